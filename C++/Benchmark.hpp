@@ -0,0 +1,474 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <regex>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+
+// защита значения от удаления оптимизатором
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+// состояние одного замера
+class BenchmarkState {
+    size_t iterations; // количество итераций
+    size_t items; // количество обработанных элементов
+    map<string, double> counters; // пользовательские счётчики
+public:
+    BenchmarkState(size_t iterations);
+
+    size_t Iterations() const; // получение количества итераций
+    void SetItemsProcessed(size_t items); // установка количества обработанных элементов
+    void SetCounter(const string& name, double value); // установка пользовательского счётчика
+
+    size_t GetItemsProcessed() const; // получение количества обработанных элементов
+    const map<string, double>& GetCounters() const; // получение пользовательских счётчиков
+};
+
+// результат замера
+struct BenchmarkResult {
+    string name; // название замера
+    size_t iterations; // количество итераций
+    double realTime; // время на итерацию, нс
+    double cpuTime; // процессорное время на итерацию, нс
+    double itemsPerSecond; // количество элементов в секунду
+    map<string, double> counters; // пользовательские счётчики
+};
+
+// аппаратный счётчик производительности
+struct PerfCounter {
+    string name; // название счётчика: cycles, instructions, branch_misses, l1d_misses, llc_misses
+    uint32_t type; // тип события perf_event_attr
+    uint64_t config; // код события
+    int fd; // дескриптор открытого счётчика
+    uint64_t start[3]; // значение, время включения и время работы при запуске замера
+};
+
+// аппаратные счётчики Linux perf_event_open для текущего процесса и потоков, созданных во время замера;
+// недоступные счётчики (другая ОС, нет PMU в виртуальной машине, perf_event_paranoid) пропускаются с предупреждением
+class PerfCounters {
+    vector<PerfCounter> counters; // открытые счётчики
+
+    bool Open(PerfCounter& counter, string& error); // открытие счётчика
+    bool Read(const PerfCounter& counter, uint64_t *data) const; // чтение значения, времени включения и времени работы
+public:
+    PerfCounters(const string& names);
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters();
+
+    bool Empty() const; // нет ни одного открытого счётчика
+    void Start(); // обнуление и запуск счётчиков
+    map<string, double> Stop(); // остановка счётчиков и чтение значений с поправкой на мультиплексирование
+};
+
+// набор замеров в стиле google benchmark
+class Benchmark {
+    vector<pair<string, function<void(BenchmarkState&)>>> benchmarks; // зарегистрированные замеры
+
+    double minTime; // минимальное время замера, с
+    string filter; // фильтр по названию
+    string format; // формат вывода в консоль
+    string out; // файл для вывода в json
+    unique_ptr<PerfCounters> perf; // аппаратные счётчики, nullptr - не запрошены
+
+    BenchmarkResult Run(const string& name, const function<void(BenchmarkState&)>& benchmark) const; // выполнение замера
+
+    void PrintConsole(ostream& os, const vector<BenchmarkResult>& results) const; // вывод результатов в виде таблицы
+    void PrintJson(ostream& os, const vector<BenchmarkResult>& results) const; // вывод результатов в json
+public:
+    Benchmark();
+
+    void Register(const string& name, function<void(BenchmarkState&)> benchmark); // регистрация замера
+    int Main(int argc, char **argv); // разбор аргументов и выполнение замеров
+};
+
+BenchmarkState::BenchmarkState(size_t iterations) {
+    this->iterations = iterations;
+    this->items = 0;
+}
+
+// получение количества итераций
+size_t BenchmarkState::Iterations() const {
+    return iterations;
+}
+
+// установка количества обработанных элементов
+void BenchmarkState::SetItemsProcessed(size_t items) {
+    this->items = items;
+}
+
+// установка пользовательского счётчика
+void BenchmarkState::SetCounter(const string& name, double value) {
+    counters[name] = value;
+}
+
+// получение количества обработанных элементов
+size_t BenchmarkState::GetItemsProcessed() const {
+    return items;
+}
+
+// получение пользовательских счётчиков
+const map<string, double>& BenchmarkState::GetCounters() const {
+    return counters;
+}
+
+PerfCounters::PerfCounters(const string& names) {
+    vector<PerfCounter> known;
+
+#ifdef __linux__
+    known = {
+        { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1, {} },
+        { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1, {} },
+        { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1, {} },
+        { "l1d_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), -1, {} },
+        { "llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1, {} } // промахи последнего уровня кэша
+    };
+#endif
+
+    string list = names.empty() || names == "all" ? "cycles,instructions,branch_misses,l1d_misses,llc_misses" : names;
+    stringstream ss(list);
+    string name;
+
+    while (getline(ss, name, ',')) {
+        auto it = find_if(known.begin(), known.end(), [&name](const PerfCounter& counter) { return counter.name == name; });
+        string error = "not supported on this platform";
+
+        if (it == known.end() && !known.empty())
+            throw string("Unknown performance counter '") + name + "'";
+
+        if (it != known.end()) {
+            PerfCounter counter = *it;
+
+            if (Open(counter, error)) {
+                counters.push_back(counter);
+                continue;
+            }
+        }
+
+        cerr << "Performance counter '" << name << "' is unavailable: " << error << endl;
+    }
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (size_t i = 0; i < counters.size(); i++)
+        close(counters[i].fd);
+#endif
+}
+
+// открытие счётчика: только пользовательский режим, чтобы хватало perf_event_paranoid <= 2,
+// inherit - учитываются потоки, созданные после открытия (пулы потоков замеров)
+bool PerfCounters::Open(PerfCounter& counter, string& error) {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter.type;
+    attr.config = counter.config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    counter.fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+
+    if (counter.fd >= 0)
+        return true;
+
+    error = strerror(errno);
+#endif
+    return false;
+}
+
+// чтение значения, времени включения и времени работы счётчика
+bool PerfCounters::Read(const PerfCounter& counter, uint64_t *data) const {
+#ifdef __linux__
+    return read(counter.fd, data, 3 * sizeof(uint64_t)) == ssize_t(3 * sizeof(uint64_t));
+#else
+    return false;
+#endif
+}
+
+// нет ни одного открытого счётчика
+bool PerfCounters::Empty() const {
+    return counters.empty();
+}
+
+// запуск счётчиков: значения запоминаются, а не обнуляются, так как PERF_EVENT_IOC_RESET
+// не сбрасывает события уже завершившихся потоков, перенесённые в счётчик через inherit
+void PerfCounters::Start() {
+#ifdef __linux__
+    for (size_t i = 0; i < counters.size(); i++)
+        if (!Read(counters[i], counters[i].start))
+            memset(counters[i].start, 0, sizeof(counters[i].start));
+
+    for (size_t i = 0; i < counters.size(); i++)
+        ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+}
+
+// остановка счётчиков и чтение приращений: если счётчиков больше, чем регистров PMU, ядро их чередует,
+// и приращение масштабируется на долю времени, в течение которой счётчик работал
+map<string, double> PerfCounters::Stop() {
+    map<string, double> values;
+
+#ifdef __linux__
+    for (size_t i = 0; i < counters.size(); i++)
+        ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+
+    for (size_t i = 0; i < counters.size(); i++) {
+        uint64_t data[3];
+
+        if (!Read(counters[i], data) || data[2] == counters[i].start[2])
+            continue;
+
+        double enabled = double(data[1] - counters[i].start[1]);
+        double running = double(data[2] - counters[i].start[2]);
+        values[counters[i].name] = double(data[0] - counters[i].start[0]) * enabled / running;
+    }
+#endif
+
+    return values;
+}
+
+Benchmark::Benchmark() {
+    minTime = 0.5;
+    filter = "";
+    format = "console";
+    out = "";
+}
+
+// регистрация замера
+void Benchmark::Register(const string& name, function<void(BenchmarkState&)> benchmark) {
+    benchmarks.push_back(make_pair(name, benchmark));
+}
+
+// выполнение замера
+BenchmarkResult Benchmark::Run(const string& name, const function<void(BenchmarkState&)>& benchmark) const {
+    size_t iterations = 1;
+
+    while (true) {
+        BenchmarkState state(iterations);
+        map<string, double> events;
+
+        if (perf)
+            perf->Start();
+
+        auto realStart = chrono::steady_clock::now();
+        clock_t cpuStart = clock();
+        benchmark(state);
+        clock_t cpuEnd = clock();
+        auto realEnd = chrono::steady_clock::now();
+
+        if (perf)
+            events = perf->Stop();
+
+        double realTime = chrono::duration<double>(realEnd - realStart).count();
+        double cpuTime = double(cpuEnd - cpuStart) / CLOCKS_PER_SEC;
+
+        // замер достаточно длинный или итераций слишком много - фиксируем результат
+        if (realTime >= minTime || iterations >= 1000000000) {
+            BenchmarkResult result;
+            result.name = name;
+            result.iterations = iterations;
+            result.realTime = realTime * 1e9 / iterations;
+            result.cpuTime = cpuTime * 1e9 / iterations;
+            result.itemsPerSecond = state.GetItemsProcessed() > 0 ? state.GetItemsProcessed() / realTime : 0;
+            result.counters = state.GetCounters();
+
+            // аппаратные события на обработанный элемент (строку, вызов), а если элементы не заданы - на итерацию
+            double items = state.GetItemsProcessed() > 0 ? double(state.GetItemsProcessed()) : double(iterations);
+
+            for (auto it = events.begin(); it != events.end(); it++)
+                result.counters[it->first + "_per_item"] = it->second / items;
+
+            if (events.count("cycles") && events.count("instructions") && events["cycles"] > 0)
+                result.counters["ipc"] = events["instructions"] / events["cycles"];
+
+            return result;
+        }
+
+        // оцениваем количество итераций, нужное для достижения минимального времени
+        double multiplier = realTime > 0 ? minTime * 1.4 / realTime : 10;
+        iterations = multiplier > 10 ? iterations * 10 : size_t(iterations * multiplier) + 1;
+    }
+}
+
+// вывод результатов в виде таблицы
+void Benchmark::PrintConsole(ostream& os, const vector<BenchmarkResult>& results) const {
+    os << left << setw(48) << "Benchmark" << right << setw(16) << "Time" << setw(16) << "CPU" << setw(14) << "Iterations" << " UserCounters..." << endl;
+    os << string(110, '-') << endl;
+
+    for (const BenchmarkResult& result : results) {
+        os << left << setw(48) << result.name << right << fixed << setprecision(1);
+        os << setw(13) << result.realTime << " ns" << setw(13) << result.cpuTime << " ns" << setw(14) << result.iterations;
+
+        if (result.itemsPerSecond > 0)
+            os << " items_per_second=" << defaultfloat << setprecision(4) << result.itemsPerSecond << "/s";
+
+        for (auto it = result.counters.begin(); it != result.counters.end(); it++)
+            os << " " << it->first << "=" << defaultfloat << setprecision(4) << it->second;
+
+        os << defaultfloat << endl;
+    }
+}
+
+// вывод результатов в json
+void Benchmark::PrintJson(ostream& os, const vector<BenchmarkResult>& results) const {
+    time_t now = time(nullptr);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    os << "{" << endl;
+    os << "  \"context\": {" << endl;
+    os << "    \"date\": \"" << date << "\"," << endl;
+    os << "    \"port\": \"C++\"," << endl;
+    os << "    \"num_cpus\": " << thread::hardware_concurrency() << "," << endl;
+#ifdef NDEBUG
+    os << "    \"library_build_type\": \"release\"" << endl;
+#else
+    os << "    \"library_build_type\": \"debug\"" << endl;
+#endif
+    os << "  }," << endl;
+    os << "  \"benchmarks\": [" << endl;
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+
+        os << "    {" << endl;
+        os << "      \"name\": \"" << result.name << "\"," << endl;
+        os << "      \"run_name\": \"" << result.name << "\"," << endl;
+        os << "      \"run_type\": \"iteration\"," << endl;
+        os << "      \"iterations\": " << result.iterations << "," << endl;
+        os << "      \"real_time\": " << setprecision(17) << result.realTime << "," << endl;
+        os << "      \"cpu_time\": " << result.cpuTime << "," << endl;
+
+        if (result.itemsPerSecond > 0)
+            os << "      \"items_per_second\": " << result.itemsPerSecond << "," << endl;
+
+        for (auto it = result.counters.begin(); it != result.counters.end(); it++)
+            os << "      \"" << it->first << "\": " << it->second << "," << endl;
+
+        os << "      \"time_unit\": \"ns\"" << endl;
+        os << "    }" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+
+    os << "  ]" << endl;
+    os << "}" << endl;
+}
+
+// разбор аргументов и выполнение замеров
+int Benchmark::Main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t eq = arg.find('=');
+        string key = arg.substr(0, eq);
+        string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+        if (key == "--benchmark_filter") {
+            filter = value;
+        }
+        else if (key == "--benchmark_format") {
+            format = value;
+        }
+        else if (key == "--benchmark_out") {
+            out = value;
+        }
+        else if (key == "--benchmark_min_time") {
+            size_t end = 0;
+
+            try {
+                minTime = stod(value, &end);
+            }
+            catch (const exception&) {
+                end = 0;
+            }
+
+            if (end == 0 || end != value.length() || !isfinite(minTime) || minTime < 0)
+                throw string("Incorrect minimum time '") + value + "'";
+        }
+        else if (key == "--benchmark_perf_counters") {
+            perf.reset(new PerfCounters(value));
+
+            if (perf->Empty())
+                perf.reset();
+        }
+        else {
+            cerr << "Unknown argument '" << arg << "'" << endl;
+            cerr << "Usage: " << argv[0] << " [--benchmark_filter=<regex>] [--benchmark_format=console|json] [--benchmark_out=<file.json>] [--benchmark_min_time=<seconds>] [--benchmark_perf_counters[=all|cycles,instructions,branch_misses,l1d_misses,llc_misses]]" << endl;
+            return 1;
+        }
+    }
+
+    if (format != "console" && format != "json") {
+        cerr << "Unknown format '" << format << "'" << endl;
+        return 1;
+    }
+
+    // фильтр - расширенное регулярное выражение POSIX, как в C/benchmark.c
+    regex pattern;
+
+    try {
+        pattern = regex(filter, regex::extended);
+    }
+    catch (const regex_error&) {
+        throw string("Incorrect benchmark filter '") + filter + "'";
+    }
+
+    vector<BenchmarkResult> results;
+
+    for (size_t i = 0; i < benchmarks.size(); i++) {
+        if (!filter.empty() && !regex_search(benchmarks[i].first, pattern))
+            continue;
+
+        results.push_back(Run(benchmarks[i].first, benchmarks[i].second));
+    }
+
+    if (format == "json")
+        PrintJson(cout, results);
+    else
+        PrintConsole(cout, results);
+
+    if (!out.empty()) {
+        ofstream fout(out);
+
+        if (!fout)
+            throw string("Unable to open file '") + out + "'";
+
+        PrintJson(fout, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include "ExpressionParser.hpp"
+
+using namespace std;
+
+// компактное скомпилированное выражение: программа, значения переменных, стек вычисления и имена переменных
+// лежат в одном непрерывном блоке, который для небольших выражений хранится внутри объекта без выделения памяти.
+// Объект только перемещается, перемещение копирует не более INLINE_SIZE байт или передаёт указатель на блок
+class CompiledExpression {
+public:
+    static constexpr size_t INLINE_SIZE = 160; // размер встроенного буфера, байт
+private:
+    alignas(Instruction) unsigned char buffer[INLINE_SIZE]; // встроенный буфер для небольших выражений
+    unsigned char *data; // блок данных: buffer или память в куче
+    uint32_t instructions; // количество инструкций
+    uint32_t variables; // количество переменных
+    uint32_t depth; // глубина стека вычисления
+    uint32_t size; // размер блока, байт
+    vector<shared_ptr<const UserFunction>> functions; // используемые пользовательские функции, на которые ссылаются инструкции
+
+    Instruction* GetProgram() const; // получение программы
+    double* GetValues() const; // получение значений переменных
+    double* GetMemory() const; // получение стека вычисления
+    uint32_t* GetNameEnds() const; // получение концов имён переменных в блоке имён
+    const char* GetNames() const; // получение блока имён переменных
+    void Release(); // освобождение блока в куче
+    void MoveFrom(CompiledExpression& expression); // перемещение данных из другого выражения
+public:
+    CompiledExpression(const ExpressionParser& parser); // конструктор из разобранного выражения
+    CompiledExpression(const string& expression, const FunctionRegistry& registry = FunctionRegistry()); // конструктор из выражения
+
+    CompiledExpression(const CompiledExpression& expression) = delete;
+    CompiledExpression& operator=(const CompiledExpression& expression) = delete;
+    CompiledExpression(CompiledExpression&& expression) noexcept;
+    CompiledExpression& operator=(CompiledExpression&& expression) noexcept;
+    ~CompiledExpression();
+
+    int GetVariableIndex(const string& name) const; // получение индекса переменной (-1, если переменной нет)
+    void SetValue(const string& name, double value); // обновление значения переменной по имени
+    void SetValue(int index, double value); // обновление значения переменной по индексу
+    double Evaluate(); // вычисление выражения
+
+    bool IsInline() const; // хранится ли выражение во встроенном буфере
+    size_t GetMemoryUsage() const; // занимаемая память вместе с самим объектом, байт
+};
+
+CompiledExpression::CompiledExpression(const ExpressionParser& parser) {
+    vector<string> names(parser.values.size());
+
+    for (auto it = parser.variables.begin(); it != parser.variables.end(); it++)
+        names[it->second] = it->first;
+
+    instructions = parser.program.size();
+    variables = names.size();
+    depth = parser.memory.size();
+
+    size_t namesSize = 0;
+
+    for (const string& name : names)
+        namesSize += name.length();
+
+    // программа, значения переменных и стек выровнены по 8 байт, за ними концы имён и сами имена
+    size = instructions * sizeof(Instruction) + (variables + depth) * sizeof(double) + variables * sizeof(uint32_t) + namesSize;
+    data = size <= INLINE_SIZE ? buffer : static_cast<unsigned char *>(::operator new(size));
+
+    if (instructions > 0)
+        memcpy(GetProgram(), parser.program.data(), instructions * sizeof(Instruction));
+
+    if (variables > 0)
+        memcpy(GetValues(), parser.values.data(), variables * sizeof(double));
+
+    uint32_t *ends = GetNameEnds();
+    char *chars = const_cast<char *>(GetNames());
+    uint32_t end = 0;
+
+    for (uint32_t i = 0; i < variables; i++) {
+        memcpy(chars + end, names[i].data(), names[i].length());
+        end += names[i].length();
+        ends[i] = end;
+    }
+
+    for (auto it = parser.userFunctions.begin(); it != parser.userFunctions.end(); it++)
+        functions.push_back(it->second);
+}
+
+CompiledExpression::CompiledExpression(const string& expression, const FunctionRegistry& registry) : CompiledExpression(ExpressionParser(expression, registry)) {
+}
+
+CompiledExpression::CompiledExpression(CompiledExpression&& expression) noexcept {
+    MoveFrom(expression);
+}
+
+CompiledExpression& CompiledExpression::operator=(CompiledExpression&& expression) noexcept {
+    if (this != &expression) {
+        Release();
+        MoveFrom(expression);
+    }
+
+    return *this;
+}
+
+CompiledExpression::~CompiledExpression() {
+    Release();
+}
+
+// получение программы
+Instruction* CompiledExpression::GetProgram() const {
+    return reinterpret_cast<Instruction *>(data);
+}
+
+// получение значений переменных
+double* CompiledExpression::GetValues() const {
+    return reinterpret_cast<double *>(data + instructions * sizeof(Instruction));
+}
+
+// получение стека вычисления
+double* CompiledExpression::GetMemory() const {
+    return GetValues() + variables;
+}
+
+// получение концов имён переменных в блоке имён
+uint32_t* CompiledExpression::GetNameEnds() const {
+    return reinterpret_cast<uint32_t *>(GetMemory() + depth);
+}
+
+// получение блока имён переменных
+const char* CompiledExpression::GetNames() const {
+    return reinterpret_cast<const char *>(GetNameEnds() + variables);
+}
+
+// освобождение блока в куче
+void CompiledExpression::Release() {
+    if (data != buffer)
+        ::operator delete(data);
+
+    data = buffer;
+    size = 0;
+}
+
+// перемещение данных из другого выражения, исходное выражение остаётся пустым
+void CompiledExpression::MoveFrom(CompiledExpression& expression) {
+    instructions = expression.instructions;
+    variables = expression.variables;
+    depth = expression.depth;
+    size = expression.size;
+    functions = move(expression.functions);
+
+    if (expression.data == expression.buffer) {
+        memcpy(buffer, expression.buffer, size);
+        data = buffer;
+    }
+    else {
+        data = expression.data;
+    }
+
+    expression.data = expression.buffer;
+    expression.instructions = 0;
+    expression.variables = 0;
+    expression.depth = 0;
+    expression.size = 0;
+}
+
+// получение индекса переменной (-1, если переменной нет)
+int CompiledExpression::GetVariableIndex(const string& name) const {
+    const uint32_t *ends = GetNameEnds();
+    const char *names = GetNames();
+
+    for (uint32_t i = 0, start = 0; i < variables; start = ends[i++])
+        if (ends[i] - start == name.length() && !memcmp(names + start, name.data(), name.length()))
+            return i;
+
+    return -1;
+}
+
+// обновление значения переменной по имени
+void CompiledExpression::SetValue(const string& name, double value) {
+    SetValue(GetVariableIndex(name), value);
+}
+
+// обновление значения переменной по индексу
+void CompiledExpression::SetValue(int index, double value) {
+    if (index >= 0 && uint32_t(index) < variables)
+        GetValues()[index] = value;
+}
+
+// вычисление выражения, совпадает с ExpressionParser::Evaluate без профилирования
+double CompiledExpression::Evaluate() {
+    if (instructions == 0)
+        throw string("Unable to evaluate moved-from expression");
+
+    const Instruction *program = GetProgram();
+    const double *values = GetValues();
+    double *memory = GetMemory();
+    double *top = memory;
+
+    for (uint32_t i = 0; i < instructions; i++) {
+        const Instruction& instruction = program[i];
+
+        switch (instruction.opcode) {
+            case Opcode::Number:
+                *top++ = instruction.value;
+                break;
+
+            case Opcode::Variable:
+                *top++ = values[instruction.index];
+                break;
+
+            case Opcode::Branch:
+                if (top[-1] == 0)
+                    i += instruction.index;
+                break;
+
+            case Opcode::Jump:
+                i += instruction.index;
+                break;
+
+            case Opcode::JumpIfFalse:
+                if (top[-1] == 0) {
+                    top[-1] = 0;
+                    i += instruction.index;
+                }
+                break;
+
+            case Opcode::JumpIfTrue:
+                if (top[-1] != 0) {
+                    top[-1] = 1;
+                    i += instruction.index;
+                }
+                break;
+
+            case Opcode::If:
+                top[-2] = top[-1];
+                top--;
+                break;
+
+            default:
+                top -= ExpressionParser::GetArgumentsCount(instruction);
+                *top = ExpressionParser::ApplyInstruction(instruction, top);
+                top++;
+        }
+    }
+
+    return memory[0];
+}
+
+// хранится ли выражение во встроенном буфере
+bool CompiledExpression::IsInline() const {
+    return data == buffer;
+}
+
+// занимаемая память вместе с самим объектом, байт
+size_t CompiledExpression::GetMemoryUsage() const {
+    return sizeof(CompiledExpression) + (IsInline() ? 0 : size) + functions.capacity() * sizeof(shared_ptr<const UserFunction>);
+}
@@ -0,0 +1,472 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <functional>
+#include "ExpressionParser.hpp"
+#include "CompiledExpression.hpp"
+
+using namespace std;
+
+// источник решений генератора: случайные числа или байты входа фаззера
+class GeneratorSource {
+    const uint8_t *data; // байты входа фаззера
+    size_t size; // количество оставшихся байтов
+    mt19937_64 random; // генератор случайных чисел, если байтов нет
+    bool fuzzing; // решения берутся из байтов
+public:
+    GeneratorSource(uint64_t seed); // решения из генератора случайных чисел
+    GeneratorSource(const uint8_t *data, size_t size); // решения из байтов, после их окончания - всегда 0
+
+    uint32_t Next(uint32_t bound); // решение из [0, bound)
+};
+
+// генератор случайных корректных выражений по грамматике парсера.
+// Бинарные операции всегда в скобках, чтобы сравнивать вычисление, а не приоритеты разных портов
+class ExpressionGenerator {
+    GeneratorSource& source; // источник решений
+    bool portable; // только конструкции, которые есть во всех портах
+    int maxDepth; // максимальная глубина вложенности
+
+    string GenerateLeaf(); // число, константа или переменная
+    string Generate(int depth); // выражение с глубиной не более depth
+public:
+    static const vector<string> VARIABLES; // переменные генерируемых выражений
+
+    ExpressionGenerator(GeneratorSource& source, bool portable, int maxDepth = 5);
+
+    string Generate(); // генерация выражения
+};
+
+// результат сравнения движка с эталоном
+struct EngineReport {
+    string name; // название движка
+    size_t evaluations = 0; // количество вычислений
+    size_t mismatches = 0; // количество расхождений с эталоном
+    size_t skipped = 0; // строки с неограниченной погрешностью эталона, которые не сравниваются
+    double seconds = 0; // суммарное время вычислений
+    string example; // первое расхождение
+};
+
+// дифференциальное сравнение всех способов вычисления выражения с эталонным EvaluateRPN:
+// оптимизированная программа, неоптимизированный уровень, регистровая программа, пакетные режимы,
+// CompiledExpression, приближённый режим, таблица значений и внешние движки (например, порт на C).
+// Расхождение - больше maxUlps ULP при относительной разнице больше relativeTolerance и разнице больше
+// удвоенной границы погрешности эталона (EvaluateErrorBound неоптимизированной программы): понижение силы
+// округляет иначе, чем pow и log, и плохо обусловленные операции (% около целого частного, tan около полюса)
+// усиливают эту разницу. Строки с бесконечной границей не сравниваются
+class DifferentialRunner {
+public:
+    typedef function<bool(const string& expression, const map<string, double>& variables, double& result)> ExternalEngine; // внешний движок, false - выражение не поддерживается
+private:
+    map<string, EngineReport> reports; // отчёты по движкам
+    vector<pair<string, ExternalEngine>> externals; // внешние движки
+    uint64_t maxUlps; // допустимое расхождение в ULP
+    double relativeTolerance; // допустимая относительная разница
+
+    static uint64_t GetUlpDistance(double a, double b); // расстояние между числами в ULP
+public:
+    static constexpr double APPROXIMATION_TOLERANCE = 1e-6; // допустимая погрешность приближённого режима
+    static constexpr double TABLE_LOW = -3.8; // левая граница области таблицы по x
+    static constexpr double TABLE_HIGH = 3.3; // правая граница области таблицы по x
+    static constexpr double TABLE_ERROR = 1e-6; // допустимая погрешность таблицы
+
+    DifferentialRunner(uint64_t maxUlps = 64, double relativeTolerance = 1e-9);
+
+    void AddExternalEngine(const string& name, ExternalEngine engine); // добавление внешнего движка
+    bool IsMatch(double reference, double result, double error = 0) const; // совпадает ли результат с эталоном с допустимой разницей error
+    size_t Run(const string& expression, const vector<map<string, double>>& rows, bool portable = false); // сравнение на строках значений, возвращает количество расхождений
+    vector<EngineReport> GetReports() const; // получение отчётов по движкам
+};
+
+GeneratorSource::GeneratorSource(uint64_t seed) : data(nullptr), size(0), random(seed), fuzzing(false) {
+}
+
+GeneratorSource::GeneratorSource(const uint8_t *data, size_t size) : data(data), size(size), random(0), fuzzing(true) {
+}
+
+// решение из [0, bound)
+uint32_t GeneratorSource::Next(uint32_t bound) {
+    if (bound <= 1)
+        return 0;
+
+    if (!fuzzing)
+        return uint32_t(random() % bound);
+
+    if (size == 0)
+        return 0;
+
+    uint32_t value = *data++;
+    size--;
+
+    if (bound > 256 && size > 0) {
+        value = value * 256 + *data++;
+        size--;
+    }
+
+    return value % bound;
+}
+
+const vector<string> ExpressionGenerator::VARIABLES = { "x", "y", "z" };
+
+ExpressionGenerator::ExpressionGenerator(GeneratorSource& source, bool portable, int maxDepth) : source(source) {
+    this->portable = portable;
+    this->maxDepth = maxDepth;
+}
+
+// число, константа или переменная
+string ExpressionGenerator::GenerateLeaf() {
+    static const vector<string> numbers = { "0", "1", "2", "3", "0.5", "10", "0.001", "1000", "2.75", "7" };
+    static const vector<string> constants = { "pi", "e" };
+    uint32_t kind = source.Next(10);
+
+    if (kind < 5)
+        return VARIABLES[source.Next(VARIABLES.size())];
+
+    if (kind < 9)
+        return numbers[source.Next(numbers.size())];
+
+    return constants[source.Next(constants.size())];
+}
+
+// выражение с глубиной не более depth
+string ExpressionGenerator::Generate(int depth) {
+    static const vector<string> operators = { "+", "-", "*", "/", "%", "^" };
+    static const vector<string> functions = { "sin", "cos", "tan", "cot", "sinh", "cosh", "tanh", "asin", "acos", "atan", "ln", "log2", "lg", "exp", "sqrt", "cbrt", "abs", "sign" };
+    static const vector<string> binaryFunctions = { "log", "pow", "root" };
+    static const vector<string> variadicFunctions = { "max", "min", "sum", "avg", "hypot" };
+    static const vector<string> comparisons = { "<", "<=", ">", ">=", "==", "!=", "&&", "||" };
+
+    if (depth <= 0 || source.Next(4) == 0)
+        return GenerateLeaf();
+
+    uint32_t kind = source.Next(portable ? 5 : 8);
+
+    if (kind <= 1)
+        return "(" + Generate(depth - 1) + " " + operators[source.Next(operators.size())] + " " + Generate(depth - 1) + ")";
+
+    if (kind == 2)
+        return functions[source.Next(functions.size())] + "(" + Generate(depth - 1) + ")";
+
+    if (kind == 3)
+        return binaryFunctions[source.Next(binaryFunctions.size())] + "(" + Generate(depth - 1) + ", " + Generate(depth - 1) + ")";
+
+    if (kind == 4)
+        return "(-" + Generate(depth - 1) + ")";
+
+    if (kind == 5) {
+        string expression = variadicFunctions[source.Next(variadicFunctions.size())] + "(" + Generate(depth - 1);
+        uint32_t count = source.Next(4);
+
+        for (uint32_t i = 0; i < count; i++)
+            expression += ", " + Generate(depth - 1);
+
+        return expression + ")";
+    }
+
+    if (kind == 6)
+        return "(" + Generate(depth - 1) + " " + comparisons[source.Next(comparisons.size())] + " " + Generate(depth - 1) + ")";
+
+    if (source.Next(2))
+        return "(!" + Generate(depth - 1) + ")";
+
+    return "if(" + Generate(depth - 1) + ", " + Generate(depth - 1) + ", " + Generate(depth - 1) + ")";
+}
+
+// генерация выражения
+string ExpressionGenerator::Generate() {
+    return Generate(maxDepth);
+}
+
+DifferentialRunner::DifferentialRunner(uint64_t maxUlps, double relativeTolerance) {
+    this->maxUlps = maxUlps;
+    this->relativeTolerance = relativeTolerance;
+}
+
+// расстояние между числами в ULP: биты отображаются в монотонную шкалу, +0 и -0 совпадают
+uint64_t DifferentialRunner::GetUlpDistance(double a, double b) {
+    int64_t ia, ib;
+    memcpy(&ia, &a, sizeof(a));
+    memcpy(&ib, &b, sizeof(b));
+
+    ia = ia < 0 ? INT64_MIN - ia : ia;
+    ib = ib < 0 ? INT64_MIN - ib : ib;
+    return ia > ib ? uint64_t(ia) - uint64_t(ib) : uint64_t(ib) - uint64_t(ia);
+}
+
+// совпадает ли результат с эталоном: NaN совпадает только с NaN, бесконечности - только с собой,
+// конечные значения - с точностью до maxUlps ULP, relativeTolerance или абсолютной разницы error
+bool DifferentialRunner::IsMatch(double reference, double result, double error) const {
+    if (isnan(reference) || isnan(result))
+        return isnan(reference) && isnan(result);
+
+    if (isinf(reference) || isinf(result))
+        return reference == result;
+
+    double difference = fabs(reference - result);
+    return GetUlpDistance(reference, result) <= maxUlps || difference <= relativeTolerance * max(fabs(reference), fabs(result)) || difference <= error;
+}
+
+// добавление внешнего движка
+void DifferentialRunner::AddExternalEngine(const string& name, ExternalEngine engine) {
+    externals.push_back(make_pair(name, engine));
+}
+
+// сравнение на строках значений, возвращает количество расхождений. Каждый движок вычисляет все строки
+// подряд, чтобы замер времени не включал переключение между движками. Внешние движки вызываются
+// только для выражений из общей для всех портов части грамматики (portable)
+size_t DifferentialRunner::Run(const string& expression, const vector<map<string, double>>& rows, bool portable) {
+    ExpressionParser optimized(expression);
+    ExpressionParser baseline(expression, FunctionRegistry(), size_t(-1)); // порог не достигается, программа остаётся неоптимизированной
+    ExpressionParser approximate(expression, FunctionRegistry(), 0, APPROXIMATION_TOLERANCE);
+    ExpressionParser tabulated(expression);
+    CompiledExpression compiled(optimized);
+
+    // таблица строится только для выражений, в которых нет других переменных, и которые удаётся табулировать
+    // с погрешностью TABLE_ERROR. Анализ зависимостей считает 0 * (y % z) нулём, но при z = 0 это NaN, поэтому
+    // таблица выражения с неиспользуемыми переменными зависит от их значений при построении
+    TableOptions options;
+    options.maxError = TABLE_ERROR;
+    options.maxSize = 1024;
+    map<string, int> degrees = tabulated.AnalyzeDependencies().degrees;
+
+    try {
+        if (degrees.size() == 1 && degrees.count("x"))
+            tabulated.Tabulate("x", TABLE_LOW, TABLE_HIGH, options);
+    }
+    catch (const string&) {
+    }
+
+    map<string, vector<double>> columns;
+    map<string, const double *> pointers;
+
+    for (const string& name : ExpressionGenerator::VARIABLES) {
+        columns[name].resize(rows.size());
+        pointers[name] = columns[name].data();
+    }
+
+    for (size_t i = 0; i < rows.size(); i++)
+        for (auto it = rows[i].begin(); it != rows[i].end(); it++)
+            columns[it->first][i] = it->second;
+
+    map<string, vector<double>> results;
+    const vector<double>& references = results["rpn"];
+
+    // вычисление строк движком со строковым интерфейсом и замер времени
+    auto runRows = [&](const string& name, function<bool(size_t, double&)> evaluate) {
+        vector<double>& values = results[name];
+        values.assign(rows.size(), NAN);
+        bool all = true;
+        auto start = chrono::steady_clock::now();
+
+        for (size_t i = 0; i < rows.size(); i++)
+            all = evaluate(i, values[i]) && all;
+
+        reports[name].seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return all;
+    };
+
+    // установка значений строки в выражение
+    auto setRow = [&](size_t i, function<void(const string&, double)> set) {
+        for (auto it = rows[i].begin(); it != rows[i].end(); it++)
+            set(it->first, it->second);
+    };
+
+    runRows("rpn", [&](size_t i, double& result) {
+        setRow(i, [&](const string& name, double value) { optimized.SetValue(name, value); });
+        result = optimized.EvaluateRPN();
+        return true;
+    });
+
+    // границы погрешности эталона: неоптимизированная программа выполняет те же операции, что и EvaluateRPN
+    vector<double> bounds(rows.size());
+
+    for (size_t i = 0; i < rows.size(); i++) {
+        setRow(i, [&](const string& name, double value) { baseline.SetValue(name, value); });
+        baseline.EvaluateErrorBound(bounds[i]);
+    }
+
+    runRows("evaluate", [&](size_t i, double& result) {
+        setRow(i, [&](const string& name, double value) { optimized.SetValue(name, value); });
+        result = optimized.Evaluate();
+        return true;
+    });
+
+    runRows("registers", [&](size_t i, double& result) {
+        setRow(i, [&](const string& name, double value) { optimized.SetValue(name, value); });
+        result = optimized.EvaluateRegisters();
+        return true;
+    });
+
+    runRows("baseline", [&](size_t i, double& result) {
+        setRow(i, [&](const string& name, double value) { baseline.SetValue(name, value); });
+        result = baseline.Evaluate();
+        return true;
+    });
+
+    runRows("compiled", [&](size_t i, double& result) {
+        setRow(i, [&](const string& name, double value) { compiled.SetValue(name, value); });
+        result = compiled.Evaluate();
+        return true;
+    });
+
+    runRows("batch", [&](size_t i, double& result) {
+        if (i == 0)
+            optimized.EvaluateBatch(pointers, results["batch"].data(), rows.size());
+
+        result = results["batch"][i];
+        return true;
+    });
+
+    runRows("registers_batch", [&](size_t i, double& result) {
+        if (i == 0)
+            optimized.EvaluateRegistersBatch(pointers, results["registers_batch"].data(), rows.size());
+
+        result = results["registers_batch"][i];
+        return true;
+    });
+
+    runRows("approximate", [&](size_t i, double& result) {
+        setRow(i, [&](const string& name, double value) { approximate.SetValue(name, value); });
+        result = approximate.Evaluate();
+        return true;
+    });
+
+    runRows("approximate_batch", [&](size_t i, double& result) {
+        if (i == 0)
+            approximate.EvaluateBatch(pointers, results["approximate_batch"].data(), rows.size());
+
+        result = results["approximate_batch"][i];
+        return true;
+    });
+
+    vector<string> names = { "rpn", "evaluate", "registers", "baseline", "compiled", "batch", "registers_batch", "approximate", "approximate_batch" };
+    vector<double> deviations(rows.size(), NAN); // отклонение эрмитовой интерполяции по узлам таблицы от эталона (NaN - не сравнивается)
+    vector<double> magnitudes(rows.size(), 1); // модуль коэффициентов интервала: их округление пропорционально ему, а не значению в x
+
+    if (tabulated.IsTabulated()) {
+        // таблица обещает погрешность только на контрольных точках и не видит узких особенностей между ними
+        // (!x в нуле, % с быстро меняющимся делителем). Поэтому для строки из области таблицы кубический многочлен
+        // Эрмита по узлам её интервала строится заново: если он описывает эталон с погрешностью TABLE_ERROR,
+        // таблица должна совпасть с ним с точностью до округления, иначе строка не сравнивается
+        size_t n = tabulated.GetTableSize();
+        double scale = n / (TABLE_HIGH - TABLE_LOW);
+
+        for (size_t i = 0; i < rows.size(); i++) {
+            double x = rows[i].count("x") ? rows[i].at("x") : NAN;
+
+            if (!(x >= TABLE_LOW && x <= TABLE_HIGH) || !isfinite(references[i]))
+                continue;
+
+            double t = (x - TABLE_LOW) * scale;
+            size_t j = min(size_t(t), n - 1);
+            double v[2], m[2];
+            setRow(i, [&](const string& name, double value) { tabulated.SetValue(name, value); });
+
+            for (size_t k = 0; k < 2; k++) {
+                tabulated.SetValue("x", j + k == n ? TABLE_HIGH : TABLE_LOW + (TABLE_HIGH - TABLE_LOW) * (j + k) / n);
+                v[k] = tabulated.EvaluateDerivative("x", m[k]);
+                m[k] /= scale;
+            }
+
+            t -= j;
+            double value = v[0] + t * (m[0] + t * (3 * (v[1] - v[0]) - 2 * m[0] - m[1] + t * (2 * (v[0] - v[1]) + m[0] + m[1])));
+            double deviation = fabs(value - references[i]);
+
+            if (deviation <= TABLE_ERROR * max(1.0, fabs(references[i]))) {
+                deviations[i] = deviation;
+                magnitudes[i] = max({ 1.0, fabs(v[0]), fabs(v[1]), fabs(m[0]), fabs(m[1]) });
+            }
+        }
+
+        runRows("tabulated", [&](size_t i, double& result) {
+            setRow(i, [&](const string& name, double value) { tabulated.SetValue(name, value); });
+            result = tabulated.Evaluate();
+            return true;
+        });
+
+        runRows("tabulated_batch", [&](size_t i, double& result) {
+            if (i == 0)
+                tabulated.EvaluateBatch(pointers, results["tabulated_batch"].data(), rows.size());
+
+            result = results["tabulated_batch"][i];
+            return true;
+        });
+
+        names.push_back("tabulated");
+        names.push_back("tabulated_batch");
+    }
+
+    for (const pair<string, ExternalEngine>& external : portable ? externals : vector<pair<string, ExternalEngine>>()) {
+        bool all = runRows(external.first, [&](size_t i, double& result) { return external.second(expression, rows[i], result); });
+
+        if (all)
+            names.push_back(external.first);
+    }
+
+    size_t mismatches = 0;
+
+    for (const string& name : names) {
+        EngineReport& report = reports[name];
+        report.name = name;
+        report.evaluations += rows.size();
+
+        for (size_t i = 0; i < rows.size(); i++) {
+            if (!isfinite(bounds[i])) {
+                report.skipped++;
+                continue;
+            }
+
+            // эталон и движок округляют независимо, приближённые ядра и таблица добавляют свою погрешность
+            double error = 2 * bounds[i];
+            double x = rows[i].count("x") ? rows[i].at("x") : NAN;
+
+            if (name.compare(0, 11, "approximate") == 0) {
+                error += approximate.GetApproximationError() * (fabs(references[i]) + bounds[i]);
+            }
+            else if (name.compare(0, 9, "tabulated") == 0 && x >= TABLE_LOW && x <= TABLE_HIGH) {
+                if (isnan(deviations[i])) {
+                    report.skipped++;
+                    continue;
+                }
+
+                error += deviations[i] + 16 * DBL_EPSILON * magnitudes[i];
+            }
+
+            if (IsMatch(references[i], results[name][i], error))
+                continue;
+
+            mismatches++;
+            report.mismatches++;
+
+            if (report.example.empty()) {
+                ostringstream os;
+                os << setprecision(17) << expression << " at";
+
+                for (auto it = rows[i].begin(); it != rows[i].end(); it++)
+                    os << " " << it->first << "=" << it->second;
+
+                os << ": " << results[name][i] << " != " << references[i];
+                report.example = os.str();
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+// получение отчётов по движкам
+vector<EngineReport> DifferentialRunner::GetReports() const {
+    vector<EngineReport> result;
+
+    for (auto it = reports.begin(); it != reports.end(); it++)
+        result.push_back(it->second);
+
+    return result;
+}
@@ -0,0 +1,421 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include "ExpressionParser.hpp"
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#define EXPRESSION_PARSER_COROUTINES
+#endif
+
+using namespace std;
+
+// ограниченная очередь с несколькими писателями и читателями без блокировок (очередь Вьюкова):
+// каждая ячейка хранит номер, по которому писатель и читатель определяют, чья сейчас очередь
+template <typename T>
+class MpmcQueue {
+    struct Cell {
+        atomic<size_t> sequence; // номер ячейки: pos - свободна для записи pos, pos + 1 - содержит значение pos
+        T value; // значение
+    };
+
+    vector<Cell> cells; // кольцевой буфер, размер - степень двойки
+    size_t mask; // маска индекса в буфере
+    alignas(64) atomic<size_t> enqueuePosition; // позиция следующей записи
+    alignas(64) atomic<size_t> dequeuePosition; // позиция следующего чтения
+
+    static size_t GetSize(size_t capacity); // размер буфера: степень двойки не меньше capacity
+public:
+    MpmcQueue(size_t capacity);
+
+    bool TryPush(const T& value); // добавление значения, false - очередь заполнена
+    bool TryPop(T& value); // извлечение значения, false - очередь пуста
+    bool IsEmpty() const; // приблизительная проверка на пустоту
+};
+
+// результат вычисления задания
+struct EvaluationResult {
+    vector<double> values; // значения выражения по строкам
+    string error; // текст ошибки вычисления (пуст при успехе)
+};
+
+// статистика сервиса вычислений, задержки считаются от постановки задания в очередь до его завершения
+struct ServiceStatistics {
+    size_t jobs = 0; // количество выполненных заданий
+    size_t batches = 0; // количество вызовов пакетного вычисления после объединения заданий
+    size_t rows = 0; // количество вычисленных строк
+    double throughput = 0; // строк в секунду с момента создания сервиса
+    double p50 = 0; // медиана задержки, мкс
+    double p90 = 0; // 90-й перцентиль задержки, мкс
+    double p99 = 0; // 99-й перцентиль задержки, мкс
+    double max = 0; // максимальная задержка, мкс
+};
+
+// сервис вычислений: задания из любых потоков попадают в очередь без блокировок, рабочие потоки
+// забирают все доступные задания и объединяют задания одного выражения с одинаковым набором столбцов
+// в один вызов EvaluateBatch
+class EvaluationService {
+    // задание: выражение, столбцы значений переменных и обработчик результата
+    struct Job {
+        shared_ptr<const ExpressionParser> formula; // вычисляемое выражение
+        map<string, vector<double>> columns; // столбцы значений переменных
+        size_t count; // количество строк
+        function<void(EvaluationResult&&)> callback; // обработчик результата, вызывается в рабочем потоке
+        chrono::steady_clock::time_point submitted; // время постановки в очередь
+    };
+
+    static constexpr size_t LATENCY_SAMPLES = 65536; // количество последних задержек для перцентилей
+    static constexpr size_t MAX_BATCH_JOBS = 256; // максимальное количество заданий, забираемых из очереди за раз
+
+    MpmcQueue<Job *> queue; // очередь заданий
+    vector<thread> workers; // рабочие потоки
+    atomic<bool> stopping; // сервис останавливается
+    atomic<int> sleepers; // количество ожидающих рабочих потоков
+    mutex sleepMutex; // защита ожидания рабочих потоков
+    condition_variable wakeup; // пробуждение рабочих потоков
+
+    mutable mutex statisticsMutex; // защита статистики
+    vector<double> latencies; // последние задержки, мкс
+    size_t latencyIndex; // позиция следующей задержки в кольцевом буфере
+    ServiceStatistics statistics; // накопленные счётчики
+    chrono::steady_clock::time_point started; // время создания сервиса
+
+    void Work(); // цикл рабочего потока
+    void Process(vector<Job *>& jobs); // объединение и вычисление заданий
+    static string GetColumnsKey(const Job& job); // ключ набора столбцов задания
+public:
+    EvaluationService(size_t threads = 1, size_t capacity = 1024);
+    ~EvaluationService();
+
+    EvaluationService(const EvaluationService& service) = delete;
+    EvaluationService& operator=(const EvaluationService& service) = delete;
+
+    void Submit(shared_ptr<const ExpressionParser> formula, map<string, vector<double>> columns, function<void(EvaluationResult&&)> callback); // постановка задания с обработчиком результата
+    future<vector<double>> Submit(shared_ptr<const ExpressionParser> formula, map<string, vector<double>> columns); // постановка задания с получением результата через future
+
+#ifdef EXPRESSION_PARSER_COROUTINES
+    // ожидание результата задания в сопрограмме: co_await service.Evaluate(formula, columns)
+    struct Awaitable {
+        EvaluationService *service; // сервис вычислений
+        shared_ptr<const ExpressionParser> formula; // вычисляемое выражение
+        map<string, vector<double>> columns; // столбцы значений переменных
+        EvaluationResult result; // результат, заполняется перед возобновлением сопрограммы
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<> handle);
+        vector<double> await_resume();
+    };
+
+    Awaitable Evaluate(shared_ptr<const ExpressionParser> formula, map<string, vector<double>> columns); // задание для co_await
+#endif
+
+    ServiceStatistics GetStatistics() const; // получение статистики
+};
+
+template <typename T>
+MpmcQueue<T>::MpmcQueue(size_t capacity) : cells(GetSize(capacity)) {
+    mask = cells.size() - 1;
+
+    for (size_t i = 0; i < cells.size(); i++)
+        cells[i].sequence.store(i, memory_order_relaxed);
+
+    enqueuePosition.store(0, memory_order_relaxed);
+    dequeuePosition.store(0, memory_order_relaxed);
+}
+
+// размер буфера: степень двойки не меньше capacity
+template <typename T>
+size_t MpmcQueue<T>::GetSize(size_t capacity) {
+    size_t size = 2;
+
+    while (size < capacity)
+        size *= 2;
+
+    return size;
+}
+
+// добавление значения, false - очередь заполнена
+template <typename T>
+bool MpmcQueue<T>::TryPush(const T& value) {
+    size_t position = enqueuePosition.load(memory_order_relaxed);
+
+    while (true) {
+        Cell& cell = cells[position & mask];
+        size_t sequence = cell.sequence.load(memory_order_acquire);
+        intptr_t difference = intptr_t(sequence) - intptr_t(position);
+
+        if (difference == 0) {
+            if (enqueuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                cell.value = value;
+                cell.sequence.store(position + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0) {
+            return false; // ячейка ещё не прочитана с предыдущего круга
+        }
+        else {
+            position = enqueuePosition.load(memory_order_relaxed);
+        }
+    }
+}
+
+// извлечение значения, false - очередь пуста
+template <typename T>
+bool MpmcQueue<T>::TryPop(T& value) {
+    size_t position = dequeuePosition.load(memory_order_relaxed);
+
+    while (true) {
+        Cell& cell = cells[position & mask];
+        size_t sequence = cell.sequence.load(memory_order_acquire);
+        intptr_t difference = intptr_t(sequence) - intptr_t(position + 1);
+
+        if (difference == 0) {
+            if (dequeuePosition.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                value = cell.value;
+                cell.sequence.store(position + mask + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0) {
+            return false; // ячейка ещё не записана
+        }
+        else {
+            position = dequeuePosition.load(memory_order_relaxed);
+        }
+    }
+}
+
+// приблизительная проверка на пустоту
+template <typename T>
+bool MpmcQueue<T>::IsEmpty() const {
+    return dequeuePosition.load(memory_order_acquire) >= enqueuePosition.load(memory_order_acquire);
+}
+
+EvaluationService::EvaluationService(size_t threads, size_t capacity) : queue(capacity), stopping(false), sleepers(0) {
+    if (threads == 0)
+        throw string("Evaluation service needs at least one thread");
+
+    latencies.assign(LATENCY_SAMPLES, 0);
+    latencyIndex = 0;
+    started = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < threads; i++)
+        workers.push_back(thread(&EvaluationService::Work, this));
+}
+
+// остановка сервиса: задания, уже поставленные в очередь, выполняются
+EvaluationService::~EvaluationService() {
+    stopping = true;
+
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        wakeup.notify_all();
+    }
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+// постановка задания с обработчиком результата, при заполненной очереди поток ждёт освобождения места
+void EvaluationService::Submit(shared_ptr<const ExpressionParser> formula, map<string, vector<double>> columns, function<void(EvaluationResult&&)> callback) {
+    if (!formula)
+        throw string("Formula is not set");
+
+    size_t count = columns.empty() ? 1 : columns.begin()->second.size();
+
+    for (auto it = columns.begin(); it != columns.end(); it++)
+        if (it->second.size() != count)
+            throw string("Column '") + it->first + "' has incorrect size";
+
+    Job *job = new Job({ formula, move(columns), count, move(callback), chrono::steady_clock::now() });
+
+    while (!queue.TryPush(job))
+        this_thread::yield();
+
+    if (sleepers.load() > 0) {
+        lock_guard<mutex> lock(sleepMutex);
+        wakeup.notify_one();
+    }
+}
+
+// постановка задания с получением результата через future, ошибка вычисления передаётся исключением string
+future<vector<double>> EvaluationService::Submit(shared_ptr<const ExpressionParser> formula, map<string, vector<double>> columns) {
+    shared_ptr<promise<vector<double>>> result = make_shared<promise<vector<double>>>();
+    future<vector<double>> values = result->get_future();
+
+    Submit(formula, move(columns), [result](EvaluationResult&& evaluation) {
+        if (evaluation.error.empty())
+            result->set_value(move(evaluation.values));
+        else
+            result->set_exception(make_exception_ptr(evaluation.error));
+    });
+
+    return values;
+}
+
+#ifdef EXPRESSION_PARSER_COROUTINES
+// постановка задания, сопрограмма возобновляется в рабочем потоке после вычисления
+void EvaluationService::Awaitable::await_suspend(coroutine_handle<> handle) {
+    service->Submit(formula, move(columns), [this, handle](EvaluationResult&& evaluation) {
+        result = move(evaluation);
+        handle.resume();
+    });
+}
+
+// получение результата, ошибка вычисления передаётся исключением string
+vector<double> EvaluationService::Awaitable::await_resume() {
+    if (!result.error.empty())
+        throw result.error;
+
+    return move(result.values);
+}
+
+// задание для co_await
+EvaluationService::Awaitable EvaluationService::Evaluate(shared_ptr<const ExpressionParser> formula, map<string, vector<double>> columns) {
+    return { this, formula, move(columns), EvaluationResult() };
+}
+#endif
+
+// цикл рабочего потока: забираем все доступные задания, при пустой очереди засыпаем
+void EvaluationService::Work() {
+    vector<Job *> jobs;
+
+    while (true) {
+        Job *job;
+
+        while (jobs.size() < MAX_BATCH_JOBS && queue.TryPop(job))
+            jobs.push_back(job);
+
+        if (!jobs.empty()) {
+            Process(jobs);
+            jobs.clear();
+            continue;
+        }
+
+        if (stopping)
+            return;
+
+        unique_lock<mutex> lock(sleepMutex);
+        sleepers++;
+        wakeup.wait_for(lock, chrono::milliseconds(1), [this]() { return stopping || !queue.IsEmpty(); }); // тайм-аут страхует от потерянного пробуждения
+        sleepers--;
+    }
+}
+
+// ключ набора столбцов задания: задания объединяются, только если у них одинаковые столбцы
+string EvaluationService::GetColumnsKey(const Job& job) {
+    string key = "";
+
+    for (auto it = job.columns.begin(); it != job.columns.end(); it++)
+        key += it->first + ",";
+
+    return key;
+}
+
+// объединение заданий одного выражения с одинаковыми столбцами и их вычисление одним пакетом,
+// статистика обновляется до вызова обработчиков, чтобы завершённые задания уже были в ней учтены
+void EvaluationService::Process(vector<Job *>& jobs) {
+    map<pair<const ExpressionParser *, string>, vector<Job *>> groups;
+
+    for (Job *job : jobs)
+        groups[make_pair(job->formula.get(), GetColumnsKey(*job))].push_back(job);
+
+    vector<pair<Job *, EvaluationResult>> results;
+    size_t rows = 0;
+
+    for (auto it = groups.begin(); it != groups.end(); it++) {
+        vector<Job *>& group = it->second;
+        size_t count = 0;
+
+        for (Job *job : group)
+            count += job->count;
+
+        // склеиваем столбцы заданий группы в общие столбцы
+        map<string, vector<double>> columns;
+        map<string, const double *> pointers;
+
+        for (auto column = group[0]->columns.begin(); column != group[0]->columns.end(); column++) {
+            vector<double>& values = columns[column->first];
+            values.reserve(count);
+
+            for (Job *job : group)
+                values.insert(values.end(), job->columns[column->first].begin(), job->columns[column->first].end());
+
+            pointers[column->first] = values.data();
+        }
+
+        vector<double> values(count);
+        string error = "";
+
+        try {
+            it->first.first->EvaluateBatch(pointers, values.data(), count);
+        }
+        catch (const string& e) {
+            error = e;
+        }
+
+        size_t offset = 0;
+
+        for (Job *job : group) {
+            EvaluationResult result;
+            result.error = error;
+
+            if (error.empty())
+                result.values.assign(values.begin() + offset, values.begin() + offset + job->count);
+
+            offset += job->count;
+            results.push_back(make_pair(job, move(result)));
+        }
+
+        rows += count;
+    }
+
+    auto now = chrono::steady_clock::now();
+
+    {
+        lock_guard<mutex> lock(statisticsMutex);
+        statistics.jobs += results.size();
+        statistics.batches += groups.size();
+        statistics.rows += rows;
+
+        for (auto& result : results)
+            latencies[latencyIndex++ % LATENCY_SAMPLES] = chrono::duration<double, micro>(now - result.first->submitted).count();
+    }
+
+    for (auto& result : results) {
+        result.first->callback(move(result.second));
+        delete result.first;
+    }
+}
+
+// получение статистики: перцентили по последним LATENCY_SAMPLES заданиям
+ServiceStatistics EvaluationService::GetStatistics() const {
+    lock_guard<mutex> lock(statisticsMutex);
+    ServiceStatistics result = statistics;
+    vector<double> samples(latencies.begin(), latencies.begin() + min(latencyIndex, LATENCY_SAMPLES));
+
+    if (!samples.empty()) {
+        sort(samples.begin(), samples.end());
+        result.p50 = samples[(samples.size() - 1) * 50 / 100];
+        result.p90 = samples[(samples.size() - 1) * 90 / 100];
+        result.p99 = samples[(samples.size() - 1) * 99 / 100];
+        result.max = samples.back();
+    }
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    result.throughput = elapsed > 0 ? result.rows / elapsed : 0;
+    return result;
+}
@@ -1,43 +1,648 @@
+#pragma once
+
 #include <iostream>
 #include <cmath>
 #include <string>
 #include <vector>
 #include <map>
 #include <stack>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+#include <tuple>
+#include <cstring>
+#include <thread>
+#include <cstdint>
+#include <climits>
+#include <cfloat>
+#include <atomic>
+#include <future>
+#include <mutex>
+
+#if defined(EXPRESSION_PARSER_PROFILING) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
 
 using namespace std;
 
+// статистика выполнения операции
+struct OperationStatistics {
+    size_t count = 0; // количество выполнений
+    unsigned long long cycles = 0; // суммарное количество тактов
+};
+
+// статистика выражения (собирается только при определённом EXPRESSION_PARSER_PROFILING)
+struct ExpressionStatistics {
+    double parseTime = 0; // время разбора, с
+    size_t evaluations = 0; // количество вычислений
+    double evaluationTime = 0; // суммарное время вычислений, с
+    unsigned long long evaluationCycles = 0; // суммарное количество тактов вычислений
+    map<string, OperationStatistics> operations; // статистика по операциям и функциям
+};
+
+// пользовательская функция
+struct UserFunction {
+    int arity; // количество аргументов
+    double (*function)(const void *context, const double *args); // вычисление по аргументам
+    void (*batch)(const void *context, const double * const *args, double *result, size_t count); // вычисление на блоке значений (может отсутствовать)
+    shared_ptr<const void> context; // функтор, вызываемый из function и batch
+};
+
+// реестр пользовательских функций и констант, подключаемых к выражению при компиляции
+// функции должны быть чистыми: вызовы от чисел вычисляются один раз при компиляции
+// встроенные функции и константы имеют приоритет над зарегистрированными с тем же именем
+class FunctionRegistry {
+    map<string, shared_ptr<const UserFunction>> functions; // функции
+    map<string, double> constants; // константы
+
+    template <typename F>
+    static double CallUnary(const void *context, const double *args); // вызов унарного функтора
+    template <typename F>
+    static double CallBinary(const void *context, const double *args); // вызов бинарного функтора
+    template <typename F>
+    static double CallFunction(const void *context, const double *args); // вызов функтора от массива аргументов
+    template <typename F, typename B>
+    static double CallPairFunction(const void *context, const double *args); // вызов функтора из пары с блочным вариантом
+    template <typename F, typename B>
+    static void CallPairBatch(const void *context, const double * const *args, double *result, size_t count); // вызов блочного функтора из пары
+
+    void CheckName(const string& name) const; // проверка имени функции или константы
+    void AddFunction(const string& name, int arity, double (*function)(const void *, const double *), void (*batch)(const void *, const double * const *, double *, size_t), shared_ptr<const void> context); // добавление функции
+public:
+    template <typename F>
+    void AddUnaryFunction(const string& name, F function); // добавление функции f(x)
+    template <typename F>
+    void AddBinaryFunction(const string& name, F function); // добавление функции f(x, y)
+    template <typename F>
+    void AddFunction(const string& name, int arity, F function); // добавление функции f(const double *args) от arity аргументов
+    template <typename F, typename B>
+    void AddFunction(const string& name, int arity, F function, B batch); // добавление функции с блочным вариантом batch(const double * const *args, double *result, size_t count)
+    void AddConstant(const string& name, double value); // добавление константы
+
+    shared_ptr<const UserFunction> FindFunction(const string& name) const; // поиск функции
+    bool FindConstant(const string& name, double& value) const; // поиск константы
+};
+
+// вид лексемы
+enum class LexemeType {
+    Unknown, Number, Constant, UserConstant, Variable, Function, UserFunction,
+    Operator, Not, Negate, Comma, LeftBracket, RightBracket
+};
+
+// уникальная лексема выражения: вид, приоритет и значение определяются один раз при разборе,
+// текст хранится в общей строке пула, поэтому лексема занимает 32 байта без отдельных выделений памяти
+struct Lexeme {
+    int start; // начало текста лексемы в общей строке
+    int length; // длина текста лексемы
+    LexemeType type; // вид лексемы
+    int priority; // приоритет операции или функции
+    int arity; // количество аргументов функции (0 - произвольное)
+    int index; // индекс переменной
+    double value; // значение числа или константы
+};
+
+// коды инструкций скомпилированной программы
+enum class Opcode {
+    Number, Variable, Call,
+    Neg, Add, Sub, Mul, Div, Mod, Pow,
+    Sin, Cos, Tan, Cot, Sinh, Cosh, Tanh, Asin, Acos, Atan, Ln, Log2, Lg, Exp, Sqrt, Cbrt, Abs, Sign,
+    Log, Root,
+    Max, Min, Sum, Avg, Hypot, // функции от произвольного количества аргументов
+    Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, And, Or, Not, If, // сравнения, логические операции и условие
+    Branch, Jump, JumpIfFalse, JumpIfTrue, // переходы для сокращённого вычисления условий, пропускают index инструкций
+    Square, Cube, PowInt, Reciprocal, Root2, InverseSqrt, Root3, LogBase, Exp2, // результаты понижения силы операций
+    MulAdd, AddMul, MulSub, SubMul, SumSquares, NegAdd, // суперинструкции: a*b + c, c + a*b, a*b - c, c - a*b, a*a + b*b, -a + b
+    SinApprox, CosApprox, ExpApprox, LnApprox // приближённые ядра, index - вариант (0 - быстрый, 1 - точный)
+};
+
+// инструкция скомпилированной программы
+struct Instruction {
+    Opcode opcode; // код инструкции
+    int index; // индекс переменной, целый показатель степени или количество аргументов функции
+    double value; // значение числа или множитель логарифма
+    const UserFunction *function = nullptr; // вызываемая пользовательская функция
+};
+
+// инструкция регистровой программы: registers[target] = instruction(registers[arguments[0]], ...)
+struct RegisterInstruction {
+    Instruction instruction; // выполняемая операция
+    int target; // регистр результата
+    int arguments; // индекс первого номера регистра аргумента в общем массиве аргументов
+};
+
+// 128-битный структурный хеш выражения, не зависящий от запуска и платформы
+struct ExpressionHash {
+    uint64_t high; // старшие 64 бита
+    uint64_t low; // младшие 64 бита
+
+    bool operator==(const ExpressionHash& hash) const { return high == hash.high && low == hash.low; }
+    bool operator!=(const ExpressionHash& hash) const { return !(*this == hash); }
+    bool operator<(const ExpressionHash& hash) const { return high < hash.high || (high == hash.high && low < hash.low); }
+};
+
+// сетка узлов таблицы значений выражения
+enum class TableGrid {
+    Uniform, // равномерная сетка с кусочной интерполяцией, поиск интервала одним умножением
+    Chebyshev // узлы Чебышёва, интерполяционный многочлен вычисляется по схеме Кленшоу
+};
+
+// интерполяция между узлами равномерной сетки
+enum class TableInterpolation {
+    Linear, // линейная, погрешность O(h^2)
+    Cubic // кубическая Эрмита по значениям и производным в узлах, погрешность O(h^4)
+};
+
+// параметры табулирования выражения от одной переменной
+struct TableOptions {
+    TableGrid grid = TableGrid::Uniform; // сетка узлов
+    TableInterpolation interpolation = TableInterpolation::Cubic; // интерполяция равномерной сетки
+    double maxError = 1e-9; // допустимая погрешность: абсолютная при |f| <= 1, относительная при |f| > 1
+    size_t maxSize = 1 << 16; // наибольшее количество интервалов (коэффициентов Чебышёва - не больше 1024)
+};
+
+// таблица значений выражения от одной переменной на отрезке [low, high]
+struct ExpressionTable {
+    int variable = -1; // индекс переменной
+    double low = 0; // левая граница области
+    double high = 0; // правая граница области
+    double scale = 0; // интервалов на единицу переменной (для Чебышёва - 2 / (high - low))
+    size_t size = 0; // количество интервалов или коэффициентов Чебышёва
+    size_t stride = 0; // количество коэффициентов многочлена на интервал (0 - многочлен Чебышёва)
+    vector<double> coefficients; // коэффициенты многочленов интервалов по t из [0, 1) или коэффициенты Чебышёва
+    double error = 0; // наибольшая погрешность на контрольных точках
+};
+
+// результат проверки приближённого режима на выборке значений переменных
+struct ApproximationCheck {
+    size_t samples = 0; // количество проверенных строк
+    size_t violations = 0; // количество строк с относительной погрешностью больше допустимой
+    double maxError = 0; // наибольшая относительная погрешность (абсолютная, если точное значение равно нулю)
+    double tolerance = 0; // допустимая относительная погрешность выражения
+};
+
+// результат анализа зависимостей выражения от переменных после свёртки констант.
+// Анализ считает значения переменных конечными, поэтому x*0 и x - x не зависят от x
+struct DependencyAnalysis {
+    bool constant = false; // значение выражения известно и не зависит от переменных
+    double value = NAN; // значение постоянного выражения
+    map<string, int> degrees; // степень многочлена по каждой переменной выражения: 0 - не влияет на результат, -1 - влияет не как многочлен
+
+    vector<string> GetUsedVariables() const; // переменные, влияющие на результат
+    vector<string> GetUnusedVariables() const; // переменные выражения, не влияющие на результат
+    bool IsLinear(const string& name) const; // зависит ли результат от переменной линейно (или не зависит)
+};
+
+// узел анализа зависимостей: известное значение или разреженные степени по индексам переменных
+struct DependencyNode {
+    bool constant = false; // значение узла известно
+    double value = 0; // значение узла
+    map<int, int> degrees; // степени по индексам переменных, от которых зависит узел (-1 - не многочлен)
+    size_t start = 0; // начало операнда в программе
+};
+
+class ExpressionParser;
+
+// состояние многоуровневой компиляции: счётчик вычислений, фоновая оптимизация программы и отложенное построение
+// канонической формы и регистровой программы. При копировании выражения копируется только уровень, счётчик и признак
+// построения, фоновая оптимизация запускается копией заново
+struct TierState {
+    bool optimized = true; // программа уже оптимизирована
+    size_t evaluations = 0; // количество вычислений неоптимизированной программы
+    atomic<bool> ready; // фоновая оптимизация завершена, программу можно подменить
+    mutable atomic<bool> analyzed; // каноническая форма и регистровая программа построены
+    mutable mutex analysis; // защита построения канонической формы и регистровой программы из константных методов
+    unique_ptr<ExpressionParser> result; // копия выражения, оптимизируемая в фоне
+    future<void> worker; // фоновая оптимизация
+
+    TierState();
+    TierState(const TierState& state);
+    TierState& operator=(const TierState& state);
+    ~TierState();
+
+    void Wait(); // ожидание завершения фоновой оптимизации
+};
+
+// ось перебора значений переменной: диапазон от start до stop включительно с шагом step или список значений
+struct SweepAxis {
+    string name; // название переменной
+    double start; // начало диапазона
+    double step; // шаг диапазона
+    size_t count; // количество значений
+    vector<double> values; // список значений (пуст для диапазона)
+
+    SweepAxis(const string& name, double start, double stop, double step); // ось-диапазон
+    SweepAxis(const string& name, const vector<double>& values); // ось-список
+
+    double GetValue(size_t index) const; // получение значения с индексом index
+};
+
+SweepAxis::SweepAxis(const string& name, double start, double stop, double step) {
+    if (step == 0 || (stop - start) * step < 0 || isnan(start) || isnan(stop) || isnan(step))
+        throw string("Incorrect sweep range for '") + name + "'";
+
+    this->name = name;
+    this->start = start;
+    this->step = step;
+    this->count = size_t(floor((stop - start) / step + 1e-9)) + 1; // stop входит в диапазон с учётом погрешности шага
+}
+
+SweepAxis::SweepAxis(const string& name, const vector<double>& values) {
+    this->name = name;
+    this->start = 0;
+    this->step = 0;
+    this->count = values.size();
+    this->values = values;
+}
+
+// получение значения с индексом index, значения диапазона вычисляются без накопления ошибки шага
+double SweepAxis::GetValue(size_t index) const {
+    return values.empty() ? start + index * step : values[index];
+}
+
+// значение переменной при поэлементном вычислении: массив из size значений или скаляр, растягиваемый на все элементы.
+// Массив не копируется и должен существовать до конца вычисления
+struct ValueSpan {
+    const double *data; // значения массива (nullptr для скаляра)
+    size_t size; // количество значений (1 для скаляра)
+    double scalar; // значение скаляра
+
+    ValueSpan(double value); // скаляр
+    ValueSpan(const double *data, size_t size); // массив
+    ValueSpan(const vector<double>& values); // массив из вектора
+
+    double GetValue(size_t index) const; // получение значения с индексом index
+};
+
+ValueSpan::ValueSpan(double value) {
+    this->data = nullptr;
+    this->size = 1;
+    this->scalar = value;
+}
+
+ValueSpan::ValueSpan(const double *data, size_t size) {
+    this->data = data;
+    this->size = size;
+    this->scalar = size == 1 ? data[0] : 0;
+}
+
+ValueSpan::ValueSpan(const vector<double>& values) : ValueSpan(values.data(), values.size()) {
+}
+
+// получение значения с индексом index, массив из одного значения растягивается как скаляр
+double ValueSpan::GetValue(size_t index) const {
+    return size == 1 ? scalar : data[index];
+}
+
+// способ суммирования в свёртках
+enum class Summation {
+    Naive, // последовательное суммирование
+    Kahan, // компенсированное суммирование Кэхэна в варианте Ноймайера
+    Pairwise // попарное суммирование, погрешность растёт как log(n)
+};
+
+// параметры свёртки выражения по строкам
+struct ReductionOptions {
+    Summation summation = Summation::Pairwise; // способ суммирования
+    size_t threads = 1; // количество потоков
+    size_t bins = 0; // количество интервалов гистограммы (0 - без гистограммы)
+    double low = 0; // левая граница гистограммы
+    double high = 1; // правая граница гистограммы (значение high попадает в последний интервал)
+};
+
+// результат свёртки выражения по строкам, строки со значением NaN не учитываются
+struct Reduction {
+    size_t count = 0; // количество строк с числовым значением
+    size_t nans = 0; // количество строк со значением NaN
+    double sum = 0; // сумма значений
+    double min = NAN; // минимальное значение
+    double max = NAN; // максимальное значение
+    double mean = NAN; // среднее значение
+    vector<size_t> histogram; // количество значений в интервалах гистограммы
+    size_t outliers = 0; // количество значений вне границ гистограммы
+};
+
+// вызов унарного функтора
+template <typename F>
+double FunctionRegistry::CallUnary(const void *context, const double *args) {
+    return (*static_cast<const F *>(context))(args[0]);
+}
+
+// вызов бинарного функтора
+template <typename F>
+double FunctionRegistry::CallBinary(const void *context, const double *args) {
+    return (*static_cast<const F *>(context))(args[0], args[1]);
+}
+
+// вызов функтора от массива аргументов
+template <typename F>
+double FunctionRegistry::CallFunction(const void *context, const double *args) {
+    return (*static_cast<const F *>(context))(args);
+}
+
+// вызов функтора из пары с блочным вариантом
+template <typename F, typename B>
+double FunctionRegistry::CallPairFunction(const void *context, const double *args) {
+    return static_cast<const pair<F, B> *>(context)->first(args);
+}
+
+// вызов блочного функтора из пары
+template <typename F, typename B>
+void FunctionRegistry::CallPairBatch(const void *context, const double * const *args, double *result, size_t count) {
+    static_cast<const pair<F, B> *>(context)->second(args, result, count);
+}
+
+// проверка имени функции или константы
+void FunctionRegistry::CheckName(const string& name) const {
+    bool correct = name.length() > 0 && isalpha(name[0]);
+
+    for (size_t i = 1; i < name.length() && correct; i++)
+        correct = isalnum(name[i]);
+
+    if (!correct)
+        throw string("Incorrect function or constant name '") + name + "'";
+
+    if (functions.find(name) != functions.end() || constants.find(name) != constants.end())
+        throw string("Function or constant '") + name + "' is already registered";
+}
+
+// добавление функции
+void FunctionRegistry::AddFunction(const string& name, int arity, double (*function)(const void *, const double *), void (*batch)(const void *, const double * const *, double *, size_t), shared_ptr<const void> context) {
+    CheckName(name);
+
+    if (arity < 1)
+        throw string("Function '") + name + "' must have at least one argument";
+
+    functions[name] = shared_ptr<const UserFunction>(new UserFunction({ arity, function, batch, context }));
+}
+
+// добавление функции f(x)
+template <typename F>
+void FunctionRegistry::AddUnaryFunction(const string& name, F function) {
+    AddFunction(name, 1, CallUnary<F>, nullptr, make_shared<F>(function));
+}
+
+// добавление функции f(x, y)
+template <typename F>
+void FunctionRegistry::AddBinaryFunction(const string& name, F function) {
+    AddFunction(name, 2, CallBinary<F>, nullptr, make_shared<F>(function));
+}
+
+// добавление функции f(const double *args) от arity аргументов
+template <typename F>
+void FunctionRegistry::AddFunction(const string& name, int arity, F function) {
+    AddFunction(name, arity, CallFunction<F>, nullptr, make_shared<F>(function));
+}
+
+// добавление функции с блочным вариантом batch(const double * const *args, double *result, size_t count)
+// результат блочного варианта может совпадать с первым аргументом
+template <typename F, typename B>
+void FunctionRegistry::AddFunction(const string& name, int arity, F function, B batch) {
+    AddFunction(name, arity, CallPairFunction<F, B>, CallPairBatch<F, B>, make_shared<pair<F, B>>(function, batch));
+}
+
+// добавление константы
+void FunctionRegistry::AddConstant(const string& name, double value) {
+    CheckName(name);
+    constants[name] = value;
+}
+
+// поиск функции
+shared_ptr<const UserFunction> FunctionRegistry::FindFunction(const string& name) const {
+    auto it = functions.find(name);
+    return it == functions.end() ? nullptr : it->second;
+}
+
+// поиск константы
+bool FunctionRegistry::FindConstant(const string& name, double& value) const {
+    auto it = constants.find(name);
+
+    if (it == constants.end())
+        return false;
+
+    value = it->second;
+    return true;
+}
+
 class ExpressionParser {
-    vector<string> lexemes; // лексемы
-    vector<string> rpn; // польская запись
-    map<string, double> variables; // переменные
+    vector<Lexeme> lexemePool; // уникальные лексемы выражения
+    string lexemeText; // тексты уникальных лексем подряд
+    vector<int> lexemes; // лексемы (номера в пуле)
+    vector<int> rpn; // польская запись (номера лексем в пуле)
+    map<string, int> variables; // индексы переменных
+    vector<double> values; // значения переменных
+    map<string, shared_ptr<const UserFunction>> userFunctions; // используемые пользовательские функции
+    map<string, double> userConstants; // используемые пользовательские константы
+
+    vector<Instruction> program; // скомпилированная программа
+    vector<double> memory; // стек для вычисления программы
+
+    // регистровая программа и каноническая форма строятся при первом обращении (Analyze)
+    mutable vector<RegisterInstruction> registerProgram; // регистровая программа
+    mutable vector<int> registerArguments; // номера регистров аргументов инструкций регистровой программы
+    mutable vector<double> registers; // регистры: значения переменных, константы, затем временные значения
+    mutable vector<double> registerRow; // аргументы инструкции при вычислении регистровой программы
+    mutable int registerTemporaries; // первый временный регистр
+    mutable int registerResult; // регистр с результатом выражения
+
+    mutable string canonical; // каноническая форма выражения
+    mutable ExpressionHash hash; // структурный хеш канонической формы
+
+    ExpressionTable table; // таблица значений для выражения от одной переменной (пустая - без таблицы)
+    size_t tierThreshold; // количество вычислений до фоновой оптимизации (0 - оптимизация при создании)
+    double tolerance; // допустимая относительная погрешность приближённого режима (0 - точное вычисление)
+    double approximationError; // оценка относительной погрешности выбранных приближённых ядер
+    TierState tier; // состояние многоуровневой компиляции
+#ifdef EXPRESSION_PARSER_PROFILING
+    ExpressionStatistics statistics; // статистика выражения
+    vector<OperationStatistics> profile; // статистика по инструкциям программы
+
+    static unsigned long long ReadCycles(); // чтение счётчика тактов
+#endif
 
     bool IsDigit(char c) const; // проверка на цифру
     bool IsLetter(char c) const; // проверка на букву
-    void SplitToLexemes(const string& s); // разбиение выражения на лексемы
+    static uint32_t HashLexeme(const char *text, size_t length); // хеш текста лексемы
+    int InternLexeme(const char *text, size_t length, vector<int>& indices); // получение номера лексемы в пуле с добавлением новой
+    string GetLexemeText(int index) const; // получение текста лексемы из пула
+    void SplitToLexemes(const string& s, vector<int>& indices); // разбиение выражения на лексемы
 
     bool IsFunction(const string& lexeme) const; // проверка на функцию
     bool IsBinaryFunction(const string& lexeme) const; // проверка на бинарную функцию
+    bool IsTernaryFunction(const string& lexeme) const; // проверка на функцию от трёх аргументов
+    bool IsVariadicFunction(const string& lexeme) const; // проверка на функцию от произвольного количества аргументов
+    bool IsAnyFunction(const string& lexeme) const; // проверка на встроенную или пользовательскую функцию
+    int GetArity(const string& lexeme) const; // получение количества аргументов функции (0 - произвольное)
     bool IsOperator(const string& lexeme) const; // проверка на операцию
     bool IsConstant(const string& lexeme) const; // проверка на константу
     bool IsNumber(const string& lexeme) const; // проверка на число
     bool IsVariable(const string& lexeme) const; // проверка на переменную
+    bool IsUserFunction(const string& lexeme) const; // проверка на пользовательскую функцию
+    bool IsUserConstant(const string& lexeme) const; // проверка на пользовательскую константу
+    void ImportUserDefinitions(const FunctionRegistry& registry); // подключение используемых функций и констант из реестра
+    void ClassifyLexeme(int index); // определение вида, приоритета и значения лексемы
 
     int GetPriority(const string lexeme) const; // получение приоритета операции
-    bool IsMorePriority(const string &curr, const string &top) const; // проверка, что текущая лексема менее приоритетна лексемы на вершине стека
-    void ConvertToRPN(); // получение польской записи
+    bool IsMorePriority(const Lexeme& curr, const Lexeme& top) const; // проверка, что текущая лексема менее приоритетна лексемы на вершине стека
+    void ConvertToRPN(vector<int>& indices); // получение польской записи
     
     double EvaluateOperator(const string& op, double arg1, double arg2) const; // вычисление операции
     double EvaluateFunction(const string& f, double arg) const; // вычисление функции
     double EvaluateBinaryFunction(const string& f, double arg1, double arg2) const; // вычисление бинарной функции
+    double EvaluateVariadicFunction(const string& f, const vector<double>& args) const; // вычисление функции от произвольного количества аргументов
     double EvaluateConstant(const string& name) const; // вычисление константы
+
+    static int GetArgumentsCount(const Instruction& instruction); // получение количества аргументов инструкции
+    static bool IsJump(Opcode opcode); // проверка, что инструкция является переходом
+    static string GetOpcodeName(Opcode opcode); // получение названия инструкции
+    static double ApplyInstruction(const Instruction& instruction, const double *args); // применение инструкции к аргументам
+    static double Hypot(const double *args, int count); // евклидова норма аргументов
+    static double ApplyDerivative(const Instruction& instruction, const double *args, const double *derivatives, double value); // производная результата инструкции
+    static double ApplyErrorBound(const Instruction& instruction, const double *args, const double *errors, double value); // граница погрешности результата инструкции
+    static double MulAdd(double a, double b, double c); // вычисление a*b + c, с EXPRESSION_PARSER_FMA - с одним округлением
+    static double SinKernel(double x, bool precise, bool cosine); // приближение синуса или косинуса без проверки диапазона
+    static double ExpKernel(double x, bool precise); // приближение экспоненты без проверки диапазона
+    static double LnKernel(double x, bool precise); // приближение натурального логарифма без проверки диапазона
+    static bool IsApproximable(Opcode opcode, double x); // попадает ли аргумент в область приближённого ядра
+    static double ApplyApproximation(const Instruction& instruction, double x); // вычисление приближённого ядра
+    static void ApplyApproximationRows(const Instruction& instruction, const double *args, double *result, size_t size); // вычисление приближённого ядра на блоке строк
+    static Opcode GetApproximateOpcode(Opcode opcode); // код приближённого ядра для функции (Number - ядра нет)
+    static Opcode GetExactOpcode(Opcode opcode); // код точной функции для приближённого ядра
+    static double GetKernelError(Opcode opcode, bool precise); // гарантированная относительная погрешность приближённого ядра
+    static void MultiplyRanges(double low1, double high1, double low2, double high2, double& low, double& high); // область значений произведения
+    static void GetRange(const Instruction& instruction, const double *low, const double *high, double& resultLow, double& resultHigh); // область значений инструкции по областям аргументов
+    static double GetTermCondition(double low, double high, double restLow, double restHigh); // множитель относительной погрешности слагаемого в сумме
+    static double GetConditionNumber(const Instruction& instruction, int argument, const double *low, const double *high); // множитель относительной погрешности аргумента в результате
+
+    Opcode GetOpcode(const string& lexeme) const; // получение кода инструкции для лексемы
+    size_t GetOperandStart(size_t end) const; // получение начала операнда, заканчивающегося перед инструкцией end
+    bool IsNumberOperand(size_t start, size_t end, double value) const; // проверка, что операнд является заданным числом
+    void RemoveOperand(size_t start, size_t end); // удаление операнда из программы
+    void ReducePower(); // понижение силы возведения в степень
+    static void UpdateDepth(const Instruction& instruction, int& depth); // учёт глубины стека при добавлении инструкции
+    void AddInstruction(const Instruction& instruction, int& depth); // добавление инструкции со свёрткой констант и понижением силы
+    static bool IsSameOperand(const vector<Instruction>& code, size_t start, size_t middle, size_t end); // проверка совпадения операндов [start, middle) и [middle, end)
+    void Fuse(); // слияние последовательностей инструкций в суперинструкции
+    void InsertJumps(); // добавление переходов для сокращённого вычисления условий
+    static uint64_t MixHash(uint64_t value); // перемешивание битов хеша
+    static uint64_t CombineHash(uint64_t hash, uint64_t value); // добавление значения к хешу
+    static uint64_t HashString(const string& s, uint64_t seed); // хеш строки
+    void Canonicalize(const vector<Instruction>& code) const; // построение канонической формы и структурного хеша
+    void CompileRegisters(const vector<Instruction>& code) const; // построение регистровой программы с устранением общих подвыражений и повторным использованием регистров
+    void AddBaselineInstruction(const Instruction& instruction, int& depth); // добавление инструкции без оптимизаций
+    void Translate(bool optimize); // перевод польской записи в программу
+    void Compile(bool optimize); // компиляция польской записи в программу
+    void StartOptimization(); // запуск фоновой оптимизации программы
+    void InstallOptimized(); // подмена программы результатом фоновой оптимизации
+    void CheckOptimized() const; // проверка, что программа оптимизирована
+    void Analyze() const; // построение канонической формы и регистровой программы при первом обращении
+    void Approximate(); // замена функций приближёнными ядрами в пределах допустимой погрешности
+    static double LookupTable(const ExpressionTable& table, double x); // значение по таблице для x из области таблицы
+    static bool LookupTableRows(const ExpressionTable& table, const double *x, double *result, size_t size); // значения по таблице на блоке строк, false - есть строки вне области
+    static void BuildTable(ExpressionTable& table, const vector<double>& nodes, const vector<double>& derivatives, TableInterpolation interpolation); // построение коэффициентов по значениям в узлах
+    static DependencyNode CombineDependencies(const DependencyNode& a, const DependencyNode& b, bool multiply); // зависимости суммы или произведения
+    static DependencyNode ScaleDependencies(const DependencyNode& a, int power); // зависимости целой степени
+    static DependencyNode NonlinearDependencies(const DependencyNode *args, int count); // зависимости нелинейной функции аргументов
+
+    string GetInstructionName(const Instruction& instruction) const; // получение названия инструкции с учётом пользовательских функций
+    static void ApplyInstructionRows(const Instruction& instruction, double *args, size_t size); // построчное применение инструкции к блокам аргументов
+    void EvaluateBlock(const vector<const double *>& inputs, const vector<double>& scalars, size_t offset, size_t size, double *memory, double *result) const; // вычисление программы на блоке строк
+    void EvaluateRegisterBlock(const vector<const double *>& sources, double *blocks, size_t size) const; // вычисление регистровой программы на блоке строк
+    void EvaluateRegisterRange(const vector<const double *>& inputs, const vector<double>& scalars, double *result, size_t begin, size_t end) const; // вычисление регистровой программы на строках [begin, end)
+    string GetRegisterName(int index, const vector<string>& names) const; // получение названия регистра
+    vector<const double *> GetInputs(const map<string, const double *>& columns) const; // получение столбцов значений по индексам переменных
+    vector<int> GetSweepIndices(const vector<SweepAxis>& axes) const; // получение индексов переменных осей
+    static double PairwiseSum(const double *values, size_t count); // попарное суммирование
+    static double KahanSum(const double *values, size_t count, double& compensation); // суммирование Кэхэна–Ноймайера с накоплением поправки
+    Reduction ReduceBlocks(const vector<const double *>& columns, const vector<SweepAxis>& axes, size_t count, const ReductionOptions& options) const; // свёртка по блокам строк
+    static void GenerateSweepBlock(const vector<SweepAxis>& axes, size_t offset, size_t size, double *blocks); // заполнение блоков значений осей для строк [offset, offset + size)
+
+    friend class CompiledExpression;
 public:
-    ExpressionParser(const string& expression); // конструктор из выражения
+    static constexpr size_t BLOCK_SIZE = 256; // количество строк, вычисляемых одной инструкцией в пакетном режиме
+
+    ExpressionParser(const string& expression, const FunctionRegistry& registry = FunctionRegistry(), size_t tierThreshold = 0, double tolerance = 0); // конструктор из выражения
 
     void SetValue(string name, double value); // обновление значения переменной
     double Evaluate(); // вычисление выражения
+    double EvaluateRPN(); // эталонное вычисление выражения по польской записи
+    double EvaluateDerivative(const string& variable, double& derivative) const; // вычисление выражения и его производной по переменной
+    double EvaluateErrorBound(double& error) const; // вычисление выражения с оценкой абсолютной погрешности округления
+    void EvaluateBatch(const map<string, const double *>& columns, double *result, size_t count) const; // пакетное вычисление выражения по столбцам значений переменных
+    double EvaluateRegisters(); // вычисление выражения по регистровой программе
+    void EvaluateRegistersBatch(const map<string, const double *>& columns, double *result, size_t count) const; // пакетное вычисление по регистровой программе
+    void Sweep(const vector<SweepAxis>& axes, double *result, size_t threads = 1) const; // вычисление выражения на сетке значений в заранее выделенный тензор
+    static size_t GetSweepSize(const vector<SweepAxis>& axes); // получение количества точек сетки
+    void EvaluateSpans(const map<string, ValueSpan>& spans, double *result, size_t threads = 1) const; // поэлементное вычисление по массивам с растягиванием скаляров
+    vector<double> EvaluateSpans(const map<string, ValueSpan>& spans, size_t threads = 1) const; // поэлементное вычисление по массивам с растягиванием скаляров
+    static size_t GetBroadcastSize(const map<string, ValueSpan>& spans); // получение количества элементов результата поэлементного вычисления
+    Reduction Reduce(const map<string, const double *>& columns, size_t count, const ReductionOptions& options = ReductionOptions()) const; // свёртка выражения по столбцам без сохранения значений
+    Reduction Reduce(const vector<SweepAxis>& axes, const ReductionOptions& options = ReductionOptions()) const; // свёртка выражения по сетке без сохранения значений
+    string Disassemble() const; // получение текстового представления программы
+    string DisassembleRegisters() const; // получение текстового представления регистровой программы
+
+    void Optimize(); // оптимизация программы без ожидания порога вычислений
+    bool IsOptimized() const; // оптимизирована ли программа
+
+    const string& GetCanonicalForm() const; // получение канонической формы выражения
+    ExpressionHash GetHash() const; // получение структурного хеша выражения
+    bool IsEquivalent(const ExpressionParser& parser) const; // проверка структурного равенства выражений
+    DependencyAnalysis AnalyzeDependencies() const; // анализ зависимости результата от переменных
+
+    double GetApproximationError() const; // оценка относительной погрешности приближённого режима
+
+    void Tabulate(const string& variable, double low, double high, const TableOptions& options = TableOptions()); // замена вычисления на отрезке таблицей значений
+    bool IsTabulated() const; // вычисляется ли выражение по таблице
+    size_t GetTableSize() const; // количество интервалов или коэффициентов таблицы
+    double GetTableError() const; // наибольшая погрешность таблицы на контрольных точках
+    ApproximationCheck VerifyApproximation(const map<string, const double *>& columns, size_t count) const; // проверка погрешности приближённого режима на выборке
+
+    ExpressionStatistics GetStatistics() const; // получение статистики выражения
+    void ResetStatistics(); // сброс статистики вычислений
+    void PrintStatistics(ostream& os) const; // вывод статистики в читаемом виде
 };
 
+#ifdef EXPRESSION_PARSER_PROFILING
+// чтение счётчика тактов
+unsigned long long ExpressionParser::ReadCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+#endif
+
+TierState::TierState() : ready(false), analyzed(false) {
+}
+
+TierState::TierState(const TierState& state) : optimized(state.optimized), evaluations(state.evaluations), ready(false), analyzed(state.analyzed.load()) {
+}
+
+TierState& TierState::operator=(const TierState& state) {
+    if (this != &state) {
+        Wait();
+        result.reset();
+        optimized = state.optimized;
+        evaluations = state.evaluations;
+        ready = false;
+        analyzed = state.analyzed.load();
+    }
+
+    return *this;
+}
+
+TierState::~TierState() {
+    Wait();
+}
+
+// ожидание завершения фоновой оптимизации
+void TierState::Wait() {
+    if (worker.valid())
+        worker.wait();
+}
+
 // проверка на цифру
 bool ExpressionParser::IsDigit(char c) const {
     return c >= '0' && c <= '9';
@@ -48,19 +653,86 @@ bool ExpressionParser::IsLetter(char c) const {
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
 }
 
-// разбиение выражения на лексемы
-void ExpressionParser::SplitToLexemes(const string& s) {
+// хеш текста лексемы (FNV-1a)
+uint32_t ExpressionParser::HashLexeme(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ uint8_t(text[i])) * 16777619u;
+
+    return hash;
+}
+
+// получение номера лексемы в пуле с добавлением новой: лексема задаётся диапазоном входной строки,
+// indices - открытая хеш-таблица номеров лексем в пуле (-1 - свободная ячейка), тексты сравниваются прямо в lexemeText
+int ExpressionParser::InternLexeme(const char *text, size_t length, vector<int>& indices) {
+    if ((lexemePool.size() + 1) * 2 > indices.size()) { // заполнено больше половины таблицы - увеличиваем её вдвое
+        vector<int> table(max(size_t(16), indices.size() * 2), -1);
+        size_t mask = table.size() - 1;
+
+        for (size_t i = 0; i < lexemePool.size(); i++) {
+            size_t slot = HashLexeme(lexemeText.data() + lexemePool[i].start, lexemePool[i].length) & mask;
+
+            while (table[slot] >= 0)
+                slot = (slot + 1) & mask;
+
+            table[slot] = i;
+        }
+
+        indices.swap(table);
+    }
+
+    size_t mask = indices.size() - 1;
+    size_t slot = HashLexeme(text, length) & mask;
+
+    for (; indices[slot] >= 0; slot = (slot + 1) & mask) {
+        const Lexeme& lexeme = lexemePool[indices[slot]];
+
+        if (size_t(lexeme.length) == length && lexemeText.compare(lexeme.start, length, text, length) == 0)
+            return indices[slot];
+    }
+
+    int index = lexemePool.size();
+    lexemePool.push_back({ int(lexemeText.length()), int(length), LexemeType::Unknown, 0, 0, -1, 0 });
+    lexemeText.append(text, length);
+    indices[slot] = index;
+    return index;
+}
+
+// получение текста лексемы из пула
+string ExpressionParser::GetLexemeText(int index) const {
+    return lexemeText.substr(lexemePool[index].start, lexemePool[index].length);
+}
+
+// разбиение выражения на лексемы за один проход: лексема выделяется диапазоном строки и сразу заносится в пул
+void ExpressionParser::SplitToLexemes(const string& s, vector<int>& indices) {
     size_t i = 0; // индекс в строке
 
     while (i < s.length()) {
         if (s[i] == '+' || s[i] == '-' || s[i] == '*' || s[i] == '/' || s[i] == '%' || s[i] == '^') {
-            lexemes.push_back(string(1, s[i++])); // кладём операцию
+            lexemes.push_back(InternLexeme(s.data() + i++, 1, indices)); // кладём операцию
+        }
+        else if (s[i] == '<' || s[i] == '>' || s[i] == '!' || s[i] == '=') {
+            bool equal = i + 1 < s.length() && s[i + 1] == '=';
+
+            if (s[i] == '=' && !equal)
+                throw string("Unknown character in expression: '='");
+
+            lexemes.push_back(InternLexeme(s.data() + i, equal ? 2 : 1, indices)); // кладём сравнение или отрицание
+            i += equal ? 2 : 1;
+        }
+        else if (s[i] == '&' || s[i] == '|') {
+            if (i + 1 == s.length() || s[i + 1] != s[i])
+                throw string("Unknown character in expression: '") + s[i] + "'";
+
+            lexemes.push_back(InternLexeme(s.data() + i, 2, indices)); // кладём логическую операцию
+            i += 2;
         }
         else if (s[i] == '(' || s[i] == ')' || s[i] == ',') {
-            lexemes.push_back(string(1, s[i++])); // кладём скобку или разделитель
+            lexemes.push_back(InternLexeme(s.data() + i++, 1, indices)); // кладём скобку или разделитель
         }
         else if (IsDigit(s[i])) { // если цифра
-            string number = ""; // строка для числа
+            size_t start = i; // начало числа
             int points = 0; // счётчик точек
 
             while (i < s.length() && (IsDigit(s[i]) || s[i] == '.')) {
@@ -71,18 +743,18 @@ void ExpressionParser::SplitToLexemes(const string& s) {
                         throw string("Invalid real number in expression");
                 }
 
-                number += s[i++]; // наращиваем число
+                i++;
             }
 
-            lexemes.push_back(number); // добавляем число
+            lexemes.push_back(InternLexeme(s.data() + start, i - start, indices)); // добавляем число
         }
         else if (IsLetter(s[i])) { // если буква
-            string word = ""; // строка для слова
+            size_t start = i; // начало слова
 
             while (i < s.length() && (IsLetter(s[i]) || IsDigit(s[i])))
-                word += s[i++]; // наращиваем слово
+                i++;
 
-            lexemes.push_back(word); // добавляем слово
+            lexemes.push_back(InternLexeme(s.data() + start, i - start, indices)); // добавляем слово
         }
         else if (s[i] == ' ' || s[i] == '\t') { // если пробельный символ
             i++; // пропускаем
@@ -114,12 +786,50 @@ bool ExpressionParser::IsFunction(const string& lexeme) const {
 
 // проверка на бинарную функцию
 bool ExpressionParser::IsBinaryFunction(const string& lexeme) const {
-    return lexeme == "max" || lexeme == "min" || lexeme == "log" || lexeme == "pow" || lexeme == "root";
+    return lexeme == "log" || lexeme == "pow" || lexeme == "root";
+}
+
+// проверка на функцию от трёх аргументов
+bool ExpressionParser::IsTernaryFunction(const string& lexeme) const {
+    return lexeme == "if";
+}
+
+// проверка на функцию от произвольного количества аргументов
+bool ExpressionParser::IsVariadicFunction(const string& lexeme) const {
+    return lexeme == "max" || lexeme == "min" || lexeme == "sum" || lexeme == "avg" || lexeme == "hypot";
+}
+
+// проверка на встроенную или пользовательскую функцию
+bool ExpressionParser::IsAnyFunction(const string& lexeme) const {
+    return IsFunction(lexeme) || IsBinaryFunction(lexeme) || IsTernaryFunction(lexeme) || IsVariadicFunction(lexeme) || IsUserFunction(lexeme);
+}
+
+// получение количества аргументов функции (0 - произвольное)
+int ExpressionParser::GetArity(const string& lexeme) const {
+    if (IsFunction(lexeme))
+        return 1;
+
+    if (IsBinaryFunction(lexeme))
+        return 2;
+
+    if (IsTernaryFunction(lexeme))
+        return 3;
+
+    if (IsUserFunction(lexeme))
+        return userFunctions.at(lexeme)->arity;
+
+    return 0;
 }
 
 // проверка на операцию
 bool ExpressionParser::IsOperator(const string& lexeme) const {
-    return lexeme == "+" || lexeme == "-" || lexeme == "*" || lexeme == "/" || lexeme == "%" || lexeme == "^";
+    if (lexeme == "+" || lexeme == "-" || lexeme == "*" || lexeme == "/" || lexeme == "%" || lexeme == "^")
+        return true;
+
+    if (lexeme == "<" || lexeme == "<=" || lexeme == ">" || lexeme == ">=" || lexeme == "==" || lexeme == "!=")
+        return true;
+
+    return lexeme == "&&" || lexeme == "||";
 }
 
 // проверка на константу
@@ -145,105 +855,245 @@ bool ExpressionParser::IsVariable(const string& lexeme) const {
         if (!IsLetter(lexeme[i]) && !IsDigit(lexeme[i]))
             return false;
 
-    return !IsFunction(lexeme) && !IsBinaryFunction(lexeme) && !IsConstant(lexeme);
+    return !IsAnyFunction(lexeme) && !IsConstant(lexeme) && !IsUserConstant(lexeme);
+}
+
+// проверка на пользовательскую функцию
+bool ExpressionParser::IsUserFunction(const string& lexeme) const {
+    return userFunctions.find(lexeme) != userFunctions.end();
+}
+
+// проверка на пользовательскую константу
+bool ExpressionParser::IsUserConstant(const string& lexeme) const {
+    return userConstants.find(lexeme) != userConstants.end();
+}
+
+// подключение используемых функций и констант из реестра
+void ExpressionParser::ImportUserDefinitions(const FunctionRegistry& registry) {
+    for (size_t i = 0; i < lexemePool.size(); i++) {
+        string lexeme = GetLexemeText(i);
+
+        if (!IsLetter(lexeme[0]) || IsFunction(lexeme) || IsBinaryFunction(lexeme) || IsTernaryFunction(lexeme) || IsVariadicFunction(lexeme) || IsConstant(lexeme))
+            continue;
+
+        shared_ptr<const UserFunction> function = registry.FindFunction(lexeme);
+        double value;
+
+        if (function)
+            userFunctions[lexeme] = function;
+        else if (registry.FindConstant(lexeme, value))
+            userConstants[lexeme] = value;
+    }
 }
 
 // получение приоритета операции
 int ExpressionParser::GetPriority(const string lexeme) const {
-    if (IsFunction(lexeme) || IsBinaryFunction(lexeme))
-        return 4;
+    if (IsAnyFunction(lexeme))
+        return 9;
 
-    if (lexeme == "!" || lexeme == "^")
-        return 3;
+    if (lexeme == "~" || lexeme == "!" || lexeme == "^")
+        return 8;
 
     if (lexeme == "*" || lexeme == "/" || lexeme == "%")
-        return 2;
+        return 7;
 
     if (lexeme == "+" || lexeme == "-")
-        return 1;
+        return 6;
+
+    if (lexeme == "<" || lexeme == "<=" || lexeme == ">" || lexeme == ">=")
+        return 5;
+
+    if (lexeme == "==" || lexeme == "!=")
+        return 4;
+
+    if (lexeme == "&&")
+        return 3;
+
+    if (lexeme == "||")
+        return 2;
 
     return 0;
 }
 
+// определение вида, приоритета и значения лексемы
+void ExpressionParser::ClassifyLexeme(int index) {
+    Lexeme& lexeme = lexemePool[index];
+    string text = GetLexemeText(index);
+
+    if (IsNumber(text)) {
+        lexeme.type = LexemeType::Number;
+        lexeme.value = stod(text);
+    }
+    else if (IsConstant(text)) {
+        lexeme.type = LexemeType::Constant;
+        lexeme.value = EvaluateConstant(text);
+    }
+    else if (IsUserConstant(text)) {
+        lexeme.type = LexemeType::UserConstant;
+        lexeme.value = userConstants.at(text);
+    }
+    else if (IsUserFunction(text) || IsAnyFunction(text)) {
+        lexeme.type = IsUserFunction(text) ? LexemeType::UserFunction : LexemeType::Function;
+        lexeme.priority = GetPriority(text);
+        lexeme.arity = GetArity(text);
+    }
+    else if (IsVariable(text))
+        lexeme.type = LexemeType::Variable;
+    else if (text == "!" || text == "~" || IsOperator(text)) {
+        lexeme.type = text == "!" ? LexemeType::Not : text == "~" ? LexemeType::Negate : LexemeType::Operator;
+        lexeme.priority = GetPriority(text);
+    }
+    else if (text == ",")
+        lexeme.type = LexemeType::Comma;
+    else if (text == "(")
+        lexeme.type = LexemeType::LeftBracket;
+    else if (text == ")")
+        lexeme.type = LexemeType::RightBracket;
+    else
+        lexeme.type = LexemeType::Unknown;
+}
+
 // проверка, что текущая лексема менее приоритетна лексемы на вершине стека
-bool ExpressionParser::IsMorePriority(const string &curr, const string &top) const {
-    if (curr == "^" || curr == "!")
-        return GetPriority(top) > GetPriority(curr);
+bool ExpressionParser::IsMorePriority(const Lexeme& curr, const Lexeme& top) const {
+    if (curr.priority == 8) // унарные операции и возведение в степень правоассоциативны
+        return top.priority > curr.priority;
 
-    return GetPriority(top) >= GetPriority(curr);
+    return top.priority >= curr.priority;
 }
 
 // получение польской записи
-void ExpressionParser::ConvertToRPN() {
-    stack<string> stack;
+// унарный минус записывается как ~, у функций от произвольного количества аргументов перед названием записывается количество аргументов;
+// вид лексем определяется один раз для пула, стеки хранят номера лексем, поэтому время и память линейны по длине выражения
+void ExpressionParser::ConvertToRPN(vector<int>& indices) {
+    for (size_t i = 0; i < lexemePool.size(); i++)
+        ClassifyLexeme(i);
+
+    int negate = -1; // номер лексемы унарного минуса, добавляется в пул при первой встрече
+
+    vector<int> arguments; // количество аргументов для открытых скобок (0 - скобки не являются вызовом функции)
+    vector<int> stack; // номера лексем операций, функций и открывающих скобок
     bool mayUnary = true;
 
-    for (string lexeme : lexemes) {
-        if (IsNumber(lexeme) || IsConstant(lexeme)) {
-            rpn.push_back(lexeme);
+    rpn.reserve(lexemes.size());
+
+    for (size_t i = 0; i < lexemes.size(); i++) {
+        int index = lexemes[i];
+        LexemeType type = lexemePool[index].type;
+
+        if (type == LexemeType::Number || type == LexemeType::Constant || type == LexemeType::UserConstant) {
+            rpn.push_back(index);
             mayUnary = false;
         }
-        else if (IsFunction(lexeme) || IsBinaryFunction(lexeme)) {
-            stack.push(lexeme);
+        else if (type == LexemeType::Function || type == LexemeType::UserFunction) {
+            if (lexemePool[index].arity != 1 && (i + 1 == lexemes.size() || lexemePool[lexemes[i + 1]].type != LexemeType::LeftBracket))
+                throw string("Incorrect expression: function '") + GetLexemeText(index) + "' requires arguments in brackets";
+
+            stack.push_back(index);
             mayUnary = true;
         }
-        else if (IsVariable(lexeme)) {
-            rpn.push_back(lexeme);
-            variables[lexeme] = 0;
+        else if (type == LexemeType::Variable) {
+            rpn.push_back(index);
             mayUnary = false;
+
+            if (lexemePool[index].index < 0) {
+                lexemePool[index].index = values.size();
+                variables[GetLexemeText(index)] = values.size();
+                values.push_back(0);
+            }
         }
-        else if (lexeme == ",") {
-            while (stack.size() > 0 && stack.top() != "(") {
-                rpn.push_back(stack.top());
-                stack.pop();
+        else if (type == LexemeType::Comma) {
+            while (stack.size() > 0 && lexemePool[stack.back()].type != LexemeType::LeftBracket) {
+                rpn.push_back(stack.back());
+                stack.pop_back();
             }
 
-            if (stack.size() == 0)
-                throw string("Incorrect expression");
+            if (stack.size() == 0 || arguments.back() == 0)
+                throw string("Incorrect expression: ',' outside of function arguments");
+
+            arguments.back()++;
+            mayUnary = true;
         }
-        else if (IsOperator(lexeme)) {
-            string curr = lexeme == "-" && mayUnary ? "!" : lexeme;
+        else if (type == LexemeType::Not) {
+            if (!mayUnary)
+                throw string("Incorrect expression: unexpected '!'");
 
-            while (stack.size() > 0 && IsMorePriority(curr, stack.top())) {
-                rpn.push_back(stack.top());
-                stack.pop();
+            stack.push_back(index);
+        }
+        else if (type == LexemeType::Operator) {
+            int curr = index;
+
+            if (mayUnary && GetLexemeText(index) == "-") {
+                if (negate < 0) {
+                    negate = InternLexeme("~", 1, indices);
+                    ClassifyLexeme(negate);
+                }
+
+                curr = negate;
             }
 
-            stack.push(curr);
-            mayUnary = lexeme == "^";
+            while (stack.size() > 0 && IsMorePriority(lexemePool[curr], lexemePool[stack.back()])) {
+                rpn.push_back(stack.back());
+                stack.pop_back();
+            }
+
+            stack.push_back(curr);
+            mayUnary = true;
         }
-        else if (lexeme == "(") {
-            stack.push(lexeme);
+        else if (type == LexemeType::LeftBracket) {
+            bool call = i > 0 && (lexemePool[lexemes[i - 1]].type == LexemeType::Function || lexemePool[lexemes[i - 1]].type == LexemeType::UserFunction);
+            arguments.push_back(call ? 1 : 0);
+            stack.push_back(index);
             mayUnary = true;
         }
-        else if (lexeme == ")") {
-            while (stack.size() > 0 && stack.top() != "(") {
-                rpn.push_back(stack.top());
-                stack.pop();
+        else if (type == LexemeType::RightBracket) {
+            while (stack.size() > 0 && lexemePool[stack.back()].type != LexemeType::LeftBracket) {
+                rpn.push_back(stack.back());
+                stack.pop_back();
             }
 
             if (stack.size() == 0)
                 throw string("Incorrect expression: brackets are disbalanced");
 
-            stack.pop();
+            if (lexemePool[lexemes[i - 1]].type == LexemeType::LeftBracket)
+                throw string("Incorrect expression: empty brackets");
 
-            if (stack.size() > 0 && IsFunction(stack.top())) {
-                rpn.push_back(stack.top());
-                stack.pop();
+            stack.pop_back();
+            int count = arguments.back();
+            arguments.pop_back();
+
+            if (count > 0) {
+                int function = stack.back();
+                int arity = lexemePool[function].arity;
+
+                if (arity > 0 && arity != count)
+                    throw string("Incorrect expression: function '") + GetLexemeText(function) + "' expects " + to_string(arity) + " arguments, got " + to_string(count);
+
+                if (arity == 0) {
+                    string text = to_string(count);
+                    int number = InternLexeme(text.data(), text.length(), indices);
+
+                    if (lexemePool[number].type == LexemeType::Unknown)
+                        ClassifyLexeme(number);
+
+                    rpn.push_back(number);
+                }
+
+                rpn.push_back(function);
+                stack.pop_back();
             }
 
             mayUnary = false;
         }
         else
-            throw string("Incorrect expression: unknown lexeme '") + lexeme + "'";
+            throw string("Incorrect expression: unknown lexeme '") + GetLexemeText(index) + "'";
     }
 
     while (stack.size() > 0) {
-        if (stack.top() == "(")
+        if (lexemePool[stack.back()].type == LexemeType::LeftBracket)
             throw string("Incorrect expression: brackets are disbalanced");
 
-        rpn.push_back(stack.top());
-        stack.pop();
+        rpn.push_back(stack.back());
+        stack.pop_back();
     }
 }
 
@@ -267,6 +1117,30 @@ double ExpressionParser::EvaluateOperator(const string& op, double arg1, double
     if (op == "^")
         return pow(arg1, arg2);
 
+    if (op == "<")
+        return arg1 < arg2;
+
+    if (op == "<=")
+        return arg1 <= arg2;
+
+    if (op == ">")
+        return arg1 > arg2;
+
+    if (op == ">=")
+        return arg1 >= arg2;
+
+    if (op == "==")
+        return arg1 == arg2;
+
+    if (op == "!=")
+        return arg1 != arg2;
+
+    if (op == "&&")
+        return arg1 != 0 && arg2 != 0;
+
+    if (op == "||")
+        return arg1 != 0 || arg2 != 0;
+
     throw string("Unhandled operator '") + op + "'";
 }
 
@@ -331,12 +1205,6 @@ double ExpressionParser::EvaluateFunction(const string& f, double arg) const {
 
 // вычисление бинарной функции
 double ExpressionParser::EvaluateBinaryFunction(const string& f, double arg1, double arg2) const {
-    if (f == "max")
-        return max(arg1, arg2);
-
-    if (f == "min")
-        return min(arg1, arg2);
-
     if (f == "log")
         return log(arg2) / log(arg1);
 
@@ -349,7 +1217,28 @@ double ExpressionParser::EvaluateBinaryFunction(const string& f, double arg1, do
     throw string("Unhandled binary function '") + f + "'";
 }
 
-// вычисление константы
+// вычисление функции от произвольного количества аргументов
+double ExpressionParser::EvaluateVariadicFunction(const string& f, const vector<double>& args) const {
+    if (f == "hypot")
+        return Hypot(args.data(), args.size());
+
+    double result = args[0];
+
+    for (size_t i = 1; i < args.size(); i++) {
+        if (f == "max")
+            result = max(result, args[i]);
+        else if (f == "min")
+            result = min(result, args[i]);
+        else if (f == "sum" || f == "avg")
+            result += args[i];
+        else
+            throw string("Unhandled variadic function '") + f + "'";
+    }
+
+    return f == "avg" ? result / args.size() : result;
+}
+
+// вычисление константы
 double ExpressionParser::EvaluateConstant(const string& name) const {
     if (name == "pi")
         return M_PI;
@@ -369,75 +1258,3536 @@ double ExpressionParser::EvaluateConstant(const string& name) const {
     throw string("Unhandled constant '") + name + "'";
 }
 
-// конструктор из выражения
-ExpressionParser::ExpressionParser(const string& expression) {
-    SplitToLexemes(expression); // разбиваем на лексемы
-    ConvertToRPN(); // получаем польскую запись
+// получение количества аргументов инструкции
+int ExpressionParser::GetArgumentsCount(const Instruction& instruction) {
+    switch (instruction.opcode) {
+        case Opcode::Number:
+        case Opcode::Variable:
+        case Opcode::Branch:
+        case Opcode::Jump:
+        case Opcode::JumpIfFalse:
+        case Opcode::JumpIfTrue:
+            return 0;
+
+        case Opcode::If:
+        case Opcode::MulAdd:
+        case Opcode::AddMul:
+        case Opcode::MulSub:
+        case Opcode::SubMul:
+            return 3;
+
+        case Opcode::Call:
+        case Opcode::Max:
+        case Opcode::Min:
+        case Opcode::Sum:
+        case Opcode::Avg:
+        case Opcode::Hypot:
+            return instruction.index;
+
+        case Opcode::Add:
+        case Opcode::Sub:
+        case Opcode::Mul:
+        case Opcode::Div:
+        case Opcode::Mod:
+        case Opcode::Pow:
+        case Opcode::Less:
+        case Opcode::LessEqual:
+        case Opcode::Greater:
+        case Opcode::GreaterEqual:
+        case Opcode::Equal:
+        case Opcode::NotEqual:
+        case Opcode::And:
+        case Opcode::Or:
+        case Opcode::Log:
+        case Opcode::Root:
+        case Opcode::SumSquares:
+        case Opcode::NegAdd:
+            return 2;
+
+        default:
+            return 1;
+    }
 }
 
-// обновление значения переменной
-void ExpressionParser::SetValue(string name, double value) {
-    variables[name] = value;
+// проверка, что инструкция является переходом
+bool ExpressionParser::IsJump(Opcode opcode) {
+    return opcode == Opcode::Branch || opcode == Opcode::Jump || opcode == Opcode::JumpIfFalse || opcode == Opcode::JumpIfTrue;
 }
 
-// вычисление выражения
-double ExpressionParser::Evaluate() {
-    stack<double> stack;
+// получение названия инструкции
+string ExpressionParser::GetOpcodeName(Opcode opcode) {
+    switch (opcode) {
+        case Opcode::Number: return "number";
+        case Opcode::Variable: return "variable";
+        case Opcode::Call: return "call";
+        case Opcode::Neg: return "neg";
+        case Opcode::Add: return "+";
+        case Opcode::Sub: return "-";
+        case Opcode::Mul: return "*";
+        case Opcode::Div: return "/";
+        case Opcode::Mod: return "%";
+        case Opcode::Pow: return "^";
+        case Opcode::Sin: return "sin";
+        case Opcode::Cos: return "cos";
+        case Opcode::Tan: return "tan";
+        case Opcode::Cot: return "cot";
+        case Opcode::Sinh: return "sinh";
+        case Opcode::Cosh: return "cosh";
+        case Opcode::Tanh: return "tanh";
+        case Opcode::Asin: return "asin";
+        case Opcode::Acos: return "acos";
+        case Opcode::Atan: return "atan";
+        case Opcode::Ln: return "ln";
+        case Opcode::Log2: return "log2";
+        case Opcode::Lg: return "lg";
+        case Opcode::Exp: return "exp";
+        case Opcode::Sqrt: return "sqrt";
+        case Opcode::Cbrt: return "cbrt";
+        case Opcode::Abs: return "abs";
+        case Opcode::Sign: return "sign";
+        case Opcode::Log: return "log";
+        case Opcode::Root: return "root";
+        case Opcode::Max: return "max";
+        case Opcode::Min: return "min";
+        case Opcode::Sum: return "sum";
+        case Opcode::Avg: return "avg";
+        case Opcode::Hypot: return "hypot";
+        case Opcode::Less: return "<";
+        case Opcode::LessEqual: return "<=";
+        case Opcode::Greater: return ">";
+        case Opcode::GreaterEqual: return ">=";
+        case Opcode::Equal: return "==";
+        case Opcode::NotEqual: return "!=";
+        case Opcode::And: return "&&";
+        case Opcode::Or: return "||";
+        case Opcode::Not: return "!";
+        case Opcode::If: return "if";
+        case Opcode::Branch: return "br";
+        case Opcode::Jump: return "jmp";
+        case Opcode::JumpIfFalse: return "jf";
+        case Opcode::JumpIfTrue: return "jt";
+        case Opcode::Square: return "square";
+        case Opcode::Cube: return "cube";
+        case Opcode::MulAdd: return "muladd";
+        case Opcode::AddMul: return "addmul";
+        case Opcode::MulSub: return "mulsub";
+        case Opcode::SubMul: return "submul";
+        case Opcode::SumSquares: return "sumsq";
+        case Opcode::NegAdd: return "negadd";
+        case Opcode::PowInt: return "powi";
+        case Opcode::Reciprocal: return "reciprocal";
+        case Opcode::Root2: return "root2";
+        case Opcode::InverseSqrt: return "rsqrt";
+        case Opcode::Root3: return "root3";
+        case Opcode::LogBase: return "logc";
+        case Opcode::Exp2: return "exp2";
+        case Opcode::SinApprox: return "approx_sin";
+        case Opcode::CosApprox: return "approx_cos";
+        case Opcode::ExpApprox: return "approx_exp";
+        case Opcode::LnApprox: return "approx_ln";
+    }
 
-    for (string lexeme : rpn) {
-        if (IsOperator(lexeme)) {
-            if (stack.size() < 2)
-                throw string("Unable to evaluate operator '") + lexeme + "'";
+    throw string("Unhandled opcode");
+}
 
-            double arg2 = stack.top();
-            stack.pop();
-            double arg1 = stack.top();
-            stack.pop();
+// применение инструкции к аргументам
+double ExpressionParser::ApplyInstruction(const Instruction& instruction, const double *args) {
+    switch (instruction.opcode) {
+        case Opcode::Call: return instruction.function->function(instruction.function->context.get(), args);
+        case Opcode::Neg: return -args[0];
+        case Opcode::Add: return args[0] + args[1];
+        case Opcode::Sub: return args[0] - args[1];
+        case Opcode::Mul: return args[0] * args[1];
+        case Opcode::Div: return args[0] / args[1];
+        case Opcode::Mod: return fmod(args[0], args[1]);
+        case Opcode::Pow: return pow(args[0], args[1]);
+        case Opcode::Sin: return sin(args[0]);
+        case Opcode::Cos: return cos(args[0]);
+        case Opcode::Tan: return tan(args[0]);
+        case Opcode::Cot: return 1.0 / tan(args[0]);
+        case Opcode::Sinh: return sinh(args[0]);
+        case Opcode::Cosh: return cosh(args[0]);
+        case Opcode::Tanh: return tanh(args[0]);
+        case Opcode::Asin: return asin(args[0]);
+        case Opcode::Acos: return acos(args[0]);
+        case Opcode::Atan: return atan(args[0]);
+        case Opcode::Ln: return log(args[0]);
+        case Opcode::Log2: return log2(args[0]);
+        case Opcode::Lg: return log10(args[0]);
+        case Opcode::Exp: return exp(args[0]);
+        case Opcode::Sqrt: return sqrt(args[0]);
+        case Opcode::Cbrt: return cbrt(args[0]);
+        case Opcode::Abs: return fabs(args[0]);
+        case Opcode::Sign: return args[0] > 0 ? 1 : (args[0] < 0 ? -1 : 0);
+        case Opcode::Hypot: return Hypot(args, instruction.index);
+        case Opcode::Less: return args[0] < args[1];
+        case Opcode::LessEqual: return args[0] <= args[1];
+        case Opcode::Greater: return args[0] > args[1];
+        case Opcode::GreaterEqual: return args[0] >= args[1];
+        case Opcode::Equal: return args[0] == args[1];
+        case Opcode::NotEqual: return args[0] != args[1];
+        case Opcode::And: return args[0] != 0 && args[1] != 0;
+        case Opcode::Or: return args[0] != 0 || args[1] != 0;
+        case Opcode::Not: return args[0] == 0;
+        case Opcode::If: return args[0] != 0 ? args[1] : args[2];
+        case Opcode::Log: return log(args[1]) / log(args[0]);
+        case Opcode::Root: return pow(args[1], 1.0 / args[0]);
+        case Opcode::Square: return args[0] * args[0];
+        case Opcode::Cube: return args[0] * args[0] * args[0];
+        case Opcode::MulAdd: return MulAdd(args[0], args[1], args[2]);
+        case Opcode::AddMul: return MulAdd(args[1], args[2], args[0]);
+        case Opcode::MulSub: return MulAdd(args[0], args[1], -args[2]);
+        case Opcode::SubMul: return MulAdd(-args[1], args[2], args[0]);
+        case Opcode::SumSquares: return MulAdd(args[0], args[0], args[1] * args[1]);
+        case Opcode::NegAdd: return args[1] - args[0];
+        case Opcode::Reciprocal: return 1.0 / args[0];
+        case Opcode::Root2: return args[0] == 0 || isinf(args[0]) ? pow(args[0], 0.5) : sqrt(args[0]); // sqrt(-0) = -0 и sqrt(-inf) = NaN, а pow даёт +0 и inf
+        case Opcode::InverseSqrt: return args[0] == 0 || isinf(args[0]) ? pow(args[0], -0.5) : 1.0 / sqrt(args[0]);
+        case Opcode::Root3: return args[0] == 0 || isinf(args[0]) ? pow(args[0], 1.0 / 3) : (args[0] < 0 ? NAN : cbrt(args[0])); // pow(x, 1/3) не определён для отрицательных x, но pow(-inf, 1/3) = inf
+        case Opcode::LogBase: return log(args[0]) * instruction.value;
+        case Opcode::Exp2: return exp2(args[0]);
+        case Opcode::SinApprox:
+        case Opcode::CosApprox:
+        case Opcode::ExpApprox:
+        case Opcode::LnApprox: return ApplyApproximation(instruction, args[0]);
 
-            stack.push(EvaluateOperator(lexeme, arg1, arg2));
+        case Opcode::Max:
+        case Opcode::Min:
+        case Opcode::Sum:
+        case Opcode::Avg: {
+            double result = args[0];
+
+            for (int i = 1; i < instruction.index; i++) {
+                if (instruction.opcode == Opcode::Max)
+                    result = max(result, args[i]);
+                else if (instruction.opcode == Opcode::Min)
+                    result = min(result, args[i]);
+                else
+                    result += args[i];
+            }
+
+            return instruction.opcode == Opcode::Avg ? result / instruction.index : result;
         }
-        else if (IsFunction(lexeme)) {
-            if (stack.size() < 1)
-                throw string("Unable to evaluate function '") + lexeme + "'";
 
-            double arg = stack.top();
-            stack.pop();
-            stack.push(EvaluateFunction(lexeme, arg));
+        case Opcode::PowInt: {
+            // возведение в целую степень последовательным возведением в квадрат
+            double base = args[0];
+            double result = 1;
+
+            for (int n = abs(instruction.index); n > 0; n >>= 1) {
+                if (n & 1)
+                    result *= base;
+
+                base *= base;
+            }
+
+            return instruction.index < 0 ? 1.0 / result : result;
         }
-        else if (IsBinaryFunction(lexeme)) {
-            if (stack.size() < 2)
-                throw string("Unable to evaluate function '") + lexeme + "'";
 
-            double arg2 = stack.top();
-            stack.pop();
-            double arg1 = stack.top();
-            stack.pop();
+        default:
+            throw string("Unable to apply instruction '") + GetOpcodeName(instruction.opcode) + "'";
+    }
+}
 
-            stack.push(EvaluateBinaryFunction(lexeme, arg1, arg2));
+// производная результата value инструкции по правилам дифференцирования, derivatives - производные аргументов args
+// производные пользовательских функций вычисляются центральной разностью
+double ExpressionParser::ApplyDerivative(const Instruction& instruction, const double *args, const double *derivatives, double value) {
+    const double *x = args;
+    const double *dx = derivatives;
+
+    switch (instruction.opcode) {
+        case Opcode::Neg: return -dx[0];
+        case Opcode::Add: return dx[0] + dx[1];
+        case Opcode::Sub: return dx[0] - dx[1];
+        case Opcode::Mul: return dx[0] * x[1] + x[0] * dx[1];
+        case Opcode::Div: return (dx[0] - value * dx[1]) / x[1];
+        case Opcode::Mod: return dx[0] - trunc(x[0] / x[1]) * dx[1];
+        case Opcode::Pow: return x[1] * pow(x[0], x[1] - 1) * dx[0] + (dx[1] != 0 ? value * log(x[0]) * dx[1] : 0);
+        case Opcode::Sin: return cos(x[0]) * dx[0];
+        case Opcode::Cos: return -sin(x[0]) * dx[0];
+        case Opcode::Tan: return dx[0] / (cos(x[0]) * cos(x[0]));
+        case Opcode::Cot: return -dx[0] / (sin(x[0]) * sin(x[0]));
+        case Opcode::Sinh: return cosh(x[0]) * dx[0];
+        case Opcode::Cosh: return sinh(x[0]) * dx[0];
+        case Opcode::Tanh: return (1 - value * value) * dx[0];
+        case Opcode::Asin: return dx[0] / sqrt(1 - x[0] * x[0]);
+        case Opcode::Acos: return -dx[0] / sqrt(1 - x[0] * x[0]);
+        case Opcode::Atan: return dx[0] / (1 + x[0] * x[0]);
+        case Opcode::Ln: return dx[0] / x[0];
+        case Opcode::Log2: return dx[0] / (x[0] * log(2.0));
+        case Opcode::Lg: return dx[0] / (x[0] * log(10.0));
+        case Opcode::Exp: return value * dx[0];
+        case Opcode::Sqrt: return dx[0] / (2 * value);
+        case Opcode::Cbrt: return dx[0] / (3 * value * value);
+        case Opcode::Root2: return dx[0] / (2 * value);
+        case Opcode::Root3: return dx[0] / (3 * value * value);
+        case Opcode::Abs: return x[0] > 0 ? dx[0] : (x[0] < 0 ? -dx[0] : 0);
+        case Opcode::Log: return (dx[1] / x[1] - value * dx[0] / x[0]) / log(x[0]);
+        case Opcode::Root: return value * (dx[1] / x[1] - (dx[0] != 0 ? log(x[1]) * dx[0] / x[0] : 0)) / x[0];
+        case Opcode::If: return x[0] != 0 ? dx[1] : dx[2];
+        case Opcode::Square: return 2 * x[0] * dx[0];
+        case Opcode::Cube: return 3 * x[0] * x[0] * dx[0];
+        case Opcode::PowInt: return instruction.index * pow(x[0], instruction.index - 1) * dx[0];
+        case Opcode::Reciprocal: return -value * value * dx[0];
+        case Opcode::InverseSqrt: return -0.5 * value * value * value * dx[0];
+        case Opcode::LogBase: return instruction.value * dx[0] / x[0];
+        case Opcode::Exp2: return value * log(2.0) * dx[0];
+        case Opcode::SinApprox: return cos(x[0]) * dx[0];
+        case Opcode::CosApprox: return -sin(x[0]) * dx[0];
+        case Opcode::ExpApprox: return value * dx[0];
+        case Opcode::LnApprox: return dx[0] / x[0];
+        case Opcode::MulAdd: return dx[0] * x[1] + x[0] * dx[1] + dx[2];
+        case Opcode::AddMul: return dx[0] + dx[1] * x[2] + x[1] * dx[2];
+        case Opcode::MulSub: return dx[0] * x[1] + x[0] * dx[1] - dx[2];
+        case Opcode::SubMul: return dx[0] - dx[1] * x[2] - x[1] * dx[2];
+        case Opcode::SumSquares: return 2 * (x[0] * dx[0] + x[1] * dx[1]);
+        case Opcode::NegAdd: return dx[1] - dx[0];
+
+        case Opcode::Max:
+        case Opcode::Min:
+            for (int i = 0; i < instruction.index; i++)
+                if (x[i] == value)
+                    return dx[i];
+
+            return 0;
+
+        case Opcode::Sum:
+        case Opcode::Avg:
+        case Opcode::Hypot: {
+            double result = 0;
+
+            for (int i = 0; i < instruction.index; i++)
+                result += instruction.opcode == Opcode::Hypot ? x[i] * dx[i] : dx[i];
+
+            if (instruction.opcode == Opcode::Avg)
+                return result / instruction.index;
+
+            return instruction.opcode == Opcode::Hypot ? (value == 0 ? 0 : result / value) : result;
         }
-        else if (lexeme == "!") {
-            if (stack.size() < 1)
-                throw string("Unable to evaluate unary minus");
 
-            double arg = stack.top();
-            stack.pop();
-            stack.push(-arg);
+        case Opcode::Call: {
+            vector<double> point(x, x + instruction.index);
+            double result = 0;
+
+            for (int i = 0; i < instruction.index; i++) {
+                if (dx[i] == 0)
+                    continue;
+
+                double h = 6e-6 * max(1.0, fabs(x[i])); // шаг порядка кубического корня из машинного эпсилон
+                point[i] = x[i] + h;
+                double right = ApplyInstruction(instruction, point.data());
+                point[i] = x[i] - h;
+                double left = ApplyInstruction(instruction, point.data());
+                point[i] = x[i];
+                result += (right - left) / (2 * h) * dx[i];
+            }
+
+            return result;
         }
-        else if (IsConstant(lexeme)) {
-            stack.push(EvaluateConstant(lexeme));
+
+        default: // сравнения, логические операции и знак кусочно-постоянны
+            return 0;
+    }
+}
+
+// граница абсолютной погрешности результата value инструкции, errors - границы погрешностей аргументов args.
+// Погрешности аргументов переходят в результат через частные производные (для умножения - с членом второго порядка),
+// к ним добавляется погрешность самой инструкции: 8 ULP результата покрывают округление libm и замены понижения силы.
+// Если аргументы разрывной инструкции (%, сравнения, логические операции, sign, условие if) могут оказаться по разные
+// стороны разрыва, граница - величина скачка. Для остальных нелинейных инструкций первый порядок верен только
+// при малой относительной погрешности аргументов, иначе граница бесконечна. Для NaN и бесконечности граница - ноль,
+// если сдвиг аргументов на их погрешность не меняет результат
+double ExpressionParser::ApplyErrorBound(const Instruction& instruction, const double *args, const double *errors, double value) {
+    const double rounding = 8 * DBL_EPSILON; // относительная погрешность одной инструкции
+    int count = GetArgumentsCount(instruction);
+    bool exact = true; // аргументы точные
+
+    for (int i = 0; i < count; i++) {
+        if (errors[i] > 0 && !isfinite(args[i]))
+            return INFINITY;
+
+        exact &= errors[i] == 0;
+    }
+
+    // NaN или бесконечность: граница бесконечна, только если сдвиг аргументов на их погрешность меняет вид результата
+    // (аргумент у границы области определения или переполнения), иначе ошибка не меняет результат
+    if (!isfinite(value)) {
+        vector<double> shifted(args, args + count);
+
+        // степень отрицательного основания определена только при целом показателе, который может оказаться внутри отрезка
+        if ((instruction.opcode == Opcode::Pow || instruction.opcode == Opcode::Root) && !exact && args[instruction.opcode == Opcode::Pow ? 0 : 1] < 0) {
+            bool pow = instruction.opcode == Opcode::Pow;
+            double exponent = pow ? args[1] : 1 / args[0];
+            double error = pow ? errors[1] : errors[0] / (args[0] * args[0]);
+
+            if (error > 0 && floor(exponent + error) >= ceil(exponent - error))
+                return INFINITY;
         }
-        else if (IsVariable(lexeme)) {
-            stack.push(variables[lexeme]);
+
+        for (int i = 0; i < count && !exact; i++) {
+            if (errors[i] > 1e-6 * fabs(args[i])) // на большом отрезке концы не показывают, что внутри
+                return INFINITY;
+
+            for (double sign : { -1.0, 1.0 }) {
+                shifted[i] = args[i] + sign * errors[i];
+                double result = ApplyInstruction(instruction, shifted.data());
+
+                if (isnan(result) != isnan(value) || (!isnan(value) && result != value))
+                    return INFINITY;
+            }
+
+            shifted[i] = args[i];
         }
-        else if (IsNumber(lexeme)) {
-            stack.push(stod(lexeme));
+
+        return 0;
+    }
+
+    // вероятно ли, что значение с погрешностью error окажется по другую сторону от нуля
+    auto uncertain = [](double x, double error) { return error > 0 && fabs(x) <= error; };
+
+    switch (instruction.opcode) {
+        case Opcode::Neg:
+        case Opcode::Abs:
+            return errors[0];
+
+        case Opcode::Max:
+        case Opcode::Min: {
+            double error = 0;
+
+            for (int i = 0; i < count; i++)
+                error = max(error, errors[i]);
+
+            return error;
         }
-        else
-            throw string("Unknown rpn lexeme '") + lexeme + "'";
+
+        case Opcode::Less:
+        case Opcode::LessEqual:
+        case Opcode::Greater:
+        case Opcode::GreaterEqual:
+        case Opcode::Equal:
+        case Opcode::NotEqual:
+            return uncertain(args[0] - args[1], errors[0] + errors[1]) ? 1 : 0;
+
+        case Opcode::And:
+        case Opcode::Or:
+            return uncertain(args[0], errors[0]) || uncertain(args[1], errors[1]) ? 1 : 0;
+
+        case Opcode::Not:
+            return uncertain(args[0], errors[0]) ? 1 : 0;
+
+        case Opcode::Sign:
+            return uncertain(args[0], errors[0]) ? 2 : 0;
+
+        case Opcode::If:
+            if (uncertain(args[0], errors[0]))
+                return fabs(args[1] - args[2]) + max(errors[1], errors[2]);
+
+            return errors[args[0] != 0 ? 1 : 2];
+
+        case Opcode::Mod: {
+            if (exact)
+                return rounding * fabs(value);
+
+            if (errors[1] >= fabs(args[1]))
+                return INFINITY;
+
+            double quotient = args[0] / args[1];
+            double spread = (errors[0] + fabs(quotient) * errors[1]) / (fabs(args[1]) - errors[1]); // погрешность частного
+
+            if (spread >= 1 || trunc(quotient - spread) != trunc(quotient + spread)) // частное может перейти через целое - скачок остатка
+                return 2 * (fabs(args[1]) + errors[1]);
+
+            return errors[0] + fabs(trunc(quotient)) * errors[1] + rounding * fabs(value);
+        }
+
+        default:
+            break;
     }
 
-    if (stack.size() != 1)
-        throw string("Incorrect expression");
+    if (exact)
+        return rounding * fabs(value);
 
-    return stack.top();
+    bool linear = true; // первый порядок верен при любой погрешности аргументов
+    double error = 0;
+
+    switch (instruction.opcode) {
+        case Opcode::Mul:
+        case Opcode::MulAdd:
+        case Opcode::MulSub:
+            error = errors[0] * errors[1];
+            break;
+
+        case Opcode::AddMul:
+        case Opcode::SubMul:
+            error = errors[1] * errors[2];
+            break;
+
+        case Opcode::Square:
+            error = errors[0] * errors[0];
+            break;
+
+        case Opcode::SumSquares:
+            error = errors[0] * errors[0] + errors[1] * errors[1];
+            break;
+
+        case Opcode::Add:
+        case Opcode::Sub:
+        case Opcode::NegAdd:
+        case Opcode::Sum:
+        case Opcode::Avg:
+            break;
+
+        case Opcode::Hypot: // норма 1-липшицева
+            for (int i = 0; i < count; i++)
+                error += errors[i];
+
+            return error + rounding * fabs(value);
+
+        default:
+            linear = false;
+    }
+
+    vector<double> unit(count, 0);
+    vector<double> shifted(args, args + count);
+
+    for (int i = 0; i < count; i++) {
+        if (errors[i] == 0)
+            continue;
+
+        if (!linear && errors[i] > 1e-6 * fabs(args[i]))
+            return INFINITY;
+
+        unit[i] = 1;
+        double derivative = ApplyDerivative(instruction, args, unit.data(), value);
+        unit[i] = 0;
+
+        if (isfinite(derivative)) {
+            error += fabs(derivative) * errors[i];
+            continue;
+        }
+
+        // производная не определена (0 * inf, pow(0, 1/a)): разница значений на концах отрезка погрешности
+        double difference = 0;
+
+        for (double sign : { -1.0, 1.0 }) {
+            shifted[i] = args[i] + sign * errors[i];
+            difference = max(difference, fabs(ApplyInstruction(instruction, shifted.data()) - value));
+        }
+
+        shifted[i] = args[i];
+        error += difference;
+    }
+
+    // root(a, b) = pow(b, 1/a): округление показателя 1/a умножается на ln(b)
+    if (instruction.opcode == Opcode::Root)
+        error += fabs(value * log(fabs(args[1])) / args[0]) * DBL_EPSILON;
+
+    error += rounding * fabs(value);
+    return isnan(error) ? INFINITY : error;
+}
+
+// вычисление a*b + c, с EXPRESSION_PARSER_FMA - аппаратным fma с одним округлением (нужна сборка с -mfma или -march=native)
+inline double ExpressionParser::MulAdd(double a, double b, double c) {
+#ifdef EXPRESSION_PARSER_FMA
+    return fma(a, b, c);
+#else
+    return a * b + c;
+#endif
+}
+
+// приближение синуса (cosine = false) или косинуса: приведение к [-pi/4, pi/4] по Коди–Уэйту с тремя частями pi/2
+// и многочлен Тейлора по четверти периода. Без ветвлений, поэтому циклы по блокам векторизуются. Точно при |x| <= 1e5
+inline double ExpressionParser::SinKernel(double x, bool precise, bool cosine) {
+    const double shifter = 6755399441055744.0; // 1.5 * 2^52: округление до целого сложением, целое в младших битах
+    double t = x * 0.63661977236758134 + shifter;
+    double k = t - shifter;
+    double r = ((x - k * 1.57079632673412561417e+00) - k * 6.07710050630396597660e-11) - k * 2.02226624879595063154e-21;
+    double r2 = r * r;
+    uint64_t quadrant;
+    memcpy(&quadrant, &t, sizeof(t));
+    quadrant += cosine;
+
+    double sinValue = precise ? r * (1 + r2 * (-1.0 / 6 + r2 * (1.0 / 120 + r2 * (-1.0 / 5040 + r2 * (1.0 / 362880 + r2 * (-1.0 / 39916800))))))
+                          : r * (1 + r2 * (-1.0 / 6 + r2 * (1.0 / 120 + r2 * (-1.0 / 5040))));
+    double cosValue = precise ? 1 + r2 * (-0.5 + r2 * (1.0 / 24 + r2 * (-1.0 / 720 + r2 * (1.0 / 40320 + r2 * (-1.0 / 3628800)))))
+                             : 1 + r2 * (-0.5 + r2 * (1.0 / 24 + r2 * (-1.0 / 720)));
+    double value = quadrant & 1 ? cosValue : sinValue;
+    return quadrant & 2 ? -value : value;
+}
+
+// приближение экспоненты: x = k*ln2 + r, |r| <= ln2/2, многочлен Тейлора по r, 2^k собирается в битах порядка. Точно при |x| <= 708
+inline double ExpressionParser::ExpKernel(double x, bool precise) {
+    const double shifter = 6755399441055744.0;
+    double t = x * 1.4426950408889634 + shifter;
+    double k = t - shifter;
+    double r = (x - k * 6.93147180369123816490e-01) - k * 1.90821492927058770002e-10;
+    double p = precise ? 1 + r * (1 + r * (1.0 / 2 + r * (1.0 / 6 + r * (1.0 / 24 + r * (1.0 / 120 + r * (1.0 / 720 + r * (1.0 / 5040)))))))
+                       : 1 + r * (1 + r * (1.0 / 2 + r * (1.0 / 6 + r * (1.0 / 24 + r * (1.0 / 120)))));
+    uint64_t bits;
+    memcpy(&bits, &t, sizeof(t));
+    bits = (bits + 1023) << 52; // младшие биты t содержат k
+    double scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+// приближение натурального логарифма: x = m * 2^e, m из [sqrt(2)/2, sqrt(2)), ln(m) = 2*atanh(s), s = (m - 1) / (m + 1).
+// Точно для нормализованных положительных x
+inline double ExpressionParser::LnKernel(double x, bool precise) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(x));
+    int64_t e = int64_t(bits - 0x3fe6a09e667f3bcdULL) >> 52; // порядок относительно sqrt(2)/2
+    bits -= uint64_t(e) << 52;
+    double m;
+    memcpy(&m, &bits, sizeof(m));
+
+    double s = (m - 1) / (m + 1);
+    double s2 = s * s;
+    double p = precise ? 1 + s2 * (1.0 / 3 + s2 * (1.0 / 5 + s2 * (1.0 / 7 + s2 * (1.0 / 9))))
+                       : 1 + s2 * (1.0 / 3 + s2 * (1.0 / 5));
+    return e * 0.69314718055994531 + 2 * s * p;
+}
+
+// попадает ли аргумент в область приближённого ядра, вне области вычисляется точная функция
+inline bool ExpressionParser::IsApproximable(Opcode opcode, double x) {
+    switch (opcode) {
+        case Opcode::SinApprox:
+        case Opcode::CosApprox: return fabs(x) <= 1e5;
+        case Opcode::ExpApprox: return fabs(x) <= 708;
+        default: return x >= DBL_MIN && x <= DBL_MAX;
+    }
+}
+
+// вычисление приближённого ядра
+inline double ExpressionParser::ApplyApproximation(const Instruction& instruction, double x) {
+    bool precise = instruction.index != 0;
+
+    if (!IsApproximable(instruction.opcode, x))
+        return ApplyInstruction({ GetExactOpcode(instruction.opcode), 0, 0 }, &x);
+
+    switch (instruction.opcode) {
+        case Opcode::SinApprox: return SinKernel(x, precise, false);
+        case Opcode::CosApprox: return SinKernel(x, precise, true);
+        case Opcode::ExpApprox: return ExpKernel(x, precise);
+        default: return LnKernel(x, precise);
+    }
+}
+
+// вычисление приближённого ядра на блоке строк: если все аргументы в области ядра, цикл без ветвлений
+// и вызовов (векторизуется), иначе построчно с точной функцией вне области. result может совпадать с args
+void ExpressionParser::ApplyApproximationRows(const Instruction& instruction, const double *args, double *result, size_t size) {
+    Opcode opcode = instruction.opcode;
+    bool precise = instruction.index != 0;
+    bool inside = true;
+
+    for (size_t i = 0; i < size; i++)
+        inside &= IsApproximable(opcode, args[i]);
+
+    if (!inside) {
+        for (size_t i = 0; i < size; i++)
+            result[i] = ApplyApproximation(instruction, args[i]);
+        return;
+    }
+
+    if (opcode == Opcode::SinApprox || opcode == Opcode::CosApprox) {
+        for (size_t i = 0; i < size; i++)
+            result[i] = SinKernel(args[i], precise, opcode == Opcode::CosApprox);
+    }
+    else if (opcode == Opcode::ExpApprox) {
+        for (size_t i = 0; i < size; i++)
+            result[i] = ExpKernel(args[i], precise);
+    }
+    else {
+        for (size_t i = 0; i < size; i++)
+            result[i] = LnKernel(args[i], precise);
+    }
+}
+
+// код приближённого ядра для функции (Number - ядра нет)
+Opcode ExpressionParser::GetApproximateOpcode(Opcode opcode) {
+    switch (opcode) {
+        case Opcode::Sin: return Opcode::SinApprox;
+        case Opcode::Cos: return Opcode::CosApprox;
+        case Opcode::Exp: return Opcode::ExpApprox;
+        case Opcode::Ln: return Opcode::LnApprox;
+        default: return Opcode::Number;
+    }
+}
+
+// код точной функции для приближённого ядра (Number - инструкция не является приближённым ядром)
+Opcode ExpressionParser::GetExactOpcode(Opcode opcode) {
+    switch (opcode) {
+        case Opcode::SinApprox: return Opcode::Sin;
+        case Opcode::CosApprox: return Opcode::Cos;
+        case Opcode::ExpApprox: return Opcode::Exp;
+        case Opcode::LnApprox: return Opcode::Ln;
+        default: return Opcode::Number;
+    }
+}
+
+// гарантированная относительная погрешность приближённого ядра в его области (измеренный максимум с запасом)
+double ExpressionParser::GetKernelError(Opcode opcode, bool precise) {
+    switch (opcode) {
+        case Opcode::SinApprox:
+        case Opcode::CosApprox: return precise ? 3e-10 : 6e-6;
+        case Opcode::ExpApprox: return precise ? 1e-8 : 4e-6;
+        default: return precise ? 3e-9 : 4e-6;
+    }
+}
+
+// область значений произведения по областям сомножителей. Значения конечны, поэтому ноль на бесконечность даёт ноль
+void ExpressionParser::MultiplyRanges(double low1, double high1, double low2, double high2, double& low, double& high) {
+    double bounds1[2] = { low1, high1 };
+    double bounds2[2] = { low2, high2 };
+    low = INFINITY;
+    high = -INFINITY;
+
+    for (double a : bounds1) {
+        for (double b : bounds2) {
+            double product = a == 0 || b == 0 ? 0 : a * b;
+            low = min(low, product);
+            high = max(high, product);
+        }
+    }
+}
+
+// область значений результата инструкции по областям аргументов [low[i], high[i]] (интервальная арифметика).
+// Область переменной и неизвестных функций - вся прямая
+void ExpressionParser::GetRange(const Instruction& instruction, const double *low, const double *high, double& resultLow, double& resultHigh) {
+    resultLow = -INFINITY;
+    resultHigh = INFINITY;
+
+    switch (instruction.opcode) {
+        case Opcode::Number:
+            resultLow = resultHigh = instruction.value;
+            break;
+
+        case Opcode::Neg:
+            resultLow = -high[0];
+            resultHigh = -low[0];
+            break;
+
+        case Opcode::Add:
+            resultLow = low[0] + low[1];
+            resultHigh = high[0] + high[1];
+            break;
+
+        case Opcode::Sub:
+            resultLow = low[0] - high[1];
+            resultHigh = high[0] - low[1];
+            break;
+
+        case Opcode::NegAdd:
+            resultLow = low[1] - high[0];
+            resultHigh = high[1] - low[0];
+            break;
+
+        case Opcode::Mul:
+            MultiplyRanges(low[0], high[0], low[1], high[1], resultLow, resultHigh);
+            break;
+
+        case Opcode::Square:
+            MultiplyRanges(low[0], high[0], low[0], high[0], resultLow, resultHigh);
+            resultLow = max(resultLow, 0.0);
+            break;
+
+        case Opcode::MulAdd:
+        case Opcode::MulSub:
+            MultiplyRanges(low[0], high[0], low[1], high[1], resultLow, resultHigh);
+            resultLow += instruction.opcode == Opcode::MulAdd ? low[2] : -high[2];
+            resultHigh += instruction.opcode == Opcode::MulAdd ? high[2] : -low[2];
+            break;
+
+        case Opcode::AddMul:
+        case Opcode::SubMul: {
+            double productLow, productHigh;
+            MultiplyRanges(low[1], high[1], low[2], high[2], productLow, productHigh);
+            resultLow = low[0] + (instruction.opcode == Opcode::AddMul ? productLow : -productHigh);
+            resultHigh = high[0] + (instruction.opcode == Opcode::AddMul ? productHigh : -productLow);
+            break;
+        }
+
+        case Opcode::Sum:
+        case Opcode::Avg:
+        case Opcode::Max:
+        case Opcode::Min:
+            resultLow = low[0];
+            resultHigh = high[0];
+
+            for (int i = 1; i < instruction.index; i++) {
+                if (instruction.opcode == Opcode::Max || instruction.opcode == Opcode::Min) {
+                    resultLow = instruction.opcode == Opcode::Max ? max(resultLow, low[i]) : min(resultLow, low[i]);
+                    resultHigh = instruction.opcode == Opcode::Max ? max(resultHigh, high[i]) : min(resultHigh, high[i]);
+                }
+                else {
+                    resultLow += low[i];
+                    resultHigh += high[i];
+                }
+            }
+
+            if (instruction.opcode == Opcode::Avg) {
+                resultLow /= instruction.index;
+                resultHigh /= instruction.index;
+            }
+            break;
+
+        case Opcode::Abs:
+            resultLow = low[0] > 0 ? low[0] : (high[0] < 0 ? -high[0] : 0);
+            resultHigh = max(fabs(low[0]), fabs(high[0]));
+            break;
+
+        case Opcode::Sqrt:
+        case Opcode::Root2:
+            resultLow = sqrt(max(low[0], 0.0));
+            resultHigh = sqrt(max(high[0], 0.0));
+            break;
+
+        case Opcode::Sin:
+        case Opcode::Cos:
+        case Opcode::Tanh:
+        case Opcode::Sign:
+        case Opcode::SinApprox:
+        case Opcode::CosApprox:
+            resultLow = -1;
+            resultHigh = 1;
+            break;
+
+        case Opcode::Exp:
+        case Opcode::ExpApprox:
+            resultLow = exp(low[0]);
+            resultHigh = exp(high[0]);
+            break;
+
+        case Opcode::Ln:
+        case Opcode::LnApprox:
+            resultLow = log(max(low[0], 0.0));
+            resultHigh = log(max(high[0], 0.0));
+            break;
+
+        case Opcode::Exp2:
+        case Opcode::Hypot:
+        case Opcode::SumSquares:
+        case Opcode::InverseSqrt:
+            resultLow = 0;
+            break;
+
+        case Opcode::Cosh:
+            resultLow = 1;
+            break;
+
+        case Opcode::Asin:
+        case Opcode::Atan:
+            resultLow = -M_PI / 2;
+            resultHigh = M_PI / 2;
+            break;
+
+        case Opcode::Acos:
+            resultLow = 0;
+            resultHigh = M_PI;
+            break;
+
+        case Opcode::Less:
+        case Opcode::LessEqual:
+        case Opcode::Greater:
+        case Opcode::GreaterEqual:
+        case Opcode::Equal:
+        case Opcode::NotEqual:
+        case Opcode::And:
+        case Opcode::Or:
+        case Opcode::Not:
+            resultLow = 0;
+            resultHigh = 1;
+            break;
+
+        case Opcode::If:
+            resultLow = min(low[1], low[2]);
+            resultHigh = max(high[1], high[2]);
+            break;
+
+        default:
+            break;
+    }
+
+    // -inf + inf на границах или NaN в числах - область неизвестна
+    if (isnan(resultLow) || isnan(resultHigh)) {
+        resultLow = -INFINITY;
+        resultHigh = INFINITY;
+    }
+}
+
+// множитель относительной погрешности слагаемого из [low, high] в сумме с остальными слагаемыми из [restLow, restHigh]:
+// при одинаковых знаках |t| <= |s| и множитель не больше 1, иначе max|t| / min|s|. Если сумма может обратиться
+// в ноль, слагаемые могут сократиться и погрешность не ограничена
+double ExpressionParser::GetTermCondition(double low, double high, double restLow, double restHigh) {
+    if ((low >= 0 && restLow >= 0) || (high <= 0 && restHigh <= 0))
+        return 1;
+
+    double term = max(fabs(low), fabs(high));
+    double sumLow = low + restLow;
+    double sumHigh = high + restHigh;
+
+    if (sumLow > 0)
+        return term / sumLow;
+
+    if (sumHigh < 0)
+        return term / -sumHigh;
+
+    return INFINITY;
+}
+
+// множитель, с которым относительная погрешность аргумента переходит в результат (в первом порядке), по областям
+// значений аргументов [low[i], high[i]]. Для сложения и вычитания множитель ограничен, только если область суммы
+// отделена от нуля (или знаки слагаемых совпадают). Для функций, у которых множитель зависит от значения
+// (sin(x) около нуля, сравнения, условие if), возвращается бесконечность
+double ExpressionParser::GetConditionNumber(const Instruction& instruction, int argument, const double *low, const double *high) {
+    double productLow, productHigh; // область произведения в суперинструкциях
+
+    switch (instruction.opcode) {
+        case Opcode::If:
+            return argument == 0 ? INFINITY : 1;
+
+        case Opcode::Add:
+            return GetTermCondition(low[argument], high[argument], low[1 - argument], high[1 - argument]);
+
+        case Opcode::Sub:
+            if (argument == 0)
+                return GetTermCondition(low[0], high[0], -high[1], -low[1]);
+
+            return GetTermCondition(-high[1], -low[1], low[0], high[0]);
+
+        case Opcode::NegAdd:
+            if (argument == 0)
+                return GetTermCondition(-high[0], -low[0], low[1], high[1]);
+
+            return GetTermCondition(low[1], high[1], -high[0], -low[0]);
+
+        case Opcode::MulAdd:
+        case Opcode::MulSub: {
+            MultiplyRanges(low[0], high[0], low[1], high[1], productLow, productHigh);
+            double restLow = instruction.opcode == Opcode::MulAdd ? low[2] : -high[2];
+            double restHigh = instruction.opcode == Opcode::MulAdd ? high[2] : -low[2];
+
+            if (argument < 2)
+                return GetTermCondition(productLow, productHigh, restLow, restHigh);
+
+            return GetTermCondition(restLow, restHigh, productLow, productHigh);
+        }
+
+        case Opcode::AddMul:
+        case Opcode::SubMul: {
+            MultiplyRanges(low[1], high[1], low[2], high[2], productLow, productHigh);
+            double termLow = instruction.opcode == Opcode::AddMul ? productLow : -productHigh;
+            double termHigh = instruction.opcode == Opcode::AddMul ? productHigh : -productLow;
+
+            if (argument > 0)
+                return GetTermCondition(termLow, termHigh, low[0], high[0]);
+
+            return GetTermCondition(low[0], high[0], termLow, termHigh);
+        }
+
+        case Opcode::Sum:
+        case Opcode::Avg: {
+            double restLow = 0, restHigh = 0;
+
+            for (int i = 0; i < instruction.index; i++) {
+                if (i != argument) {
+                    restLow += low[i];
+                    restHigh += high[i];
+                }
+            }
+
+            return GetTermCondition(low[argument], high[argument], restLow, restHigh);
+        }
+
+        case Opcode::Neg:
+        case Opcode::Mul:
+        case Opcode::Div:
+        case Opcode::Abs:
+        case Opcode::Max:
+        case Opcode::Min:
+        case Opcode::Hypot:
+        case Opcode::Reciprocal:
+            return 1;
+
+        case Opcode::Square:
+        case Opcode::SumSquares:
+            return 2;
+
+        case Opcode::Cube:
+            return 3;
+
+        case Opcode::PowInt:
+            return fabs(double(instruction.index));
+
+        case Opcode::Sqrt:
+        case Opcode::Root2:
+        case Opcode::InverseSqrt:
+            return 0.5;
+
+        case Opcode::Cbrt:
+        case Opcode::Root3:
+            return 1.0 / 3;
+
+        default:
+            return INFINITY;
+    }
+}
+
+// евклидова норма аргументов, масштабированная на максимальный модуль для защиты от переполнения
+double ExpressionParser::Hypot(const double *args, int count) {
+    double scale = 0;
+
+    for (int i = 0; i < count; i++)
+        scale = scale < fabs(args[i]) ? fabs(args[i]) : scale;
+
+    if (scale == 0 || isinf(scale))
+        return scale;
+
+    double sum = 0;
+
+    for (int i = 0; i < count; i++)
+        sum += (args[i] / scale) * (args[i] / scale);
+
+    return scale * sqrt(sum);
+}
+
+// получение кода инструкции для лексемы
+Opcode ExpressionParser::GetOpcode(const string& lexeme) const {
+    static const map<string, Opcode> opcodes = {
+        { "~", Opcode::Neg }, { "+", Opcode::Add }, { "-", Opcode::Sub }, { "*", Opcode::Mul }, { "/", Opcode::Div }, { "%", Opcode::Mod }, { "^", Opcode::Pow },
+        { "sin", Opcode::Sin }, { "cos", Opcode::Cos }, { "tan", Opcode::Tan }, { "tg", Opcode::Tan }, { "cot", Opcode::Cot }, { "ctg", Opcode::Cot },
+        { "sinh", Opcode::Sinh }, { "sh", Opcode::Sinh }, { "cosh", Opcode::Cosh }, { "ch", Opcode::Cosh }, { "tanh", Opcode::Tanh }, { "th", Opcode::Tanh },
+        { "asin", Opcode::Asin }, { "arcsin", Opcode::Asin }, { "acos", Opcode::Acos }, { "arccos", Opcode::Acos }, { "atan", Opcode::Atan }, { "arctg", Opcode::Atan },
+        { "ln", Opcode::Ln }, { "log2", Opcode::Log2 }, { "lg", Opcode::Lg }, { "exp", Opcode::Exp },
+        { "sqrt", Opcode::Sqrt }, { "cbrt", Opcode::Cbrt }, { "abs", Opcode::Abs }, { "sign", Opcode::Sign },
+        { "log", Opcode::Log }, { "pow", Opcode::Pow }, { "root", Opcode::Root },
+        { "max", Opcode::Max }, { "min", Opcode::Min }, { "sum", Opcode::Sum }, { "avg", Opcode::Avg }, { "hypot", Opcode::Hypot },
+        { "<", Opcode::Less }, { "<=", Opcode::LessEqual }, { ">", Opcode::Greater }, { ">=", Opcode::GreaterEqual }, { "==", Opcode::Equal }, { "!=", Opcode::NotEqual },
+        { "&&", Opcode::And }, { "||", Opcode::Or }, { "!", Opcode::Not }, { "if", Opcode::If }
+    };
+
+    auto it = opcodes.find(lexeme);
+
+    if (it == opcodes.end())
+        throw string("Unknown rpn lexeme '") + lexeme + "'";
+
+    return it->second;
+}
+
+// получение начала операнда, заканчивающегося перед инструкцией end
+size_t ExpressionParser::GetOperandStart(size_t end) const {
+    int need = 1; // количество значений, которые ещё нужно найти
+
+    while (need > 0) {
+        end--;
+
+        if (!IsJump(program[end].opcode))
+            need += GetArgumentsCount(program[end]) - 1;
+    }
+
+    return end;
+}
+
+// проверка, что операнд является заданным числом
+bool ExpressionParser::IsNumberOperand(size_t start, size_t end, double value) const {
+    return end - start == 1 && program[start].opcode == Opcode::Number && program[start].value == value;
+}
+
+// удаление операнда из программы
+void ExpressionParser::RemoveOperand(size_t start, size_t end) {
+    program.erase(program.begin() + start, program.begin() + end);
+}
+
+// понижение силы возведения в степень, показатель и основание уже находятся в программе
+void ExpressionParser::ReducePower() {
+    size_t end = program.size();
+    size_t start = GetOperandStart(end); // начало показателя
+    size_t baseStart = GetOperandStart(start); // начало основания
+
+    // 2^x = exp2(x)
+    if (IsNumberOperand(baseStart, start, 2)) {
+        RemoveOperand(baseStart, start);
+        program.push_back({ Opcode::Exp2, 0, 0 });
+        return;
+    }
+
+    if (end - start != 1 || program[start].opcode != Opcode::Number) {
+        program.push_back({ Opcode::Pow, 0, 0 });
+        return;
+    }
+
+    double exponent = program[start].value;
+    program.pop_back();
+
+    if (exponent == 0) { // pow(x, 0) = 1 для любого x
+        RemoveOperand(baseStart, start);
+        program.push_back({ Opcode::Number, 0, 1 });
+    }
+    else if (exponent == 1) {
+        return;
+    }
+    else if (exponent == 2) {
+        program.push_back({ Opcode::Square, 0, 0 });
+    }
+    else if (exponent == 3) {
+        program.push_back({ Opcode::Cube, 0, 0 });
+    }
+    else if (exponent == -1) {
+        program.push_back({ Opcode::Reciprocal, 0, 0 });
+    }
+    else if (exponent == 0.5) {
+        program.push_back({ Opcode::Root2, 0, 0 });
+    }
+    else if (exponent == -0.5) {
+        program.push_back({ Opcode::InverseSqrt, 0, 0 });
+    }
+    else if (exponent == int(exponent) && fabs(exponent) <= 16) {
+        program.push_back({ Opcode::PowInt, int(exponent), 0 });
+    }
+    else {
+        program.push_back({ Opcode::Number, 0, exponent });
+        program.push_back({ Opcode::Pow, 0, 0 });
+    }
+}
+
+// учёт глубины стека при добавлении инструкции: аргументов на стеке должно быть не меньше, чем нужно инструкции,
+// иначе свёртка и понижение силы обратились бы к операндам перед началом программы
+void ExpressionParser::UpdateDepth(const Instruction& instruction, int& depth) {
+    int count = GetArgumentsCount(instruction);
+
+    if (depth < count)
+        throw string("Incorrect expression");
+
+    depth += 1 - count;
+}
+
+// добавление инструкции со свёрткой констант и понижением силы
+void ExpressionParser::AddInstruction(const Instruction& instruction, int& depth) {
+    UpdateDepth(instruction, depth);
+
+    Opcode opcode = instruction.opcode;
+    int count = GetArgumentsCount(instruction);
+    size_t end = program.size();
+
+    bool constant = count > 0;
+
+    for (int i = 1; i <= count && constant; i++)
+        constant = program[end - i].opcode == Opcode::Number;
+
+    // все аргументы - числа, вычисляем инструкцию сразу
+    if (constant) {
+        vector<double> args(count);
+
+        for (int i = 0; i < count; i++)
+            args[i] = program[end - count + i].value;
+
+        program.resize(end - count);
+        program.push_back({ Opcode::Number, 0, ApplyInstruction(instruction, args.data()) });
+        return;
+    }
+
+    if (opcode == Opcode::Pow) {
+        ReducePower();
+        return;
+    }
+
+    if (opcode == Opcode::Root || opcode == Opcode::Log) {
+        size_t start = GetOperandStart(end); // начало второго аргумента
+        size_t first = GetOperandStart(start); // начало первого аргумента
+
+        if (start - first != 1 || program[first].opcode != Opcode::Number) {
+            program.push_back(instruction);
+            return;
+        }
+
+        double arg = program[first].value;
+        RemoveOperand(first, start);
+
+        if (opcode == Opcode::Root) {
+            if (arg == 2) {
+                program.push_back({ Opcode::Root2, 0, 0 });
+            }
+            else if (arg == 3) {
+                program.push_back({ Opcode::Root3, 0, 0 });
+            }
+            else {
+                program.push_back({ Opcode::Number, 0, 1.0 / arg });
+                ReducePower();
+            }
+        }
+        else if (arg == 2) {
+            program.push_back({ Opcode::Log2, 0, 0 });
+        }
+        else if (arg == 10) {
+            program.push_back({ Opcode::Lg, 0, 0 });
+        }
+        else {
+            program.push_back({ Opcode::LogBase, 0, 1.0 / log(arg) });
+        }
+
+        return;
+    }
+
+    // exp(x*ln2) = exp2(x)
+    if (opcode == Opcode::Exp && program[end - 1].opcode == Opcode::Mul) {
+        size_t right = GetOperandStart(end - 1);
+        size_t left = GetOperandStart(right);
+
+        if (IsNumberOperand(right, end - 1, log(2))) {
+            program.resize(right);
+            program.push_back({ Opcode::Exp2, 0, 0 });
+            return;
+        }
+
+        if (IsNumberOperand(left, right, log(2))) {
+            program.pop_back();
+            RemoveOperand(left, right);
+            program.push_back({ Opcode::Exp2, 0, 0 });
+            return;
+        }
+    }
+
+    program.push_back(instruction);
+}
+
+// проверка совпадения операндов [start, middle) и [middle, end)
+bool ExpressionParser::IsSameOperand(const vector<Instruction>& code, size_t start, size_t middle, size_t end) {
+    if (middle - start != end - middle)
+        return false;
+
+    for (size_t i = start; i < middle; i++) {
+        const Instruction& a = code[i];
+        const Instruction& b = code[i - start + middle];
+
+        if (a.opcode != b.opcode || a.index != b.index || a.value != b.value || a.function != b.function)
+            return false;
+    }
+
+    return true;
+}
+
+// слияние частых последовательностей инструкций в суперинструкции для уменьшения числа диспетчеризаций:
+// a*a -> a square, a*b + c -> muladd, c + a*b -> addmul, a*b - c -> mulsub, c - a*b -> submul,
+// a^2 + b^2 -> sumsq, -a + b -> negadd, a + -b -> a - b, a - -b -> a + b
+void ExpressionParser::Fuse() {
+    vector<Instruction> result;
+    vector<size_t> starts; // начала значений на стеке
+
+    for (const Instruction& instruction : program) {
+        int count = GetArgumentsCount(instruction);
+        size_t start = count > 0 ? starts[starts.size() - count] : result.size();
+        Instruction fused = instruction;
+
+        if (count == 2) {
+            Opcode opcode = instruction.opcode;
+            size_t middle = starts.back(); // начало второго аргумента
+            Opcode left = result[middle - 1].opcode; // инструкция, вычисляющая первый аргумент
+            Opcode right = result.back().opcode; // инструкция, вычисляющая второй аргумент
+            bool additive = opcode == Opcode::Add || opcode == Opcode::Sub;
+
+            if (opcode == Opcode::Mul && IsSameOperand(result, start, middle, result.size())) {
+                result.resize(middle);
+                fused = { Opcode::Square, 0, 0 };
+            }
+            else if (opcode == Opcode::Add && left == Opcode::Square && right == Opcode::Square) {
+                result.pop_back();
+                result.erase(result.begin() + middle - 1);
+                fused = { Opcode::SumSquares, 0, 0 };
+            }
+            else if (additive && left == Opcode::Mul) {
+                result.erase(result.begin() + middle - 1);
+                fused = { opcode == Opcode::Add ? Opcode::MulAdd : Opcode::MulSub, 0, 0 };
+            }
+            else if (additive && right == Opcode::Mul) {
+                result.pop_back();
+                fused = { opcode == Opcode::Add ? Opcode::AddMul : Opcode::SubMul, 0, 0 };
+            }
+            else if (additive && right == Opcode::Neg) {
+                result.pop_back();
+                fused = { opcode == Opcode::Add ? Opcode::Sub : Opcode::Add, 0, 0 };
+            }
+            else if (opcode == Opcode::Add && left == Opcode::Neg) {
+                result.erase(result.begin() + middle - 1);
+                fused = { Opcode::NegAdd, 0, 0 };
+            }
+        }
+
+        starts.resize(starts.size() - count);
+        starts.push_back(start);
+        result.push_back(fused);
+    }
+
+    program = result;
+}
+
+// добавление переходов для сокращённого вычисления условий:
+// a && b -> a jf b &&, a || b -> a jt b ||, if(c, a, b) -> c br a jmp b if
+// в пакетном режиме переходы пропускаются, и условия вычисляются без ветвлений по всем аргументам
+void ExpressionParser::InsertJumps() {
+    vector<Opcode> jumps(program.size(), Opcode::Number); // переходы, вставляемые перед инструкциями (Number - нет перехода)
+    vector<pair<size_t, size_t>> owned(program.size()); // инструкции, перед которыми стоят переходы условия
+    vector<size_t> starts; // начала значений на стеке
+    bool found = false;
+
+    for (size_t i = 0; i < program.size(); i++) {
+        int count = GetArgumentsCount(program[i]);
+        size_t start = count > 0 ? starts[starts.size() - count] : i;
+        Opcode opcode = program[i].opcode;
+
+        if (opcode == Opcode::And || opcode == Opcode::Or) {
+            jumps[starts.back()] = opcode == Opcode::And ? Opcode::JumpIfFalse : Opcode::JumpIfTrue;
+            owned[i] = make_pair(starts.back(), starts.back());
+            found = true;
+        }
+        else if (opcode == Opcode::If) {
+            jumps[starts[starts.size() - 2]] = Opcode::Branch;
+            jumps[starts.back()] = Opcode::Jump;
+            owned[i] = make_pair(starts[starts.size() - 2], starts.back());
+            found = true;
+        }
+
+        starts.resize(starts.size() - count);
+        starts.push_back(start);
+    }
+
+    if (!found)
+        return;
+
+    vector<Instruction> result;
+    vector<size_t> positions(program.size()); // позиции вставленных переходов
+
+    for (size_t i = 0; i < program.size(); i++) {
+        if (jumps[i] != Opcode::Number) {
+            positions[i] = result.size();
+            result.push_back({ jumps[i], 0, 0 });
+        }
+
+        result.push_back(program[i]);
+        Opcode opcode = program[i].opcode;
+        size_t end = result.size() - 1; // позиция самой инструкции
+
+        // вычисляем длины прыжков: индекс увеличивается на index, затем переходит к следующей инструкции
+        if (opcode == Opcode::And || opcode == Opcode::Or) {
+            size_t jump = positions[owned[i].first];
+            result[jump].index = end - jump; // за инструкцию && или ||
+        }
+        else if (opcode == Opcode::If) {
+            size_t branch = positions[owned[i].first];
+            size_t jump = positions[owned[i].second];
+            result[branch].index = jump - branch; // на начало второй ветви
+            result[jump].index = end - jump - 1; // на инструкцию if
+        }
+    }
+
+    program = result;
+}
+
+// перемешивание битов хеша (финализатор splitmix64)
+uint64_t ExpressionParser::MixHash(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+// добавление значения к хешу с учётом порядка
+uint64_t ExpressionParser::CombineHash(uint64_t hash, uint64_t value) {
+    return MixHash(hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2)));
+}
+
+// хеш строки FNV-1a с перемешиванием
+uint64_t ExpressionParser::HashString(const string& s, uint64_t seed) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+
+    for (unsigned char c : s) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return MixHash(hash);
+}
+
+// построение канонической формы и структурного хеша по программе после свёртки констант:
+// синонимы функций уже сведены к одному коду инструкции, операнды коммутативных операций упорядочиваются
+// по хешу, a > b записывается как b < a. Переменные и пользовательские функции учитываются по именам,
+// поэтому форма не зависит от пробелов, синонимов и порядка появления переменных.
+// Сложение и умножение не перегруппировываются, так как (a + b) + c и a + (b + c) округляются по-разному
+void ExpressionParser::Canonicalize(const vector<Instruction>& code) const {
+    vector<string> names(values.size());
+
+    for (auto it = variables.begin(); it != variables.end(); it++)
+        names[it->second] = it->first;
+
+    vector<Instruction> nodes(code); // узлы дерева выражения в порядке польской записи
+    vector<size_t> children; // аргументы всех узлов подряд, без отдельного массива на каждый узел
+    vector<size_t> firstChild(nodes.size() + 1); // начало аргументов узла в children
+    vector<ExpressionHash> hashes(nodes.size());
+    vector<string> tokens(nodes.size()); // текстовое представление узлов
+    vector<size_t> stack;
+    ostringstream os;
+    os << setprecision(17);
+    children.reserve(nodes.size()); // у дерева аргументов меньше, чем узлов
+    stack.reserve(nodes.size());
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        Instruction& node = nodes[i];
+        int count = GetArgumentsCount(node);
+        firstChild[i] = children.size();
+        children.insert(children.end(), stack.end() - count, stack.end());
+        stack.resize(stack.size() - count);
+        size_t *args = children.data() + firstChild[i];
+
+        if (node.opcode == Opcode::Greater || node.opcode == Opcode::GreaterEqual) {
+            node.opcode = node.opcode == Opcode::Greater ? Opcode::Less : Opcode::LessEqual;
+            swap(args[0], args[1]);
+        }
+
+        Opcode opcode = node.opcode;
+
+        if (opcode == Opcode::Add || opcode == Opcode::Mul || opcode == Opcode::Equal || opcode == Opcode::NotEqual || opcode == Opcode::And || opcode == Opcode::Or)
+            if (hashes[args[1]] < hashes[args[0]])
+                swap(args[0], args[1]);
+
+        os.str("");
+
+        if (opcode == Opcode::Number)
+            os << node.value;
+        else if (opcode == Opcode::Variable)
+            os << names[node.index];
+        else if (opcode == Opcode::LogBase)
+            os << "logc(" << node.value << ")";
+        else if (opcode == Opcode::PowInt || (count > 0 && node.index > 0))
+            os << GetInstructionName(node) << "(" << node.index << ")";
+        else
+            os << GetInstructionName(node);
+
+        tokens[i] = os.str();
+
+        uint64_t bits;
+        memcpy(&bits, &node.value, sizeof(bits));
+        hashes[i].high = CombineHash(HashString(tokens[i], 0x6a09e667f3bcc908ULL), bits);
+        hashes[i].low = CombineHash(HashString(tokens[i], 0xbb67ae8584caa73bULL), uint64_t(opcode));
+
+        for (int j = 0; j < count; j++) {
+            hashes[i].high = CombineHash(hashes[i].high, hashes[args[j]].high);
+            hashes[i].low = CombineHash(hashes[i].low, hashes[args[j]].low);
+        }
+
+        stack.push_back(i);
+    }
+
+    firstChild[nodes.size()] = children.size();
+    hash = hashes[stack.back()];
+
+    // записываем дерево в польской записи с упорядоченными аргументами без рекурсии
+    canonical = "";
+    vector<pair<size_t, size_t>> path = { make_pair(stack.back(), size_t(0)) }; // узел и номер следующего аргумента
+
+    while (!path.empty()) {
+        pair<size_t, size_t>& top = path.back();
+
+        if (firstChild[top.first] + top.second < firstChild[top.first + 1]) {
+            path.push_back(make_pair(children[firstChild[top.first] + top.second++], size_t(0)));
+            continue;
+        }
+
+        canonical += (canonical.empty() ? "" : " ") + tokens[top.first];
+        path.pop_back();
+    }
+}
+
+// построение регистровой (трёхадресной) программы из стековой: регистры [0, n) - переменные, затем константы,
+// затем временные значения. Одинаковые инструкции от одинаковых аргументов вычисляются один раз, а регистр
+// временного значения освобождается после последнего использования и может сразу стать регистром результата.
+// Условия вычисляются без переходов, как в пакетном режиме
+void ExpressionParser::CompileRegisters(const vector<Instruction>& code) const {
+    map<unsigned long long, int> constants; // регистры констант по битовому представлению значения
+    vector<double> constantValues;
+
+    for (const Instruction& instruction : code) {
+        if (instruction.opcode != Opcode::Number)
+            continue;
+
+        unsigned long long bits;
+        memcpy(&bits, &instruction.value, sizeof(bits));
+
+        if (constants.insert(make_pair(bits, int(values.size() + constantValues.size()))).second)
+            constantValues.push_back(instruction.value);
+    }
+
+    int first = values.size() + constantValues.size(); // первый временный регистр
+    map<tuple<Opcode, int, unsigned long long, const UserFunction *, vector<int>>, int> known; // уже вычисленные значения
+    vector<int> stack; // регистры значений на стеке, временные значения пока нумеруются по порядку появления
+
+    registerProgram.clear();
+    registerArguments.clear();
+
+    for (const Instruction& instruction : code) {
+        unsigned long long bits;
+        memcpy(&bits, &instruction.value, sizeof(bits));
+
+        if (instruction.opcode == Opcode::Number) {
+            stack.push_back(constants.at(bits));
+            continue;
+        }
+
+        if (instruction.opcode == Opcode::Variable) {
+            stack.push_back(instruction.index);
+            continue;
+        }
+
+        int count = GetArgumentsCount(instruction);
+        vector<int> args(stack.end() - count, stack.end());
+        stack.resize(stack.size() - count);
+
+        auto key = make_tuple(instruction.opcode, instruction.index, bits, instruction.function, args);
+        auto it = known.find(key);
+
+        if (it != known.end()) {
+            stack.push_back(it->second);
+            continue;
+        }
+
+        int target = first + registerProgram.size();
+        known[key] = target;
+        registerProgram.push_back({ instruction, target, int(registerArguments.size()) });
+        registerArguments.insert(registerArguments.end(), args.begin(), args.end());
+        stack.push_back(target);
+    }
+
+    registerResult = stack.back();
+
+    // индекс последней инструкции, использующей временное значение (результат нужен до конца)
+    vector<size_t> lastUse(registerProgram.size(), 0);
+
+    for (size_t i = 0; i < registerProgram.size(); i++)
+        for (int j = 0; j < GetArgumentsCount(registerProgram[i].instruction); j++)
+            if (registerArguments[registerProgram[i].arguments + j] >= first)
+                lastUse[registerArguments[registerProgram[i].arguments + j] - first] = i;
+
+    if (registerResult >= first)
+        lastUse[registerResult - first] = registerProgram.size();
+
+    // распределяем временные значения по регистрам
+    vector<int> assigned(registerProgram.size()); // регистр временного значения относительно first
+    vector<int> released; // свободные регистры
+    int count = 0; // количество временных регистров
+
+    for (size_t i = 0; i < registerProgram.size(); i++) {
+        for (int j = 0; j < GetArgumentsCount(registerProgram[i].instruction); j++) {
+            int& arg = registerArguments[registerProgram[i].arguments + j];
+
+            if (arg < first)
+                continue;
+
+            int value = arg - first;
+            arg = first + assigned[value];
+
+            if (lastUse[value] == i) {
+                released.push_back(assigned[value]);
+                lastUse[value] = registerProgram.size() + 1; // повторный аргумент не освобождает регистр второй раз
+            }
+        }
+
+        if (released.empty()) {
+            assigned[i] = count++;
+        }
+        else {
+            assigned[i] = released.back();
+            released.pop_back();
+        }
+
+        registerProgram[i].target = first + assigned[i];
+    }
+
+    if (registerResult >= first)
+        registerResult = first + assigned[registerResult - first];
+
+    registerTemporaries = first;
+    registers.assign(first + count, 0);
+    copy(constantValues.begin(), constantValues.end(), registers.begin() + values.size());
+
+    int arity = 0;
+
+    for (const RegisterInstruction& instruction : registerProgram)
+        arity = max(arity, GetArgumentsCount(instruction.instruction));
+
+    registerRow.assign(arity, 0);
+}
+
+// компиляция польской записи в программу
+// добавление инструкции без свёртки констант и понижения силы для быстрой начальной компиляции
+void ExpressionParser::AddBaselineInstruction(const Instruction& instruction, int& depth) {
+    UpdateDepth(instruction, depth);
+    program.push_back(instruction);
+}
+
+// перевод польской записи в программу: с optimize - со свёрткой констант и понижением силы, иначе - без оптимизаций
+void ExpressionParser::Translate(bool optimize) {
+    program.clear();
+    void (ExpressionParser::*add)(const Instruction&, int&) = optimize ? &ExpressionParser::AddInstruction : &ExpressionParser::AddBaselineInstruction;
+    int depth = 0; // количество операндов на стеке после уже добавленных инструкций
+
+    for (int index : rpn) {
+        const Lexeme& lexeme = lexemePool[index];
+
+        if (lexeme.type == LexemeType::Number || lexeme.type == LexemeType::Constant || lexeme.type == LexemeType::UserConstant) {
+            (this->*add)({ Opcode::Number, 0, lexeme.value }, depth);
+        }
+        else if (lexeme.type == LexemeType::Variable) {
+            (this->*add)({ Opcode::Variable, lexeme.index, 0 }, depth);
+        }
+        else if (lexeme.type == LexemeType::UserFunction) {
+            const UserFunction *function = userFunctions.at(GetLexemeText(index)).get();
+            (this->*add)({ Opcode::Call, function->arity, 0, function }, depth);
+        }
+        else if (lexeme.type == LexemeType::Function && lexeme.arity == 0) {
+            int count = int(program.back().value); // количество аргументов записано перед функцией
+            program.pop_back();
+            depth--;
+            (this->*add)({ GetOpcode(GetLexemeText(index)), count, 0 }, depth);
+        }
+        else {
+            (this->*add)({ GetOpcode(GetLexemeText(index)), 0, 0 }, depth);
+        }
+    }
+
+    // проверяем, что программа оставляет на стеке ровно одно значение
+    if (depth != 1)
+        throw string("Incorrect expression");
+}
+
+// компиляция польской записи в программу: с optimize - со свёрткой констант и суперинструкциями,
+// иначе - прямой перевод с переходами для условий. Каноническая форма и регистровая программа строятся позже (Analyze)
+void ExpressionParser::Compile(bool optimize) {
+    tier.analyzed = false;
+    Translate(optimize);
+
+    if (optimize) {
+        Fuse();
+
+        if (tolerance > 0)
+            Approximate();
+    }
+
+    // суперинструкции держат на стеке больше аргументов, поэтому размер стека определяем после слияния
+    int maxDepth = 0;
+    int depth = 0;
+
+    for (size_t i = 0; i < program.size(); i++) {
+        depth += 1 - GetArgumentsCount(program[i]);
+        maxDepth = max(maxDepth, depth);
+    }
+
+    InsertJumps();
+
+    memory.assign(maxDepth, 0);
+}
+
+// замена sin, cos, exp и ln приближёнными ядрами. Погрешность ядра переходит в результат с множителем - произведением
+// GetConditionNumber на пути к корню выражения, множители сумм зависят от областей значений слагаемых (GetRange).
+// Бюджет tolerance делится поровну между функциями с конечным множителем, для каждой выбирается быстрое ядро,
+// если оно укладывается в свою долю, иначе точное, иначе функция остаётся точной
+void ExpressionParser::Approximate() {
+    vector<size_t> parents(program.size(), program.size()); // инструкция, аргументом которой является результат
+    vector<double> factors(program.size(), 1); // множитель погрешности результата инструкции в родительской инструкции
+    vector<double> low(program.size()), high(program.size()); // области значений результатов инструкций
+    vector<double> argumentLow, argumentHigh; // области значений аргументов текущей инструкции
+    vector<size_t> operands; // вершины операндов на стеке
+
+    for (size_t i = 0; i < program.size(); i++) {
+        int count = GetArgumentsCount(program[i]);
+        argumentLow.resize(count);
+        argumentHigh.resize(count);
+
+        for (int j = 0; j < count; j++) {
+            size_t operand = operands[operands.size() - count + j];
+            argumentLow[j] = low[operand];
+            argumentHigh[j] = high[operand];
+        }
+
+        for (int j = 0; j < count; j++) {
+            size_t operand = operands[operands.size() - count + j];
+            parents[operand] = i;
+            factors[operand] = GetConditionNumber(program[i], j, argumentLow.data(), argumentHigh.data());
+        }
+
+        GetRange(program[i], argumentLow.data(), argumentHigh.data(), low[i], high[i]);
+        operands.resize(operands.size() - count);
+        operands.push_back(i);
+    }
+
+    // родитель в польской записи всегда правее аргумента, поэтому множители считаются справа налево
+    vector<double> amplification(program.size(), 1);
+    vector<size_t> candidates;
+
+    for (size_t i = program.size() - 1; i-- > 0;)
+        amplification[i] = amplification[parents[i]] * factors[i];
+
+    for (size_t i = 0; i < program.size(); i++)
+        if (GetApproximateOpcode(program[i].opcode) != Opcode::Number && isfinite(amplification[i]))
+            candidates.push_back(i);
+
+    approximationError = 0;
+
+    for (size_t i : candidates) {
+        Opcode opcode = GetApproximateOpcode(program[i].opcode);
+
+        for (int precise = 0; precise <= 1; precise++) {
+            double error = amplification[i] * GetKernelError(opcode, precise);
+
+            if (error <= tolerance / candidates.size()) {
+                program[i] = { opcode, precise, 0 };
+                approximationError += error;
+                break;
+            }
+        }
+    }
+}
+
+// запуск фоновой оптимизации: оптимизируется копия выражения, текущая программа продолжает выполняться
+void ExpressionParser::StartOptimization() {
+    tier.result.reset(new ExpressionParser(*this));
+    ExpressionParser *result = tier.result.get();
+    atomic<bool> *ready = &tier.ready;
+
+    tier.worker = async(launch::async, [result, ready]() {
+        result->Compile(true);
+        ready->store(true, memory_order_release);
+    });
+}
+
+// подмена программы результатом фоновой оптимизации, значения переменных остаются текущими
+void ExpressionParser::InstallOptimized() {
+    tier.worker.get();
+    ExpressionParser& result = *tier.result;
+
+    program.swap(result.program);
+    memory.swap(result.memory);
+    approximationError = result.approximationError;
+
+#ifdef EXPRESSION_PARSER_PROFILING
+    profile.assign(program.size(), OperationStatistics());
+#endif
+
+    tier.result.reset();
+    tier.ready = false;
+    tier.optimized = true;
+}
+
+// проверка, что программа оптимизирована: регистровая программа и каноническая форма строятся только при оптимизации
+void ExpressionParser::CheckOptimized() const {
+    if (!tier.optimized)
+        throw string("Expression is not optimized yet, call Optimize()");
+}
+
+// построение канонической формы и регистровой программы при первом обращении: большинству выражений они не нужны,
+// а стоят дороже разбора короткого выражения. Каноническая форма строится по программе до слияния, которая заново
+// получается из польской записи во временной копии, регистровая программа - по итоговой программе без переходов
+void ExpressionParser::Analyze() const {
+    CheckOptimized();
+
+    if (tier.analyzed.load(memory_order_acquire))
+        return;
+
+    lock_guard<mutex> lock(tier.analysis);
+
+    if (tier.analyzed.load(memory_order_relaxed))
+        return;
+
+    vector<Instruction> code;
+    code.reserve(program.size());
+
+    for (const Instruction& instruction : program)
+        if (!IsJump(instruction.opcode))
+            code.push_back(instruction);
+
+    ExpressionParser folded(*this);
+    folded.Translate(true);
+    Canonicalize(folded.program);
+    CompileRegisters(code);
+    tier.analyzed.store(true, memory_order_release);
+}
+
+// оптимизация программы без ожидания порога вычислений, при уже запущенной фоновой оптимизации - ожидание её результата
+void ExpressionParser::Optimize() {
+    if (tier.optimized)
+        return;
+
+    if (!tier.worker.valid())
+        StartOptimization();
+
+    tier.worker.wait();
+    InstallOptimized();
+}
+
+// оптимизирована ли программа
+bool ExpressionParser::IsOptimized() const {
+    return tier.optimized;
+}
+
+// конструктор из выражения: при tierThreshold > 0 программа сначала компилируется без оптимизаций
+// и оптимизируется в фоновом потоке после tierThreshold вычислений, при tolerance > 0 оптимизированная программа
+// использует приближённые ядра с относительной погрешностью результата не более tolerance
+ExpressionParser::ExpressionParser(const string& expression, const FunctionRegistry& registry, size_t tierThreshold, double tolerance) {
+#ifdef EXPRESSION_PARSER_PROFILING
+    auto start = chrono::steady_clock::now();
+#endif
+
+    vector<int> indices; // хеш-таблица номеров лексем в пуле, нужна только для разбора
+    SplitToLexemes(expression, indices); // разбиваем на лексемы
+    ImportUserDefinitions(registry); // подключаем пользовательские функции и константы
+    ConvertToRPN(indices); // получаем польскую запись
+    vector<int>().swap(lexemes); // лексемы нужны только для разбора
+    lexemePool.shrink_to_fit();
+    lexemeText.shrink_to_fit();
+    rpn.shrink_to_fit();
+
+    if (!(tolerance >= 0))
+        throw string("Incorrect tolerance");
+
+    this->tierThreshold = tierThreshold;
+    this->tolerance = tolerance;
+    this->approximationError = 0;
+    tier.optimized = tierThreshold == 0;
+    Compile(tier.optimized); // компилируем польскую запись в программу
+
+#ifdef EXPRESSION_PARSER_PROFILING
+    statistics.parseTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    profile.assign(program.size(), OperationStatistics());
+#endif
+}
+
+// обновление значения переменной
+void ExpressionParser::SetValue(string name, double value) {
+    auto it = variables.find(name);
+
+    if (it != variables.end())
+        values[it->second] = value;
+}
+
+// вычисление выражения
+double ExpressionParser::Evaluate() {
+#ifdef EXPRESSION_PARSER_PROFILING
+    auto start = chrono::steady_clock::now();
+    unsigned long long startCycles = ReadCycles();
+#endif
+
+    if (!tier.optimized) {
+        if (tier.ready.load(memory_order_acquire))
+            InstallOptimized();
+        else if (++tier.evaluations == tierThreshold)
+            StartOptimization();
+    }
+
+    double *top = memory.data(); // первая свободная ячейка стека
+    bool tabulated = table.size > 0 && values[table.variable] >= table.low && values[table.variable] <= table.high;
+
+    // внутри области таблицы программа не выполняется
+    if (tabulated)
+        memory[0] = LookupTable(table, values[table.variable]);
+
+    for (size_t i = 0; i < program.size() && !tabulated; i++) {
+        const Instruction& instruction = program[i];
+#ifdef EXPRESSION_PARSER_PROFILING
+        unsigned long long instructionCycles = ReadCycles();
+#endif
+
+#ifdef EXPRESSION_PARSER_PROFILING
+        size_t index = i;
+#endif
+
+        switch (instruction.opcode) {
+            case Opcode::Number:
+                *top++ = instruction.value;
+                break;
+
+            case Opcode::Variable:
+                *top++ = values[instruction.index];
+                break;
+
+            case Opcode::Branch: // условие остаётся на стеке до инструкции if
+                if (top[-1] == 0)
+                    i += instruction.index;
+                break;
+
+            case Opcode::Jump:
+                i += instruction.index;
+                break;
+
+            case Opcode::JumpIfFalse:
+                if (top[-1] == 0) {
+                    top[-1] = 0;
+                    i += instruction.index;
+                }
+                break;
+
+            case Opcode::JumpIfTrue:
+                if (top[-1] != 0) {
+                    top[-1] = 1;
+                    i += instruction.index;
+                }
+                break;
+
+            case Opcode::If: // на стеке условие и значение выбранной ветви
+                top[-2] = top[-1];
+                top--;
+                break;
+
+            default:
+                top -= GetArgumentsCount(instruction);
+                *top = ApplyInstruction(instruction, top);
+                top++;
+        }
+
+#ifdef EXPRESSION_PARSER_PROFILING
+        profile[index].count++;
+        profile[index].cycles += ReadCycles() - instructionCycles;
+#endif
+    }
+
+#ifdef EXPRESSION_PARSER_PROFILING
+    statistics.evaluations++;
+    statistics.evaluationCycles += ReadCycles() - startCycles;
+    statistics.evaluationTime += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+#endif
+
+    return memory[0];
+}
+
+// эталонное вычисление выражения по польской записи
+double ExpressionParser::EvaluateRPN() {
+    stack<double> stack;
+
+    for (int index : rpn) {
+        string lexeme = GetLexemeText(index); // эталон разбирает текст лексем, не используя их вид
+
+        if (IsOperator(lexeme)) {
+            if (stack.size() < 2)
+                throw string("Unable to evaluate operator '") + lexeme + "'";
+
+            double arg2 = stack.top();
+            stack.pop();
+            double arg1 = stack.top();
+            stack.pop();
+
+            stack.push(EvaluateOperator(lexeme, arg1, arg2));
+        }
+        else if (IsFunction(lexeme)) {
+            if (stack.size() < 1)
+                throw string("Unable to evaluate function '") + lexeme + "'";
+
+            double arg = stack.top();
+            stack.pop();
+            stack.push(EvaluateFunction(lexeme, arg));
+        }
+        else if (IsBinaryFunction(lexeme)) {
+            if (stack.size() < 2)
+                throw string("Unable to evaluate function '") + lexeme + "'";
+
+            double arg2 = stack.top();
+            stack.pop();
+            double arg1 = stack.top();
+            stack.pop();
+
+            stack.push(EvaluateBinaryFunction(lexeme, arg1, arg2));
+        }
+        else if (lexeme == "~" || lexeme == "!") {
+            if (stack.size() < 1)
+                throw string("Unable to evaluate unary operator '") + lexeme + "'";
+
+            double arg = stack.top();
+            stack.pop();
+            stack.push(lexeme == "~" ? -arg : arg == 0);
+        }
+        else if (IsTernaryFunction(lexeme)) {
+            if (stack.size() < 3)
+                throw string("Unable to evaluate function '") + lexeme + "'";
+
+            double arg3 = stack.top();
+            stack.pop();
+            double arg2 = stack.top();
+            stack.pop();
+            double arg1 = stack.top();
+            stack.pop();
+
+            stack.push(arg1 != 0 ? arg2 : arg3);
+        }
+        else if (IsVariadicFunction(lexeme)) {
+            int count = int(stack.top()); // количество аргументов записано перед функцией
+            stack.pop();
+
+            if (stack.size() < size_t(count))
+                throw string("Unable to evaluate function '") + lexeme + "'";
+
+            vector<double> args(count);
+
+            for (int i = count - 1; i >= 0; i--) {
+                args[i] = stack.top();
+                stack.pop();
+            }
+
+            stack.push(EvaluateVariadicFunction(lexeme, args));
+        }
+        else if (IsUserFunction(lexeme)) {
+            const UserFunction& function = *userFunctions.at(lexeme);
+
+            if (stack.size() < size_t(function.arity))
+                throw string("Unable to evaluate function '") + lexeme + "'";
+
+            vector<double> args(function.arity);
+
+            for (int i = function.arity - 1; i >= 0; i--) {
+                args[i] = stack.top();
+                stack.pop();
+            }
+
+            stack.push(function.function(function.context.get(), args.data()));
+        }
+        else if (IsConstant(lexeme)) {
+            stack.push(EvaluateConstant(lexeme));
+        }
+        else if (IsUserConstant(lexeme)) {
+            stack.push(userConstants.at(lexeme));
+        }
+        else if (IsVariable(lexeme)) {
+            stack.push(values[variables.at(lexeme)]);
+        }
+        else if (IsNumber(lexeme)) {
+            stack.push(stod(lexeme));
+        }
+        else
+            throw string("Unknown rpn lexeme '") + lexeme + "'";
+    }
+
+    if (stack.size() != 1)
+        throw string("Incorrect expression");
+
+    return stack.top();
+}
+
+// вычисление выражения и его производной по переменной прямым автоматическим дифференцированием:
+// вместе с каждым значением на стеке хранится его производная. Условия вычисляются без переходов
+double ExpressionParser::EvaluateDerivative(const string& variable, double& derivative) const {
+    auto it = variables.find(variable);
+    int index = it == variables.end() ? -1 : it->second; // переменная вне выражения даёт нулевую производную
+    vector<double> stack(memory.size());
+    vector<double> derivatives(memory.size());
+    size_t top = 0;
+
+    for (const Instruction& instruction : program) {
+        if (instruction.opcode == Opcode::Number) {
+            stack[top] = instruction.value;
+            derivatives[top++] = 0;
+        }
+        else if (instruction.opcode == Opcode::Variable) {
+            stack[top] = values[instruction.index];
+            derivatives[top++] = instruction.index == index;
+        }
+        else if (!IsJump(instruction.opcode)) {
+            top -= GetArgumentsCount(instruction);
+            double value = ApplyInstruction(instruction, stack.data() + top);
+            derivatives[top] = ApplyDerivative(instruction, stack.data() + top, derivatives.data() + top, value);
+            stack[top++] = value;
+        }
+    }
+
+    derivative = derivatives[0];
+    return stack[0];
+}
+
+// вычисление выражения с границей абсолютной погрешности округления (анализ погрешности по ходу вычисления):
+// вместе с каждым значением на стеке хранится граница его погрешности (ApplyErrorBound). Числа и переменные
+// считаются точными. Бесконечная граница означает, что результат плохо обусловлен и округление может изменить его
+// сколь угодно сильно. Условия вычисляются без переходов
+double ExpressionParser::EvaluateErrorBound(double& error) const {
+    vector<double> stack(memory.size());
+    vector<double> errors(memory.size());
+    size_t top = 0;
+
+    for (const Instruction& instruction : program) {
+        if (instruction.opcode == Opcode::Number || instruction.opcode == Opcode::Variable) {
+            stack[top] = instruction.opcode == Opcode::Number ? instruction.value : values[instruction.index];
+            errors[top++] = 0;
+        }
+        else if (!IsJump(instruction.opcode)) {
+            top -= GetArgumentsCount(instruction);
+            double value = ApplyInstruction(instruction, stack.data() + top);
+            errors[top] = ApplyErrorBound(instruction, stack.data() + top, errors.data() + top, value);
+            stack[top++] = value;
+        }
+    }
+
+    error = errors[0];
+    return stack[0];
+}
+
+// вычисление выражения по регистровой программе
+double ExpressionParser::EvaluateRegisters() {
+    Analyze();
+    double *r = registers.data();
+    copy(values.begin(), values.end(), r);
+
+    for (const RegisterInstruction& instruction : registerProgram) {
+        const int *args = registerArguments.data() + instruction.arguments;
+
+        switch (instruction.instruction.opcode) {
+            case Opcode::Neg:
+                r[instruction.target] = -r[args[0]];
+                break;
+
+            case Opcode::Add:
+                r[instruction.target] = r[args[0]] + r[args[1]];
+                break;
+
+            case Opcode::Sub:
+                r[instruction.target] = r[args[0]] - r[args[1]];
+                break;
+
+            case Opcode::Mul:
+                r[instruction.target] = r[args[0]] * r[args[1]];
+                break;
+
+            case Opcode::Div:
+                r[instruction.target] = r[args[0]] / r[args[1]];
+                break;
+
+            case Opcode::Square:
+                r[instruction.target] = r[args[0]] * r[args[0]];
+                break;
+
+            case Opcode::MulAdd:
+                r[instruction.target] = MulAdd(r[args[0]], r[args[1]], r[args[2]]);
+                break;
+
+            case Opcode::AddMul:
+                r[instruction.target] = MulAdd(r[args[1]], r[args[2]], r[args[0]]);
+                break;
+
+            default:
+                for (int j = 0; j < GetArgumentsCount(instruction.instruction); j++)
+                    registerRow[j] = r[args[j]];
+
+                r[instruction.target] = ApplyInstruction(instruction.instruction, registerRow.data());
+        }
+    }
+
+    return r[registerResult];
+}
+
+// построчное применение инструкции к блокам аргументов
+void ExpressionParser::ApplyInstructionRows(const Instruction& instruction, double *args, size_t size) {
+    int count = GetArgumentsCount(instruction);
+    vector<double> row(count); // аргументы одной строки
+
+    for (size_t i = 0; i < size; i++) {
+        for (int j = 0; j < count; j++)
+            row[j] = args[j * BLOCK_SIZE + i];
+
+        args[i] = ApplyInstruction(instruction, row.data());
+    }
+}
+
+// вычисление программы на блоке строк
+void ExpressionParser::EvaluateBlock(const vector<const double *>& inputs, const vector<double>& scalars, size_t offset, size_t size, double *memory, double *result) const {
+    // блок, все строки которого в области таблицы, вычисляется по таблице, иначе весь блок - по программе
+    if (table.size > 0 && inputs[table.variable] && LookupTableRows(table, inputs[table.variable] + offset, result, size))
+        return;
+
+    double *top = memory; // первый свободный блок стека
+
+    for (const Instruction& instruction : program) {
+        if (IsJump(instruction.opcode))
+            continue;
+
+        int count = GetArgumentsCount(instruction);
+        double *a = top - count * BLOCK_SIZE; // первый аргумент, на его место записывается результат
+        double *b = a + BLOCK_SIZE; // второй аргумент
+
+        switch (instruction.opcode) {
+            case Opcode::Number:
+                fill(a, a + size, instruction.value);
+                break;
+
+            case Opcode::Variable:
+                if (inputs[instruction.index])
+                    copy(inputs[instruction.index] + offset, inputs[instruction.index] + offset + size, a);
+                else
+                    fill(a, a + size, scalars[instruction.index]);
+                break;
+
+            case Opcode::Neg:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = -a[i];
+                break;
+
+            case Opcode::Add:
+                for (size_t i = 0; i < size; i++)
+                    a[i] += b[i];
+                break;
+
+            case Opcode::Sub:
+                for (size_t i = 0; i < size; i++)
+                    a[i] -= b[i];
+                break;
+
+            case Opcode::Mul:
+                for (size_t i = 0; i < size; i++)
+                    a[i] *= b[i];
+                break;
+
+            case Opcode::Div:
+                for (size_t i = 0; i < size; i++)
+                    a[i] /= b[i];
+                break;
+
+            case Opcode::Square:
+                for (size_t i = 0; i < size; i++)
+                    a[i] *= a[i];
+                break;
+
+            case Opcode::Cube:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = a[i] * a[i] * a[i];
+                break;
+
+            case Opcode::MulAdd:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = MulAdd(a[i], b[i], b[BLOCK_SIZE + i]);
+                break;
+
+            case Opcode::AddMul:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = MulAdd(b[i], b[BLOCK_SIZE + i], a[i]);
+                break;
+
+            case Opcode::MulSub:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = MulAdd(a[i], b[i], -b[BLOCK_SIZE + i]);
+                break;
+
+            case Opcode::SubMul:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = MulAdd(-b[i], b[BLOCK_SIZE + i], a[i]);
+                break;
+
+            case Opcode::SumSquares:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = MulAdd(a[i], a[i], b[i] * b[i]);
+                break;
+
+            case Opcode::NegAdd:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = b[i] - a[i];
+                break;
+
+            case Opcode::Reciprocal:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = 1.0 / a[i];
+                break;
+
+            case Opcode::Sqrt:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = sqrt(a[i]);
+                break;
+
+            case Opcode::Abs:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = fabs(a[i]);
+                break;
+
+            case Opcode::Max:
+                for (int j = 1; j < count; j++, b += BLOCK_SIZE)
+                    for (size_t i = 0; i < size; i++)
+                        a[i] = a[i] < b[i] ? b[i] : a[i];
+                break;
+
+            case Opcode::Min:
+                for (int j = 1; j < count; j++, b += BLOCK_SIZE)
+                    for (size_t i = 0; i < size; i++)
+                        a[i] = b[i] < a[i] ? b[i] : a[i];
+                break;
+
+            case Opcode::Sum:
+            case Opcode::Avg:
+                for (int j = 1; j < count; j++, b += BLOCK_SIZE)
+                    for (size_t i = 0; i < size; i++)
+                        a[i] += b[i];
+
+                if (instruction.opcode == Opcode::Avg)
+                    for (size_t i = 0; i < size; i++)
+                        a[i] /= count;
+                break;
+
+            case Opcode::Less:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = a[i] < b[i];
+                break;
+
+            case Opcode::LessEqual:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = a[i] <= b[i];
+                break;
+
+            case Opcode::Greater:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = a[i] > b[i];
+                break;
+
+            case Opcode::GreaterEqual:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = a[i] >= b[i];
+                break;
+
+            case Opcode::Equal:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = a[i] == b[i];
+                break;
+
+            case Opcode::NotEqual:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = a[i] != b[i];
+                break;
+
+            case Opcode::And:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = (a[i] != 0) & (b[i] != 0);
+                break;
+
+            case Opcode::Or:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = (a[i] != 0) | (b[i] != 0);
+                break;
+
+            case Opcode::Not:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = a[i] == 0;
+                break;
+
+            case Opcode::If:
+                for (size_t i = 0; i < size; i++)
+                    a[i] = a[i] != 0 ? b[i] : b[BLOCK_SIZE + i];
+                break;
+
+            case Opcode::Hypot: {
+                double *scale = top; // свободный блок над аргументами
+                double *sum = top + BLOCK_SIZE;
+                fill(scale, scale + size, 0.0);
+                fill(sum, sum + size, 0.0);
+
+                for (int j = 0; j < count; j++)
+                    for (size_t i = 0; i < size; i++)
+                        scale[i] = scale[i] < fabs(a[j * BLOCK_SIZE + i]) ? fabs(a[j * BLOCK_SIZE + i]) : scale[i];
+
+                for (int j = 0; j < count; j++)
+                    for (size_t i = 0; i < size; i++)
+                        sum[i] += (a[j * BLOCK_SIZE + i] / scale[i]) * (a[j * BLOCK_SIZE + i] / scale[i]);
+
+                for (size_t i = 0; i < size; i++)
+                    a[i] = scale[i] == 0 || isinf(scale[i]) ? scale[i] : scale[i] * sqrt(sum[i]);
+                break;
+            }
+
+            case Opcode::Call:
+                if (instruction.function->batch) {
+                    vector<const double *> args(count);
+
+                    for (int j = 0; j < count; j++)
+                        args[j] = a + j * BLOCK_SIZE;
+
+                    instruction.function->batch(instruction.function->context.get(), args.data(), a, size);
+                }
+                else {
+                    ApplyInstructionRows(instruction, a, size);
+                }
+                break;
+
+            case Opcode::SinApprox:
+            case Opcode::CosApprox:
+            case Opcode::ExpApprox:
+            case Opcode::LnApprox:
+                ApplyApproximationRows(instruction, a, a, size);
+                break;
+
+            default:
+                ApplyInstructionRows(instruction, a, size);
+        }
+
+        top = a + BLOCK_SIZE;
+    }
+
+    copy(memory, memory + size, result);
+}
+
+// получение столбцов значений по индексам переменных (nullptr - переменная без столбца)
+vector<const double *> ExpressionParser::GetInputs(const map<string, const double *>& columns) const {
+    vector<const double *> inputs(values.size(), nullptr);
+
+    for (auto it = columns.begin(); it != columns.end(); it++) {
+        auto variable = variables.find(it->first);
+
+        if (variable != variables.end())
+            inputs[variable->second] = it->second;
+    }
+
+    return inputs;
+}
+
+// пакетное вычисление выражения по столбцам значений переменных
+// переменные без столбца берут значения, установленные через SetValue
+void ExpressionParser::EvaluateBatch(const map<string, const double *>& columns, double *result, size_t count) const {
+    vector<const double *> inputs = GetInputs(columns);
+
+    vector<double> blocks((memory.size() + 2) * BLOCK_SIZE); // два дополнительных блока для промежуточных значений инструкций
+
+    for (size_t offset = 0; offset < count; offset += BLOCK_SIZE)
+        EvaluateBlock(inputs, values, offset, min(BLOCK_SIZE, count - offset), blocks.data(), result + offset);
+}
+
+// вычисление регистровой программы на блоке строк, sources - начала блоков регистров
+// (блоки переменных со столбцами указывают прямо на входные данные, блоки остальных регистров лежат в blocks)
+void ExpressionParser::EvaluateRegisterBlock(const vector<const double *>& sources, double *blocks, size_t size) const {
+    double *scratch = blocks + registers.size() * BLOCK_SIZE; // блок для результата пакетных функций
+    vector<const double *> args(registerRow.size());
+    vector<double> row(registerRow.size());
+
+    for (const RegisterInstruction& instruction : registerProgram) {
+        int count = GetArgumentsCount(instruction.instruction);
+        double *t = blocks + instruction.target * BLOCK_SIZE;
+
+        for (int j = 0; j < count; j++)
+            args[j] = sources[registerArguments[instruction.arguments + j]];
+
+        const double *a = args[0];
+        const double *b = count > 1 ? args[1] : nullptr;
+        const double *c = count > 2 ? args[2] : nullptr;
+        const UserFunction *function = instruction.instruction.function;
+
+        // результат пакетной функции пишется в отдельный блок, так как функция может читать аргументы после записи
+        if (function && function->batch) {
+            function->batch(function->context.get(), args.data(), scratch, size);
+            copy(scratch, scratch + size, t);
+            continue;
+        }
+
+        switch (instruction.instruction.opcode) {
+            case Opcode::Neg:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = -a[i];
+                break;
+
+            case Opcode::Add:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = a[i] + b[i];
+                break;
+
+            case Opcode::Sub:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = a[i] - b[i];
+                break;
+
+            case Opcode::Mul:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = a[i] * b[i];
+                break;
+
+            case Opcode::Div:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = a[i] / b[i];
+                break;
+
+            case Opcode::Square:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = a[i] * a[i];
+                break;
+
+            case Opcode::MulAdd:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = MulAdd(a[i], b[i], c[i]);
+                break;
+
+            case Opcode::AddMul:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = MulAdd(b[i], c[i], a[i]);
+                break;
+
+            case Opcode::MulSub:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = MulAdd(a[i], b[i], -c[i]);
+                break;
+
+            case Opcode::SubMul:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = MulAdd(-b[i], c[i], a[i]);
+                break;
+
+            case Opcode::SumSquares:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = MulAdd(a[i], a[i], b[i] * b[i]);
+                break;
+
+            case Opcode::Sqrt:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = sqrt(a[i]);
+                break;
+
+            case Opcode::Abs:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = fabs(a[i]);
+                break;
+
+            case Opcode::If:
+                for (size_t i = 0; i < size; i++)
+                    t[i] = a[i] != 0 ? b[i] : c[i];
+                break;
+
+            case Opcode::SinApprox:
+            case Opcode::CosApprox:
+            case Opcode::ExpApprox:
+            case Opcode::LnApprox:
+                ApplyApproximationRows(instruction.instruction, a, t, size);
+                break;
+
+            default: // строка аргументов читается до записи результата, поэтому t может совпадать с аргументом
+                for (size_t i = 0; i < size; i++) {
+                    for (int j = 0; j < count; j++)
+                        row[j] = args[j][i];
+
+                    t[i] = ApplyInstruction(instruction.instruction, row.data());
+                }
+        }
+    }
+}
+
+// пакетное вычисление выражения по регистровой программе, каждый регистр - блок из BLOCK_SIZE строк
+// переменные без столбца берут значения, установленные через SetValue
+void ExpressionParser::EvaluateRegistersBatch(const map<string, const double *>& columns, double *result, size_t count) const {
+    Analyze();
+    EvaluateRegisterRange(GetInputs(columns), values, result, 0, count);
+}
+
+// вычисление регистровой программы на строках [begin, end), scalars - значения переменных без столбца
+void ExpressionParser::EvaluateRegisterRange(const vector<const double *>& inputs, const vector<double>& scalars, double *result, size_t begin, size_t end) const {
+    vector<double> blocks((registers.size() + 1) * BLOCK_SIZE);
+    vector<const double *> sources(registers.size());
+
+    // блоки констант и переменных без столбца заполняются один раз
+    for (size_t r = 0; r < registers.size(); r++) {
+        sources[r] = blocks.data() + r * BLOCK_SIZE;
+
+        if (r < values.size() && !inputs[r])
+            fill(blocks.data() + r * BLOCK_SIZE, blocks.data() + (r + 1) * BLOCK_SIZE, scalars[r]);
+        else if (r >= values.size())
+            fill(blocks.data() + r * BLOCK_SIZE, blocks.data() + (r + 1) * BLOCK_SIZE, registers[r]);
+    }
+
+    for (size_t offset = begin; offset < end; offset += BLOCK_SIZE) {
+        size_t size = min(BLOCK_SIZE, end - offset);
+
+        for (size_t v = 0; v < values.size(); v++)
+            if (inputs[v])
+                sources[v] = inputs[v] + offset;
+
+        EvaluateRegisterBlock(sources, blocks.data(), size);
+        copy(sources[registerResult], sources[registerResult] + size, result + offset);
+    }
+}
+
+// получение индексов переменных осей (-1 - переменная не входит в выражение)
+vector<int> ExpressionParser::GetSweepIndices(const vector<SweepAxis>& axes) const {
+    vector<int> indices(axes.size(), -1);
+
+    for (size_t a = 0; a < axes.size(); a++) {
+        for (size_t b = 0; b < a; b++)
+            if (axes[a].name == axes[b].name)
+                throw string("Duplicate sweep variable '") + axes[a].name + "'";
+
+        auto variable = variables.find(axes[a].name);
+
+        if (variable != variables.end())
+            indices[a] = variable->second;
+    }
+
+    return indices;
+}
+
+// получение количества точек сетки
+size_t ExpressionParser::GetSweepSize(const vector<SweepAxis>& axes) {
+    size_t size = 1;
+
+    for (const SweepAxis& axis : axes)
+        size *= axis.count;
+
+    return size;
+}
+
+// заполнение блоков значений осей для строк сетки [offset, offset + size), последняя ось меняется быстрее всего
+void ExpressionParser::GenerateSweepBlock(const vector<SweepAxis>& axes, size_t offset, size_t size, double *blocks) {
+    size_t stride = 1; // количество строк с одинаковым значением оси
+
+    for (size_t a = axes.size(); a-- > 0;) {
+        double *block = blocks + a * BLOCK_SIZE;
+        size_t index = offset / stride % axes[a].count; // индекс значения оси в первой строке
+        size_t remaining = stride - offset % stride; // количество строк до смены значения
+        double value = axes[a].GetValue(index);
+
+        for (size_t i = 0; i < size; i++) {
+            block[i] = value;
+
+            if (--remaining == 0) {
+                index = index + 1 == axes[a].count ? 0 : index + 1;
+                value = axes[a].GetValue(index);
+                remaining = stride;
+            }
+        }
+
+        stride *= axes[a].count;
+    }
+}
+
+// вычисление выражения на сетке значений осей (декартово произведение) в тензор result размера GetSweepSize(axes),
+// последняя ось меняется быстрее всего. Значения осей генерируются поблочно, переменные вне осей берутся из SetValue
+void ExpressionParser::Sweep(const vector<SweepAxis>& axes, double *result, size_t threads) const {
+    vector<int> indices = GetSweepIndices(axes);
+    size_t count = GetSweepSize(axes);
+    size_t blocksCount = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    threads = max(size_t(1), min(threads, blocksCount));
+
+    // каждый поток вычисляет непрерывный диапазон блоков в собственной памяти
+    auto worker = [&](size_t begin, size_t end) {
+        vector<double> blocks((memory.size() + 2) * BLOCK_SIZE);
+        vector<double> generated(axes.size() * BLOCK_SIZE);
+        vector<const double *> inputs(values.size(), nullptr);
+
+        for (size_t a = 0; a < axes.size(); a++)
+            if (indices[a] >= 0)
+                inputs[indices[a]] = generated.data() + a * BLOCK_SIZE;
+
+        for (size_t offset = begin; offset < end; offset += BLOCK_SIZE) {
+            size_t size = min(BLOCK_SIZE, end - offset);
+            GenerateSweepBlock(axes, offset, size, generated.data());
+            EvaluateBlock(inputs, values, 0, size, blocks.data(), result + offset);
+        }
+    };
+
+    vector<thread> workers;
+
+    for (size_t t = 1; t < threads; t++)
+        workers.push_back(thread(worker, min(count, blocksCount * t / threads * BLOCK_SIZE), min(count, blocksCount * (t + 1) / threads * BLOCK_SIZE)));
+
+    worker(0, min(count, blocksCount / threads * BLOCK_SIZE));
+
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+// получение количества элементов результата поэлементного вычисления: массивы одинаковой длины,
+// скаляры и массивы из одного значения растягиваются на все элементы
+size_t ExpressionParser::GetBroadcastSize(const map<string, ValueSpan>& spans) {
+    size_t size = 1;
+
+    for (auto it = spans.begin(); it != spans.end(); it++) {
+        if (it->second.size == 1)
+            continue;
+
+        if (size != 1 && it->second.size != size)
+            throw string("Incompatible span size for '") + it->first + "': " + to_string(it->second.size) + " instead of " + to_string(size);
+
+        size = it->second.size;
+    }
+
+    return size;
+}
+
+// поэлементное вычисление выражения по массивам значений переменных в result размера GetBroadcastSize(spans).
+// Скаляры подставляются в программу как значения переменных, массивы читаются блоками без копирования
+// (в оптимизированной программе без таблицы значений - через регистры), переменные без массива берутся из SetValue
+void ExpressionParser::EvaluateSpans(const map<string, ValueSpan>& spans, double *result, size_t threads) const {
+    size_t count = GetBroadcastSize(spans);
+    vector<const double *> inputs(values.size(), nullptr);
+    vector<double> scalars(values);
+
+    for (auto it = spans.begin(); it != spans.end(); it++) {
+        auto variable = variables.find(it->first);
+
+        if (variable == variables.end())
+            continue;
+
+        if (it->second.size == 1)
+            scalars[variable->second] = it->second.scalar;
+        else
+            inputs[variable->second] = it->second.data;
+    }
+
+    size_t blocksCount = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    threads = max(size_t(1), min(threads, blocksCount));
+
+    if (tier.optimized && table.size == 0)
+        Analyze(); // регистровая программа строится до запуска потоков
+
+    // каждый поток вычисляет непрерывный диапазон блоков в собственной памяти
+    auto worker = [&](size_t begin, size_t end) {
+        if (tier.optimized && table.size == 0) {
+            EvaluateRegisterRange(inputs, scalars, result, begin, end);
+            return;
+        }
+
+        vector<double> blocks((memory.size() + 2) * BLOCK_SIZE);
+
+        for (size_t offset = begin; offset < end; offset += BLOCK_SIZE)
+            EvaluateBlock(inputs, scalars, offset, min(BLOCK_SIZE, end - offset), blocks.data(), result + offset);
+    };
+
+    vector<thread> workers;
+
+    for (size_t t = 1; t < threads; t++)
+        workers.push_back(thread(worker, min(count, blocksCount * t / threads * BLOCK_SIZE), min(count, blocksCount * (t + 1) / threads * BLOCK_SIZE)));
+
+    worker(0, min(count, blocksCount / threads * BLOCK_SIZE));
+
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+// поэлементное вычисление выражения по массивам значений переменных с растягиванием скаляров
+vector<double> ExpressionParser::EvaluateSpans(const map<string, ValueSpan>& spans, size_t threads) const {
+    vector<double> result(GetBroadcastSize(spans));
+    EvaluateSpans(spans, result.data(), threads);
+    return result;
+}
+
+// попарное суммирование: погрешность растёт как log(count) вместо count
+double ExpressionParser::PairwiseSum(const double *values, size_t count) {
+    if (count <= 8) {
+        double sum = 0;
+
+        for (size_t i = 0; i < count; i++)
+            sum += values[i];
+
+        return sum;
+    }
+
+    return PairwiseSum(values, count / 2) + PairwiseSum(values + count / 2, count - count / 2);
+}
+
+// суммирование Кэхэна–Ноймайера: потерянные младшие разряды накапливаются в compensation
+double ExpressionParser::KahanSum(const double *values, size_t count, double& compensation) {
+    double sum = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        double next = sum + values[i];
+
+        if (fabs(sum) >= fabs(values[i]))
+            compensation += (sum - next) + values[i];
+        else
+            compensation += (values[i] - next) + sum;
+
+        sum = next;
+    }
+
+    return sum;
+}
+
+// свёртка выражения по блокам строк: строки берутся из столбцов columns или генерируются по осям axes.
+// Каждый поток обрабатывает непрерывный диапазон блоков и накапливает свои минимум, максимум и гистограмму,
+// а суммы сохраняются для каждого блока и складываются в порядке блоков, поэтому результат не зависит от числа потоков
+Reduction ExpressionParser::ReduceBlocks(const vector<const double *>& columns, const vector<SweepAxis>& axes, size_t count, const ReductionOptions& options) const {
+    if (options.bins > 0 && !(options.low < options.high))
+        throw string("Incorrect histogram range");
+
+    vector<int> indices = GetSweepIndices(axes);
+    size_t blocksCount = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    size_t threads = max(size_t(1), min(options.threads, blocksCount));
+    double scale = options.bins / (options.high - options.low); // количество интервалов на единицу значения
+
+    vector<double> sums(blocksCount); // суммы блоков
+    vector<double> compensations(blocksCount, 0); // поправки сумм блоков для суммирования Кэхэна
+    vector<Reduction> partials(threads); // частичные результаты потоков
+
+    auto worker = [&](size_t t) {
+        vector<double> blocks((memory.size() + 2) * BLOCK_SIZE);
+        vector<double> generated(axes.size() * BLOCK_SIZE);
+        vector<double> result(BLOCK_SIZE);
+        vector<const double *> inputs = columns;
+        Reduction& partial = partials[t];
+
+        partial.histogram.assign(options.bins, 0);
+
+        for (size_t a = 0; a < axes.size(); a++)
+            if (indices[a] >= 0)
+                inputs[indices[a]] = generated.data() + a * BLOCK_SIZE;
+
+        for (size_t block = blocksCount * t / threads; block < blocksCount * (t + 1) / threads; block++) {
+            size_t offset = block * BLOCK_SIZE;
+            size_t size = min(BLOCK_SIZE, count - offset);
+
+            if (!axes.empty())
+                GenerateSweepBlock(axes, offset, size, generated.data());
+
+            EvaluateBlock(inputs, values, axes.empty() ? offset : 0, size, blocks.data(), result.data());
+
+            // переносим числовые значения в начало блока
+            size_t n = 0;
+
+            for (size_t i = 0; i < size; i++)
+                if (!isnan(result[i]))
+                    result[n++] = result[i];
+
+            partial.nans += size - n;
+            partial.count += n;
+
+            for (size_t i = 0; i < n; i++) {
+                partial.min = result[i] < partial.min || isnan(partial.min) ? result[i] : partial.min;
+                partial.max = result[i] > partial.max || isnan(partial.max) ? result[i] : partial.max;
+            }
+
+            for (size_t i = 0; i < n && options.bins > 0; i++) {
+                if (result[i] >= options.low && result[i] <= options.high)
+                    partial.histogram[min(size_t((result[i] - options.low) * scale), options.bins - 1)]++;
+                else
+                    partial.outliers++;
+            }
+
+            if (options.summation == Summation::Pairwise) {
+                sums[block] = PairwiseSum(result.data(), n);
+            }
+            else if (options.summation == Summation::Kahan) {
+                sums[block] = KahanSum(result.data(), n, compensations[block]);
+            }
+            else {
+                sums[block] = 0;
+
+                for (size_t i = 0; i < n; i++)
+                    sums[block] += result[i];
+            }
+        }
+    };
+
+    vector<thread> workers;
+
+    for (size_t t = 1; t < threads; t++)
+        workers.push_back(thread(worker, t));
+
+    worker(0);
+
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    // объединяем частичные результаты в фиксированном порядке
+    Reduction reduction;
+    reduction.histogram.assign(options.bins, 0);
+
+    for (const Reduction& partial : partials) {
+        reduction.count += partial.count;
+        reduction.nans += partial.nans;
+        reduction.outliers += partial.outliers;
+        reduction.min = partial.min < reduction.min || isnan(reduction.min) ? partial.min : reduction.min;
+        reduction.max = partial.max > reduction.max || isnan(reduction.max) ? partial.max : reduction.max;
+
+        for (size_t i = 0; i < options.bins; i++)
+            reduction.histogram[i] += partial.histogram[i];
+    }
+
+    if (options.summation == Summation::Pairwise) {
+        reduction.sum = PairwiseSum(sums.data(), sums.size());
+    }
+    else if (options.summation == Summation::Kahan) {
+        double compensation = 0;
+        double sum = KahanSum(sums.data(), sums.size(), compensation);
+        double correction = KahanSum(compensations.data(), compensations.size(), compensation);
+        reduction.sum = sum + (correction + compensation);
+    }
+    else {
+        for (size_t i = 0; i < sums.size(); i++)
+            reduction.sum += sums[i];
+    }
+
+    if (reduction.count > 0)
+        reduction.mean = reduction.sum / reduction.count;
+
+    return reduction;
+}
+
+// свёртка выражения по столбцам значений переменных без сохранения значений строк
+// переменные без столбца берут значения, установленные через SetValue
+Reduction ExpressionParser::Reduce(const map<string, const double *>& columns, size_t count, const ReductionOptions& options) const {
+    return ReduceBlocks(GetInputs(columns), { }, count, options);
+}
+
+// свёртка выражения по сетке значений осей без сохранения значений точек
+Reduction ExpressionParser::Reduce(const vector<SweepAxis>& axes, const ReductionOptions& options) const {
+    return ReduceBlocks(vector<const double *>(values.size(), nullptr), axes, GetSweepSize(axes), options);
+}
+
+// получение названия инструкции с учётом пользовательских функций
+string ExpressionParser::GetInstructionName(const Instruction& instruction) const {
+    if (instruction.opcode == Opcode::Call)
+        for (auto it = userFunctions.begin(); it != userFunctions.end(); it++)
+            if (it->second.get() == instruction.function)
+                return it->first;
+
+    return GetOpcodeName(instruction.opcode);
+}
+
+// получение текстового представления программы
+string ExpressionParser::Disassemble() const {
+    vector<string> names(values.size());
+
+    for (auto it = variables.begin(); it != variables.end(); it++)
+        names[it->second] = it->first;
+
+    string result = "";
+
+    for (size_t i = 0; i < program.size(); i++) {
+        const Instruction& instruction = program[i];
+        string text;
+
+        if (instruction.opcode == Opcode::Number) {
+            ostringstream os;
+            os << setprecision(17) << instruction.value;
+            text = os.str();
+        }
+        else if (instruction.opcode == Opcode::Variable) {
+            text = names[instruction.index];
+        }
+        else if (instruction.opcode == Opcode::PowInt || IsJump(instruction.opcode) || GetExactOpcode(instruction.opcode) != Opcode::Number) {
+            text = GetOpcodeName(instruction.opcode) + "(" + to_string(instruction.index) + ")";
+        }
+        else {
+            text = GetInstructionName(instruction);
+        }
+
+        result += (i > 0 ? " " : "") + text;
+    }
+
+    return result;
+}
+
+// получение названия регистра: переменная, константа или временный регистр rN
+string ExpressionParser::GetRegisterName(int index, const vector<string>& names) const {
+    if (index < int(values.size()))
+        return names[index];
+
+    if (index < registerTemporaries) {
+        ostringstream os;
+        os << setprecision(17) << registers[index];
+        return os.str();
+    }
+
+    return "r" + to_string(index - registerTemporaries);
+}
+
+// получение текстового представления регистровой программы
+string ExpressionParser::DisassembleRegisters() const {
+    Analyze();
+    vector<string> names(values.size());
+
+    for (auto it = variables.begin(); it != variables.end(); it++)
+        names[it->second] = it->first;
+
+    string result = "";
+
+    for (const RegisterInstruction& instruction : registerProgram) {
+        int count = GetArgumentsCount(instruction.instruction);
+        string name = GetInstructionName(instruction.instruction);
+        const int *args = registerArguments.data() + instruction.arguments;
+
+        result += GetRegisterName(instruction.target, names) + " = ";
+
+        if (count == 2 && !IsLetter(name[0])) {
+            result += GetRegisterName(args[0], names) + " " + name + " " + GetRegisterName(args[1], names);
+        }
+        else {
+            result += name + "(";
+
+            for (int j = 0; j < count; j++)
+                result += (j > 0 ? ", " : "") + GetRegisterName(args[j], names);
+
+            if (instruction.instruction.opcode == Opcode::PowInt)
+                result += ", " + to_string(instruction.instruction.index);
+
+            result += ")";
+        }
+
+        result += "; ";
+    }
+
+    return result + "return " + GetRegisterName(registerResult, names);
+}
+
+// получение канонической формы выражения: польская запись с упорядоченными операндами коммутативных операций
+const string& ExpressionParser::GetCanonicalForm() const {
+    Analyze();
+    return canonical;
+}
+
+// получение структурного хеша выражения, одинакового для выражений с одинаковой канонической формой
+ExpressionHash ExpressionParser::GetHash() const {
+    Analyze();
+    return hash;
+}
+
+// проверка структурного равенства выражений: совпадение канонических форм
+bool ExpressionParser::IsEquivalent(const ExpressionParser& parser) const {
+    Analyze();
+    parser.Analyze();
+    return hash == parser.hash && canonical == parser.canonical;
+}
+
+// переменные, влияющие на результат
+vector<string> DependencyAnalysis::GetUsedVariables() const {
+    vector<string> names;
+
+    for (auto it = degrees.begin(); it != degrees.end(); it++)
+        if (it->second != 0)
+            names.push_back(it->first);
+
+    return names;
+}
+
+// переменные выражения, не влияющие на результат
+vector<string> DependencyAnalysis::GetUnusedVariables() const {
+    vector<string> names;
+
+    for (auto it = degrees.begin(); it != degrees.end(); it++)
+        if (it->second == 0)
+            names.push_back(it->first);
+
+    return names;
+}
+
+// зависит ли результат от переменной линейно (или не зависит)
+bool DependencyAnalysis::IsLinear(const string& name) const {
+    auto it = degrees.find(name);
+    return it == degrees.end() || it->second == 0 || it->second == 1;
+}
+
+// зависимости суммы (степень - максимум) или произведения (степень - сумма), произведение на известный ноль равно нулю
+DependencyNode ExpressionParser::CombineDependencies(const DependencyNode& a, const DependencyNode& b, bool multiply) {
+    DependencyNode node;
+
+    if (a.constant && b.constant) {
+        node.constant = true;
+        node.value = multiply ? a.value * b.value : a.value + b.value;
+        return node;
+    }
+
+    if (multiply && ((a.constant && a.value == 0) || (b.constant && b.value == 0))) {
+        node.constant = true;
+        return node;
+    }
+
+    node.degrees = a.degrees;
+
+    for (auto it = b.degrees.begin(); it != b.degrees.end(); it++) {
+        int& degree = node.degrees[it->first];
+
+        if (degree < 0 || it->second < 0)
+            degree = -1;
+        else if (multiply)
+            degree = degree + (long long)it->second > INT_MAX ? -1 : degree + it->second;
+        else
+            degree = max(degree, it->second);
+    }
+
+    return node;
+}
+
+// зависимости целой степени: степени умножаются, отрицательная степень - не многочлен
+DependencyNode ExpressionParser::ScaleDependencies(const DependencyNode& a, int power) {
+    DependencyNode node = a;
+
+    for (auto it = node.degrees.begin(); it != node.degrees.end(); it++)
+        if (power < 0 || it->second < 0 || it->second * (long long)power > INT_MAX)
+            it->second = -1;
+        else
+            it->second *= power;
+
+    return node;
+}
+
+// зависимости нелинейной функции: от всех переменных аргументов не как многочлен
+DependencyNode ExpressionParser::NonlinearDependencies(const DependencyNode *args, int count) {
+    DependencyNode node;
+
+    for (int i = 0; i < count; i++)
+        for (auto it = args[i].degrees.begin(); it != args[i].degrees.end(); it++)
+            node.degrees[it->first] = -1;
+
+    return node;
+}
+
+// анализ зависимости результата от переменных по скомпилированной программе: используемые переменные,
+// степень многочлена по каждой переменной и постоянство результата после свёртки (x*0, x - x, 0 && x, if с известным условием)
+DependencyAnalysis ExpressionParser::AnalyzeDependencies() const {
+    vector<DependencyNode> stack;
+
+    // зависимости противоположного значения
+    auto negate = [](DependencyNode node) {
+        node.value = -node.value;
+        return node;
+    };
+
+    for (size_t i = 0; i < program.size(); i++) {
+        const Instruction& instruction = program[i];
+
+        if (IsJump(instruction.opcode))
+            continue;
+
+        int count = GetArgumentsCount(instruction);
+        DependencyNode *args = stack.data() + stack.size() - count;
+        DependencyNode node;
+        bool constant = count > 0;
+
+        for (int j = 0; j < count && constant; j++)
+            constant = args[j].constant;
+
+        if (instruction.opcode == Opcode::Number) {
+            node.constant = true;
+            node.value = instruction.value;
+        }
+        else if (instruction.opcode == Opcode::Variable) {
+            node.degrees[instruction.index] = 1;
+        }
+        else if (constant) {
+            vector<double> values(count);
+
+            for (int j = 0; j < count; j++)
+                values[j] = args[j].value;
+
+            node.constant = true;
+            node.value = ApplyInstruction(instruction, values.data());
+        }
+        else {
+            switch (instruction.opcode) {
+                case Opcode::Neg:
+                    node = negate(args[0]);
+                    break;
+
+                case Opcode::Add:
+                    node = CombineDependencies(args[0], args[1], false);
+                    break;
+
+                case Opcode::NegAdd:
+                    node = CombineDependencies(negate(args[0]), args[1], false);
+                    break;
+
+                case Opcode::Sub:
+                    node = CombineDependencies(args[0], negate(args[1]), false);
+
+                    if (IsSameOperand(program, args[0].start, args[1].start, i)) { // x - x = 0
+                        node = DependencyNode();
+                        node.constant = true;
+                    }
+
+                    break;
+
+                case Opcode::Mul:
+                    node = CombineDependencies(args[0], args[1], true);
+                    break;
+
+                case Opcode::Div:
+                    node = CombineDependencies(args[0], NonlinearDependencies(args + 1, 1), false);
+                    break;
+
+                case Opcode::Square:
+                    node = ScaleDependencies(args[0], 2);
+                    break;
+
+                case Opcode::Cube:
+                    node = ScaleDependencies(args[0], 3);
+                    break;
+
+                case Opcode::PowInt:
+                    node = ScaleDependencies(args[0], instruction.index);
+                    break;
+
+                case Opcode::MulAdd:
+                    node = CombineDependencies(CombineDependencies(args[0], args[1], true), args[2], false);
+                    break;
+
+                case Opcode::MulSub:
+                    node = CombineDependencies(CombineDependencies(args[0], args[1], true), negate(args[2]), false);
+                    break;
+
+                case Opcode::AddMul:
+                    node = CombineDependencies(args[0], CombineDependencies(args[1], args[2], true), false);
+                    break;
+
+                case Opcode::SubMul:
+                    node = CombineDependencies(args[0], negate(CombineDependencies(args[1], args[2], true)), false);
+                    break;
+
+                case Opcode::SumSquares:
+                    node = CombineDependencies(ScaleDependencies(args[0], 2), ScaleDependencies(args[1], 2), false);
+                    break;
+
+                case Opcode::Sum:
+                case Opcode::Avg:
+                    node = args[0];
+
+                    for (int j = 1; j < count; j++)
+                        node = CombineDependencies(node, args[j], false);
+                    break;
+
+                case Opcode::And:
+                case Opcode::Or:
+                    // 0 && x = 0 и 1 || x = 1 при любом x
+                    for (int j = 0; j < count && !node.constant; j++)
+                        if (args[j].constant && (args[j].value != 0) == (instruction.opcode == Opcode::Or)) {
+                            node.constant = true;
+                            node.value = instruction.opcode == Opcode::Or;
+                        }
+
+                    if (!node.constant)
+                        node = NonlinearDependencies(args, count);
+                    break;
+
+                case Opcode::If:
+                    if (args[0].constant)
+                        node = args[0].value != 0 ? args[1] : args[2];
+                    else if (args[1].constant && args[2].constant && args[1].value == args[2].value)
+                        node = args[1];
+                    else
+                        node = CombineDependencies(NonlinearDependencies(args, 1), CombineDependencies(args[1], args[2], false), false);
+                    break;
+
+                default:
+                    node = NonlinearDependencies(args, count);
+            }
+        }
+
+        if (node.constant)
+            node.degrees.clear();
+
+        node.start = count > 0 ? args[0].start : i;
+        stack.resize(stack.size() - count);
+        stack.push_back(node);
+    }
+
+    DependencyAnalysis analysis;
+    analysis.constant = stack.back().constant;
+    analysis.value = analysis.constant ? stack.back().value : NAN;
+
+    for (auto it = variables.begin(); it != variables.end(); it++) {
+        auto degree = stack.back().degrees.find(it->second);
+        analysis.degrees[it->first] = degree == stack.back().degrees.end() ? 0 : degree->second;
+    }
+
+    return analysis;
+}
+
+// оценка относительной погрешности приближённого режима: сумма погрешностей выбранных ядер с множителями
+// распространения по дереву, не больше допустимой погрешности, если сложения не сокращают слагаемые
+double ExpressionParser::GetApproximationError() const {
+    return approximationError;
+}
+
+// проверка погрешности приближённого режима на выборке: пакетное вычисление с приближёнными ядрами
+// сравнивается с той же программой, в которой ядра заменены точными функциями
+ApproximationCheck ExpressionParser::VerifyApproximation(const map<string, const double *>& columns, size_t count) const {
+    ExpressionParser exact(*this);
+
+    for (Instruction& instruction : exact.program)
+        if (GetExactOpcode(instruction.opcode) != Opcode::Number)
+            instruction = { GetExactOpcode(instruction.opcode), 0, 0 };
+
+    vector<double> approximate(count), reference(count);
+    EvaluateBatch(columns, approximate.data(), count);
+    exact.EvaluateBatch(columns, reference.data(), count);
+
+    ApproximationCheck check;
+    check.samples = count;
+    check.tolerance = tolerance;
+
+    for (size_t i = 0; i < count; i++) {
+        double error = 0;
+
+        if (isnan(approximate[i]) || isnan(reference[i]) || isinf(approximate[i]) || isinf(reference[i]))
+            error = approximate[i] == reference[i] || (isnan(approximate[i]) && isnan(reference[i])) ? 0 : INFINITY;
+        else
+            error = fabs(approximate[i] - reference[i]) / (reference[i] != 0 ? fabs(reference[i]) : 1);
+
+        check.maxError = max(check.maxError, error);
+
+        if (error > tolerance)
+            check.violations++;
+    }
+
+    return check;
+}
+
+// значение по таблице для x из области таблицы: многочлен интервала по схеме Горнера или многочлен Чебышёва по схеме Кленшоу
+inline double ExpressionParser::LookupTable(const ExpressionTable& table, double x) {
+    if (table.stride == 0) {
+        double t = (x - table.low) * table.scale - 1; // x, приведённый к [-1, 1]
+        double b1 = 0, b2 = 0;
+
+        for (size_t k = table.size - 1; k > 0; k--) {
+            double b = table.coefficients[k] + 2 * t * b1 - b2;
+            b2 = b1;
+            b1 = b;
+        }
+
+        return table.coefficients[0] + t * b1 - b2;
+    }
+
+    double t = (x - table.low) * table.scale;
+    size_t index = min(size_t(t), table.size - 1); // x = high попадает в последний интервал
+    const double *c = table.coefficients.data() + index * table.stride;
+    t -= index;
+
+    return table.stride == 2 ? c[0] + t * c[1] : c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+}
+
+// значения по таблице на блоке строк: индексы интервалов считаются отдельным проходом, коэффициенты читаются
+// по индексам (с -mavx2 -O3 - инструкциями gather). Возвращает false без записи результата, если есть строки вне области
+bool ExpressionParser::LookupTableRows(const ExpressionTable& table, const double *x, double *result, size_t size) {
+    bool inside = true;
+
+    for (size_t i = 0; i < size; i++)
+        inside &= x[i] >= table.low && x[i] <= table.high;
+
+    if (!inside)
+        return false;
+
+    if (table.stride == 0) {
+        for (size_t i = 0; i < size; i++)
+            result[i] = LookupTable(table, x[i]);
+
+        return true;
+    }
+
+    size_t indices[BLOCK_SIZE];
+    double fractions[BLOCK_SIZE];
+    const double *c = table.coefficients.data();
+    size_t last = table.size - 1;
+
+    for (size_t i = 0; i < size; i++) {
+        double t = (x[i] - table.low) * table.scale;
+        size_t index = min(size_t(t), last);
+        indices[i] = index * table.stride;
+        fractions[i] = t - index;
+    }
+
+    if (table.stride == 2) {
+        for (size_t i = 0; i < size; i++)
+            result[i] = c[indices[i]] + fractions[i] * c[indices[i] + 1];
+    }
+    else {
+        for (size_t i = 0; i < size; i++) {
+            double t = fractions[i];
+            result[i] = c[indices[i]] + t * (c[indices[i] + 1] + t * (c[indices[i] + 2] + t * c[indices[i] + 3]));
+        }
+    }
+
+    return true;
+}
+
+// построение коэффициентов по значениям в узлах: для равномерной сетки - многочлены интервалов по t из [0, 1)
+// (кубические Эрмита по производным, умноженным на шаг), для Чебышёва - коэффициенты по значениям в узлах Чебышёва
+void ExpressionParser::BuildTable(ExpressionTable& table, const vector<double>& nodes, const vector<double>& derivatives, TableInterpolation interpolation) {
+    size_t n = table.size;
+
+    if (table.stride == 0) {
+        table.coefficients.assign(n, 0);
+
+        for (size_t k = 0; k < n; k++) {
+            for (size_t j = 0; j < n; j++)
+                table.coefficients[k] += nodes[j] * cos(M_PI * k * (j + 0.5) / n);
+
+            table.coefficients[k] *= (k == 0 ? 1.0 : 2.0) / n;
+        }
+
+        return;
+    }
+
+    table.coefficients.resize(n * table.stride);
+    double h = 1 / table.scale;
+
+    for (size_t k = 0; k < n; k++) {
+        double *c = table.coefficients.data() + k * table.stride;
+        double v0 = nodes[k], v1 = nodes[k + 1];
+        c[0] = v0;
+        c[1] = v1 - v0;
+
+        if (interpolation == TableInterpolation::Cubic) {
+            double m0 = derivatives[k] * h, m1 = derivatives[k + 1] * h;
+            c[1] = m0;
+            c[2] = 3 * (v1 - v0) - 2 * m0 - m1;
+            c[3] = 2 * (v0 - v1) + m0 + m1;
+        }
+    }
+}
+
+// замена вычисления выражения от одной переменной на отрезке [low, high] таблицей значений. Количество интервалов
+// (коэффициентов) удваивается, пока погрешность на контрольных точках между узлами не станет меньше options.maxError.
+// Evaluate и пакетные вычисления по стековой программе используют таблицу внутри отрезка и программу вне его
+void ExpressionParser::Tabulate(const string& variable, double low, double high, const TableOptions& options) {
+    if (!(low < high) || !isfinite(low) || !isfinite(high))
+        throw string("Incorrect table domain for '") + variable + "'";
+
+    for (const string& name : AnalyzeDependencies().GetUsedVariables())
+        if (name != variable)
+            throw string("Unable to tabulate expression depending on '") + name + "'";
+
+    auto it = variables.find(variable);
+
+    if (it == variables.end())
+        throw string("Unable to tabulate expression without variable '") + variable + "'";
+
+    ExpressionTable result;
+    result.variable = it->second;
+    result.low = low;
+    result.high = high;
+    result.stride = options.grid == TableGrid::Chebyshev ? 0 : (options.interpolation == TableInterpolation::Cubic ? 4 : 2);
+
+    double saved = values[result.variable];
+    size_t limit = result.stride == 0 ? min(options.maxSize, size_t(1024)) : options.maxSize;
+    table = ExpressionTable(); // узлы и контрольные точки вычисляются по программе
+
+    // значение и производная выражения в точке
+    auto evaluate = [this, &result, &variable](double x, double& derivative) {
+        values[result.variable] = x;
+        return EvaluateDerivative(variable, derivative);
+    };
+
+    for (size_t n = result.stride == 0 ? 8 : 16; n <= limit; n *= 2) {
+        size_t count = result.stride == 0 ? n : n + 1;
+        vector<double> nodes(count), derivatives(count);
+        result.size = n;
+        result.scale = result.stride == 0 ? 2 / (high - low) : n / (high - low);
+
+        for (size_t j = 0; j < count; j++) {
+            double x = result.stride == 0 ? (low + high) / 2 + (high - low) / 2 * cos(M_PI * (j + 0.5) / n) : (j == n ? high : low + (high - low) * j / n);
+            nodes[j] = evaluate(x, derivatives[j]);
+
+            if (!isfinite(nodes[j])) {
+                values[result.variable] = saved;
+                throw string("Unable to tabulate expression: value at ") + to_string(x) + " is not finite";
+            }
+        }
+
+        // бесконечная производная (например, sqrt(abs(x)) в нуле) заменяется разностной
+        for (size_t j = 0; j < count && result.stride != 0; j++)
+            if (!isfinite(derivatives[j]))
+                derivatives[j] = (nodes[min(j + 1, n)] - nodes[j > 0 ? j - 1 : 0]) * result.scale / (j > 0 && j < n ? 2 : 1);
+
+        BuildTable(result, nodes, derivatives, options.interpolation);
+
+        // контрольные точки: по четыре внутри каждого интервала равномерной сетки, 8n точек для Чебышёва
+        size_t checks = result.stride == 0 ? 8 * n : 4 * n;
+        result.error = 0;
+
+        for (size_t j = 0; j < checks; j++) {
+            double x = result.stride == 0 ? low + (high - low) * (j + 0.5) / checks : low + (high - low) * (j / 4 + 0.2 * (j % 4 + 1)) / n;
+            double derivative;
+            double exact = evaluate(x, derivative);
+
+            if (!isfinite(exact)) {
+                values[result.variable] = saved;
+                throw string("Unable to tabulate expression: value at ") + to_string(x) + " is not finite";
+            }
+
+            result.error = max(result.error, fabs(LookupTable(result, x) - exact) / max(1.0, fabs(exact)));
+        }
+
+        if (result.error <= options.maxError) {
+            // хвост коэффициентов Чебышёва, сумма модулей которого укладывается в остаток погрешности, отбрасывается
+            double tail = 0;
+
+            while (result.stride == 0 && result.size > 1 && result.error + tail + fabs(result.coefficients[result.size - 1]) <= options.maxError)
+                tail += fabs(result.coefficients[--result.size]);
+
+            result.coefficients.resize(result.stride == 0 ? result.size : result.coefficients.size());
+            result.error += tail;
+            values[result.variable] = saved;
+            table = result;
+            return;
+        }
+    }
+
+    values[result.variable] = saved;
+    throw string("Unable to tabulate expression with error ") + to_string(options.maxError) + " using " + to_string(limit) + " nodes";
+}
+
+// вычисляется ли выражение по таблице
+bool ExpressionParser::IsTabulated() const {
+    return table.size > 0;
+}
+
+// количество интервалов или коэффициентов таблицы
+size_t ExpressionParser::GetTableSize() const {
+    return table.size;
+}
+
+// наибольшая погрешность таблицы на контрольных точках
+double ExpressionParser::GetTableError() const {
+    return table.error;
+}
+
+// получение статистики выражения
+ExpressionStatistics ExpressionParser::GetStatistics() const {
+#ifdef EXPRESSION_PARSER_PROFILING
+    ExpressionStatistics result = statistics;
+
+    for (size_t i = 0; i < program.size(); i++) {
+        string name = GetInstructionName(program[i]);
+        result.operations[name].count += profile[i].count;
+        result.operations[name].cycles += profile[i].cycles;
+    }
+
+    return result;
+#else
+    return ExpressionStatistics();
+#endif
+}
+
+// сброс статистики вычислений
+void ExpressionParser::ResetStatistics() {
+#ifdef EXPRESSION_PARSER_PROFILING
+    statistics.evaluations = 0;
+    statistics.evaluationTime = 0;
+    statistics.evaluationCycles = 0;
+    profile.assign(program.size(), OperationStatistics());
+#endif
+}
+
+// вывод статистики в читаемом виде
+void ExpressionParser::PrintStatistics(ostream& os) const {
+#ifndef EXPRESSION_PARSER_PROFILING
+    os << "Statistics are unavailable: compile with EXPRESSION_PARSER_PROFILING defined" << endl;
+#else
+    ExpressionStatistics statistics = GetStatistics();
+    vector<pair<string, OperationStatistics>> operations(statistics.operations.begin(), statistics.operations.end());
+    unsigned long long total = 0;
+
+    for (size_t i = 0; i < operations.size(); i++)
+        total += operations[i].second.cycles;
+
+    // сортируем операции по убыванию затраченных тактов
+    sort(operations.begin(), operations.end(), [](const pair<string, OperationStatistics>& a, const pair<string, OperationStatistics>& b) {
+        return a.second.cycles > b.second.cycles;
+    });
+
+    os << "parse time: " << statistics.parseTime * 1e6 << " us" << endl;
+    os << "evaluations: " << statistics.evaluations << endl;
+    os << "evaluation time: " << statistics.evaluationTime * 1e6 << " us";
+
+    if (statistics.evaluations > 0)
+        os << " (" << statistics.evaluationTime * 1e9 / statistics.evaluations << " ns, " << statistics.evaluationCycles / statistics.evaluations << " cycles per evaluation)";
+
+    os << endl;
+    os << left << setw(12) << "operation" << right << setw(14) << "count" << setw(16) << "cycles" << setw(14) << "cycles/call" << setw(10) << "share" << endl;
+
+    for (size_t i = 0; i < operations.size(); i++) {
+        const OperationStatistics& operation = operations[i].second;
+
+        os << left << setw(12) << operations[i].first << right << setw(14) << operation.count << setw(16) << operation.cycles;
+        os << setw(14) << fixed << setprecision(1) << (operation.count > 0 ? double(operation.cycles) / operation.count : 0.0);
+        os << setw(9) << (total > 0 ? operation.cycles * 100.0 / total : 0.0) << "%" << defaultfloat << endl;
+    }
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <limits>
+#include "ExpressionParser.hpp"
+
+using namespace std;
+
+// результат интегрирования
+struct QuadratureResult {
+    double value; // значение интеграла
+    double error; // оценка абсолютной погрешности
+    size_t evaluations; // количество вычислений выражения
+    size_t intervals; // количество интервалов разбиения
+    bool converged; // достигнута ли заданная точность
+};
+
+// результат поиска корня
+struct RootResult {
+    double root; // найденный корень
+    double value; // значение выражения в корне
+    size_t iterations; // количество итераций
+    size_t evaluations; // количество вычислений выражения
+    bool converged; // достигнута ли заданная точность
+};
+
+// численные методы над скомпилированным выражением от одной переменной,
+// остальные переменные берут значения, установленные через SetValue
+class Numerics {
+    static const double KRONROD_NODES[8]; // узлы правила Кронрода на [0, 1], узлы Гаусса - нечётные
+    static const double KRONROD_WEIGHTS[8]; // веса 15-точечного правила Кронрода
+    static const double GAUSS_WEIGHTS[4]; // веса 7-точечного правила Гаусса
+
+    static void Evaluate(const ExpressionParser& parser, const string& variable, const vector<double>& x, vector<double>& y); // пакетное вычисление выражения в точках x
+public:
+    static QuadratureResult Integrate(const ExpressionParser& parser, const string& variable, double a, double b, double tolerance = 1e-10, size_t maxIntervals = 1000); // адаптивное интегрирование Гаусса–Кронрода
+    static RootResult FindRoot(const ExpressionParser& parser, const string& variable, double a, double b, double tolerance = 1e-12, size_t maxIterations = 100); // поиск корня методом Брента на отрезке
+    static RootResult SolveNewton(const ExpressionParser& parser, const string& variable, double x0, double tolerance = 1e-12, size_t maxIterations = 50); // поиск корня методом Ньютона
+};
+
+const double Numerics::KRONROD_NODES[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0.000000000000000000000000000000000
+};
+
+const double Numerics::KRONROD_WEIGHTS[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714
+};
+
+const double Numerics::GAUSS_WEIGHTS[4] = {
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975, 0.417959183673469387755102040816327
+};
+
+// пакетное вычисление выражения в точках x
+void Numerics::Evaluate(const ExpressionParser& parser, const string& variable, const vector<double>& x, vector<double>& y) {
+    y.resize(x.size());
+    parser.EvaluateBatch({ { variable, x.data() } }, y.data(), x.size());
+}
+
+// адаптивное интегрирование правилом Гаусса–Кронрода G7K15 с абсолютной точностью tolerance:
+// на каждом шаге узлы всех неточных интервалов вычисляются одним пакетом, затем интервалы делятся пополам
+QuadratureResult Numerics::Integrate(const ExpressionParser& parser, const string& variable, double a, double b, double tolerance, size_t maxIntervals) {
+    if (!isfinite(a) || !isfinite(b))
+        throw string("Integration limits must be finite");
+
+    QuadratureResult result = { 0, 0, 0, 0, true };
+    vector<pair<double, double>> pending = { make_pair(a, b) }; // интервалы, ещё не достигшие точности
+    vector<double> x, y;
+
+    while (!pending.empty()) {
+        x.clear();
+
+        for (const pair<double, double>& interval : pending) {
+            double center = (interval.first + interval.second) / 2;
+            double radius = (interval.second - interval.first) / 2;
+
+            for (int i = 0; i < 7; i++) {
+                x.push_back(center - radius * KRONROD_NODES[i]);
+                x.push_back(center + radius * KRONROD_NODES[i]);
+            }
+
+            x.push_back(center);
+        }
+
+        Evaluate(parser, variable, x, y);
+        result.evaluations += x.size();
+
+        // интервалы, которые можно разделить, не превышая ограничение на их количество
+        size_t budget = maxIntervals > result.intervals + pending.size() ? maxIntervals - result.intervals - pending.size() : 0;
+        vector<pair<double, double>> next;
+
+        for (size_t j = 0; j < pending.size(); j++) {
+            const double *f = y.data() + j * 15;
+            double radius = (pending[j].second - pending[j].first) / 2;
+            double kronrod = f[14] * KRONROD_WEIGHTS[7];
+            double gauss = f[14] * GAUSS_WEIGHTS[3];
+
+            for (int i = 0; i < 7; i++) {
+                kronrod += (f[2 * i] + f[2 * i + 1]) * KRONROD_WEIGHTS[i];
+
+                if (i % 2 == 1)
+                    gauss += (f[2 * i] + f[2 * i + 1]) * GAUSS_WEIGHTS[i / 2];
+            }
+
+            double error = fabs((kronrod - gauss) * radius);
+            double center = (pending[j].first + pending[j].second) / 2;
+            bool accurate = error <= tolerance * (2 * radius) / fabs(b - a) || !isfinite(error);
+            bool divisible = center > pending[j].first && center < pending[j].second; // интервал не вырожден в точку
+
+            if (accurate || !divisible || budget == 0) {
+                result.converged = result.converged && (accurate || error <= tolerance);
+                result.value += kronrod * radius;
+                result.error += error;
+                result.intervals++;
+            }
+            else {
+                next.push_back(make_pair(pending[j].first, center));
+                next.push_back(make_pair(center, pending[j].second));
+                budget--;
+            }
+        }
+
+        pending = next;
+    }
+
+    result.converged = result.converged && isfinite(result.value) && result.error <= tolerance;
+    return result;
+}
+
+// поиск корня методом Брента на отрезке [a, b]: отрезок сначала делится на части одним пакетом вычислений,
+// и метод запускается на первой части со сменой знака. Итерации Брента скалярные: каждая следующая точка зависит
+// от предыдущего значения, а вызов EvaluateBatch стоит нескольких скалярных вычислений, поэтому пакет из нескольких
+// точек на шаге сужает отрезок медленнее, чем сверхлинейная сходимость метода за то же время
+RootResult Numerics::FindRoot(const ExpressionParser& parser, const string& variable, double a, double b, double tolerance, size_t maxIterations) {
+    const size_t SAMPLES = 64; // количество частей начального разбиения
+    vector<double> x(SAMPLES + 1), y;
+
+    for (size_t i = 0; i <= SAMPLES; i++)
+        x[i] = i == SAMPLES ? b : a + (b - a) * i / SAMPLES;
+
+    Evaluate(parser, variable, x, y);
+
+    RootResult result = { NAN, NAN, 0, SAMPLES + 1, false };
+    size_t bracket = SAMPLES;
+
+    for (size_t i = 0; i <= SAMPLES && bracket == SAMPLES; i++) {
+        if (y[i] == 0) {
+            result.root = x[i];
+            result.value = 0;
+            result.converged = true;
+            return result;
+        }
+
+        if (i < SAMPLES && ((y[i] < 0 && y[i + 1] > 0) || (y[i] > 0 && y[i + 1] < 0)))
+            bracket = i;
+    }
+
+    if (bracket == SAMPLES)
+        throw string("Expression does not change sign on the interval");
+
+    ExpressionParser f(parser);
+    double fa = y[bracket], fb = y[bracket + 1];
+    a = x[bracket];
+    b = x[bracket + 1];
+
+    double c = a, fc = fa;
+    double d = b - a, e = d;
+
+    for (result.iterations = 1; result.iterations <= maxIterations; result.iterations++) {
+        // b - лучшее приближение, корень лежит между b и c
+        if ((fb > 0 && fc > 0) || (fb < 0 && fc < 0)) {
+            c = a;
+            fc = fa;
+            d = e = b - a;
+        }
+
+        if (fabs(fc) < fabs(fb)) {
+            a = b;
+            b = c;
+            c = a;
+            fa = fb;
+            fb = fc;
+            fc = fa;
+        }
+
+        double tol = 2 * numeric_limits<double>::epsilon() * fabs(b) + tolerance / 2;
+        double m = (c - b) / 2;
+
+        if (fabs(m) <= tol || fb == 0) {
+            result.converged = true;
+            break;
+        }
+
+        if (fabs(e) >= tol && fabs(fa) > fabs(fb)) {
+            // обратная квадратичная интерполяция или метод секущих
+            double s = fb / fa, p, q;
+
+            if (a == c) {
+                p = 2 * m * s;
+                q = 1 - s;
+            }
+            else {
+                double r = fb / fc;
+                q = fa / fc;
+                p = s * (2 * m * q * (q - r) - (b - a) * (r - 1));
+                q = (q - 1) * (r - 1) * (s - 1);
+            }
+
+            if (p > 0)
+                q = -q;
+            else
+                p = -p;
+
+            if (2 * p < min(3 * m * q - fabs(tol * q), fabs(e * q))) {
+                e = d;
+                d = p / q;
+            }
+            else {
+                d = e = m; // интерполяция неудачна, делим пополам
+            }
+        }
+        else {
+            d = e = m;
+        }
+
+        a = b;
+        fa = fb;
+        b += fabs(d) > tol ? d : (m > 0 ? tol : -tol);
+
+        f.SetValue(variable, b);
+        fb = f.Evaluate();
+        result.evaluations++;
+    }
+
+    result.iterations = min(result.iterations, maxIterations);
+    result.root = b;
+    result.value = fb;
+    return result;
+}
+
+// поиск корня методом Ньютона из начального приближения x0, производная вычисляется автоматическим дифференцированием
+RootResult Numerics::SolveNewton(const ExpressionParser& parser, const string& variable, double x0, double tolerance, size_t maxIterations) {
+    ExpressionParser f(parser);
+    RootResult result = { x0, NAN, 0, 0, false };
+
+    for (result.iterations = 1; result.iterations <= maxIterations; result.iterations++) {
+        double derivative;
+        f.SetValue(variable, result.root);
+        result.value = f.EvaluateDerivative(variable, derivative);
+        result.evaluations++;
+
+        if (result.value == 0) {
+            result.converged = true;
+            break;
+        }
+
+        if (derivative == 0 || !isfinite(derivative) || !isfinite(result.value))
+            break;
+
+        double step = result.value / derivative;
+        result.root -= step;
+
+        if (fabs(step) <= tolerance * max(1.0, fabs(result.root))) {
+            f.SetValue(variable, result.root);
+            result.value = f.Evaluate();
+            result.evaluations++;
+            result.converged = true;
+            break;
+        }
+    }
+
+    result.iterations = min(result.iterations, maxIterations);
+    return result;
+}
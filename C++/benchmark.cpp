@@ -0,0 +1,566 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "ExpressionParser.hpp"
+#include "Numerics.hpp"
+#include "CompiledExpression.hpp"
+#include "EvaluationService.hpp"
+#include "Benchmark.hpp"
+
+using namespace std;
+
+// подсчитывающие операторы не встраиваются, иначе gcc принимает free в operator delete за освобождение памяти от operator new
+#if defined(__GNUC__) || defined(__clang__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
+atomic<long long> allocatedBytes(0); // объём памяти, выделенной через operator new и ещё не освобождённой
+atomic<long long> peakAllocatedBytes(0); // наибольшее значение allocatedBytes с последнего сброса
+
+// подсчитывающие operator new и operator delete: перед блоком хранится его размер
+NOINLINE void* operator new(size_t size) {
+    size_t *block = static_cast<size_t *>(malloc(size + sizeof(max_align_t)));
+
+    if (!block)
+        throw bad_alloc();
+
+    *block = size;
+    long long current = allocatedBytes += size;
+    long long peak = peakAllocatedBytes;
+
+    while (current > peak && !peakAllocatedBytes.compare_exchange_weak(peak, current))
+        ;
+
+    return reinterpret_cast<char *>(block) + sizeof(max_align_t);
+}
+
+NOINLINE void operator delete(void *pointer) noexcept {
+    if (!pointer)
+        return;
+
+    size_t *block = reinterpret_cast<size_t *>(static_cast<char *>(pointer) - sizeof(max_align_t));
+    allocatedBytes -= *block;
+    free(block);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+
+const string SHORT_EXPRESSION = "x + 1";
+const string ARITHMETIC_EXPRESSION = "(x + 1) * (y - 2) / (x * y + 3) - x % 7";
+const string TRANSCENDENTAL_EXPRESSION = "sin(x) * cos(y) + exp(-x^2) + ln(abs(y) + 1) + atan(x / (y + 1))";
+
+// длинное выражение из count слагаемых
+string MakeLongExpression(int count) {
+    string expression = "";
+
+    for (int i = 0; i < count; i++)
+        expression += (i > 0 ? " + " : "") + string("sin(x) * ") + to_string(i + 1) + " - y / " + to_string(i + 2);
+
+    return expression;
+}
+
+// выражение с глубиной вложенности скобок depth
+string MakeNestedExpression(int depth) {
+    string expression = "x";
+
+    for (int i = 0; i < depth; i++)
+        expression = "(" + expression + (i % 2 ? " * " : " + ") + "1)";
+
+    return expression;
+}
+
+// машинно сгенерированная сумма из слагаемых с разными переменными длиной не менее bytes символов
+string MakeHugeExpression(size_t bytes) {
+    string expression = "";
+
+    for (int i = 0; expression.length() < bytes; i++)
+        expression += (i > 0 ? " + " : "") + string("sin(x") + to_string(i % 64) + ") * " + to_string(i + 1) + ".5 - y / " + to_string(i % 7 + 2);
+
+    return expression;
+}
+
+// выражение с глубиной вложенности скобок порядка bytes / 6, строится за линейное время
+string MakeHugeNestedExpression(size_t bytes) {
+    size_t depth = bytes / 6;
+    string expression = string(depth, '(') + "x";
+
+    for (size_t i = 0; i < depth; i++)
+        expression += i % 2 ? " * 1)" : " + 1)";
+
+    return expression;
+}
+
+// выражение от большого количества переменных x1..xcount
+string MakeManyVariablesExpression(int count) {
+    string expression = "";
+
+    for (int i = 1; i < count; i += 2)
+        expression += (i > 1 ? " + " : "") + string("x") + to_string(i) + " * x" + to_string(i + 1);
+
+    return expression;
+}
+
+// замер разбора выражения с полной оптимизацией или с отложенной (tierThreshold > 0), с analyze - вместе с построением
+// канонической формы и регистровой программы, которые без обращения к ним не строятся
+void RegisterParse(Benchmark& benchmark, const string& name, const string& expression, size_t tierThreshold = 0, bool analyze = false) {
+    benchmark.Register("BM_Parse/" + name + (tierThreshold > 0 ? "/tiered" : analyze ? "/analyzed" : ""), [expression, tierThreshold, analyze](BenchmarkState& state) {
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            ExpressionParser parser(expression, FunctionRegistry(), tierThreshold);
+
+            if (analyze)
+                DoNotOptimize(parser.GetHash());
+
+            DoNotOptimize(parser);
+        }
+
+        state.SetItemsProcessed(state.Iterations());
+        state.SetCounter("expression_length", expression.length());
+    });
+}
+
+// замер разбора выражения размером порядка мегабайта: скорость в символах в секунду, пиковая и оставшаяся после разбора память на символ
+void RegisterHugeParse(Benchmark& benchmark, const string& name, const string& expression, size_t tierThreshold = 0) {
+    benchmark.Register("BM_Parse/" + name + (tierThreshold > 0 ? "/tiered" : ""), [expression, tierThreshold](BenchmarkState& state) {
+        double peak = 0;
+        double retained = 0;
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            long long before = allocatedBytes;
+            peakAllocatedBytes = before;
+            ExpressionParser parser(expression, FunctionRegistry(), tierThreshold);
+            peak = double(peakAllocatedBytes - before);
+            retained = double(allocatedBytes - before);
+            DoNotOptimize(parser);
+        }
+
+        state.SetItemsProcessed(state.Iterations() * expression.length());
+        state.SetCounter("peak_bytes_per_char", peak / expression.length());
+        state.SetCounter("retained_bytes_per_char", retained / expression.length());
+    });
+}
+
+// замер однократного вычисления выражения по стековой или регистровой программе
+void RegisterEvaluate(Benchmark& benchmark, const string& name, const string& expression, int variables, bool registers = false) {
+    benchmark.Register((registers ? "BM_EvaluateRegisters/" : "BM_Evaluate/") + name, [expression, variables, registers](BenchmarkState& state) {
+        ExpressionParser parser(expression);
+
+        if (variables > 0) {
+            for (int i = 1; i <= variables; i++)
+                parser.SetValue("x" + to_string(i), i * 0.5);
+        }
+        else {
+            parser.SetValue("x", 0.75);
+            parser.SetValue("y", -1.25);
+        }
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            double result = registers ? parser.EvaluateRegisters() : parser.Evaluate();
+            DoNotOptimize(result);
+        }
+
+        state.SetItemsProcessed(state.Iterations());
+    });
+}
+
+// замер вычисления выражения на наборе строк
+void RegisterRows(Benchmark& benchmark, const string& expression, size_t rows) {
+    benchmark.Register("BM_Rows/rows:" + to_string(rows), [expression, rows](BenchmarkState& state) {
+        ExpressionParser parser(expression);
+        vector<double> x(rows), y(rows), result(rows);
+
+        for (size_t j = 0; j < rows; j++) {
+            x[j] = -10 + 20.0 * j / rows;
+            y[j] = 5 - 10.0 * j / rows;
+        }
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            for (size_t j = 0; j < rows; j++) {
+                parser.SetValue("x", x[j]);
+                parser.SetValue("y", y[j]);
+                result[j] = parser.Evaluate();
+            }
+
+            DoNotOptimize(result.data());
+        }
+
+        state.SetItemsProcessed(state.Iterations() * rows);
+    });
+}
+
+// замер пакетного вычисления выражения по столбцам по стековой или регистровой программе
+void RegisterBatch(Benchmark& benchmark, const string& expression, size_t rows, bool registers = false) {
+    benchmark.Register((registers ? "BM_RegistersBatch/rows:" : "BM_Batch/rows:") + to_string(rows), [expression, rows, registers](BenchmarkState& state) {
+        ExpressionParser parser(expression);
+        vector<double> x(rows), y(rows), result(rows);
+
+        for (size_t j = 0; j < rows; j++) {
+            x[j] = -10 + 20.0 * j / rows;
+            y[j] = 5 - 10.0 * j / rows;
+        }
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            if (registers)
+                parser.EvaluateRegistersBatch({ { "x", x.data() }, { "y", y.data() } }, result.data(), rows);
+            else
+                parser.EvaluateBatch({ { "x", x.data() }, { "y", y.data() } }, result.data(), rows);
+
+            DoNotOptimize(result.data());
+        }
+
+        state.SetItemsProcessed(state.Iterations() * rows);
+    });
+}
+
+// замер поэлементного вычисления x * k + b по массиву со скалярами k и b: циклом SetValue или через EvaluateSpans
+void RegisterSpans(Benchmark& benchmark, size_t rows, bool spans) {
+    benchmark.Register("BM_Spans/rows:" + to_string(rows) + (spans ? "/spans" : "/set_value"), [rows, spans](BenchmarkState& state) {
+        ExpressionParser parser("x * k + b");
+        vector<double> x(rows), result(rows);
+
+        for (size_t j = 0; j < rows; j++)
+            x[j] = -10 + 20.0 * j / rows;
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            if (spans) {
+                parser.EvaluateSpans({ { "x", x }, { "k", 2.5 }, { "b", -1 } }, result.data());
+            }
+            else {
+                parser.SetValue("k", 2.5);
+                parser.SetValue("b", -1);
+
+                for (size_t j = 0; j < rows; j++) {
+                    parser.SetValue("x", x[j]);
+                    result[j] = parser.Evaluate();
+                }
+            }
+
+            DoNotOptimize(result.data());
+        }
+
+        state.SetItemsProcessed(state.Iterations() * rows);
+    });
+}
+
+// замер пакетного вычисления с точными функциями и с приближёнными ядрами в пределах погрешности tolerance
+void RegisterApproximation(Benchmark& benchmark, const string& expression, size_t rows, double tolerance) {
+    benchmark.Register("BM_Approximation/rows:" + to_string(rows) + (tolerance > 0 ? "/approximate" : "/exact"), [expression, rows, tolerance](BenchmarkState& state) {
+        ExpressionParser parser(expression, FunctionRegistry(), 0, tolerance);
+        vector<double> x(rows), y(rows), result(rows);
+
+        for (size_t j = 0; j < rows; j++) {
+            x[j] = -10 + 20.0 * j / rows;
+            y[j] = 5 - 10.0 * j / rows;
+        }
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            parser.EvaluateBatch({ { "x", x.data() }, { "y", y.data() } }, result.data(), rows);
+            DoNotOptimize(result.data());
+        }
+
+        state.SetItemsProcessed(state.Iterations() * rows);
+    });
+}
+
+// замер пакетного вычисления выражения от одной переменной по программе и по таблице значений
+void RegisterTable(Benchmark& benchmark, const string& expression, size_t rows, const string& name, TableGrid grid) {
+    benchmark.Register("BM_Table/rows:" + to_string(rows) + "/" + name, [expression, rows, name, grid](BenchmarkState& state) {
+        ExpressionParser parser(expression);
+        vector<double> x(rows), result(rows);
+        TableOptions options;
+        options.grid = grid;
+
+        if (name != "program")
+            parser.Tabulate("x", -10, 10, options);
+
+        for (size_t j = 0; j < rows; j++)
+            x[j] = -10 + 20.0 * ((j * 7919) % rows) / rows; // перемешанный порядок, чтобы обращения к таблице не были последовательными
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            parser.EvaluateBatch({ { "x", x.data() } }, result.data(), rows);
+            DoNotOptimize(result.data());
+        }
+
+        state.SetItemsProcessed(state.Iterations() * rows);
+    });
+}
+
+// замер масштабирования вычислений по потокам
+void RegisterThreads(Benchmark& benchmark, const string& expression, size_t rows, int threads) {
+    benchmark.Register("BM_Threads/rows:" + to_string(rows) + "/threads:" + to_string(threads), [expression, rows, threads](BenchmarkState& state) {
+        ExpressionParser prototype(expression);
+        vector<double> result(rows);
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            vector<thread> workers;
+
+            for (int t = 0; t < threads; t++) {
+                workers.push_back(thread([&prototype, &result, rows, threads, t]() {
+                    ExpressionParser parser(prototype); // у каждого потока своя копия с собственными переменными
+
+                    for (size_t j = rows * t / threads; j < rows * (t + 1) / threads; j++) {
+                        parser.SetValue("x", -10 + 20.0 * j / rows);
+                        parser.SetValue("y", 5 - 10.0 * j / rows);
+                        result[j] = parser.Evaluate();
+                    }
+                }));
+            }
+
+            for (size_t t = 0; t < workers.size(); t++)
+                workers[t].join();
+
+            DoNotOptimize(result.data());
+        }
+
+        state.SetItemsProcessed(state.Iterations() * rows);
+    });
+}
+
+// замер вычисления на сетке со значениями, генерируемыми внутри вычислителя
+void RegisterSweep(Benchmark& benchmark, const string& expression, size_t rows, int threads) {
+    benchmark.Register("BM_Sweep/rows:" + to_string(rows) + "/threads:" + to_string(threads), [expression, rows, threads](BenchmarkState& state) {
+        ExpressionParser parser(expression);
+        vector<double> result(rows);
+        size_t side = sqrt(rows);
+        vector<SweepAxis> axes = { SweepAxis("x", -10, 10, 20.0 / (rows / side - 1)), SweepAxis("y", 5, -5, -10.0 / (side - 1)) };
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            parser.Sweep(axes, result.data(), threads);
+            DoNotOptimize(result.data());
+        }
+
+        state.SetItemsProcessed(state.Iterations() * rows);
+    });
+}
+
+// замер свёртки по столбцам без сохранения значений строк
+void RegisterReduce(Benchmark& benchmark, const string& expression, size_t rows, const string& name, Summation summation) {
+    benchmark.Register("BM_Reduce/rows:" + to_string(rows) + "/" + name, [expression, rows, summation](BenchmarkState& state) {
+        ExpressionParser parser(expression);
+        vector<double> x(rows), y(rows);
+        ReductionOptions options;
+        options.summation = summation;
+
+        for (size_t j = 0; j < rows; j++) {
+            x[j] = -10 + 20.0 * j / rows;
+            y[j] = 5 - 10.0 * j / rows;
+        }
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            Reduction reduction = parser.Reduce({ { "x", x.data() }, { "y", y.data() } }, rows, options);
+            DoNotOptimize(reduction.sum);
+        }
+
+        state.SetItemsProcessed(state.Iterations() * rows);
+    });
+}
+
+// замер памяти на одну формулу для ExpressionParser и CompiledExpression при formulas живых формулах
+void RegisterMemory(Benchmark& benchmark, const string& name, const string& expression, size_t formulas, bool compiled) {
+    benchmark.Register("BM_Memory/" + name + (compiled ? "/compiled" : "/parser"), [expression, formulas, compiled](BenchmarkState& state) {
+        double bytes = 0;
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            long long before = allocatedBytes;
+
+            if (compiled) {
+                vector<CompiledExpression> expressions;
+                expressions.reserve(formulas);
+
+                for (size_t j = 0; j < formulas; j++)
+                    expressions.push_back(CompiledExpression(expression));
+
+                bytes = double(allocatedBytes - before) / formulas;
+                DoNotOptimize(expressions.data());
+            }
+            else {
+                vector<ExpressionParser> expressions;
+                expressions.reserve(formulas);
+
+                for (size_t j = 0; j < formulas; j++)
+                    expressions.push_back(ExpressionParser(expression));
+
+                bytes = double(allocatedBytes - before) / formulas;
+                DoNotOptimize(expressions.data());
+            }
+        }
+
+        state.SetItemsProcessed(state.Iterations() * formulas);
+        state.SetCounter("bytes_per_formula", bytes); // включает сам объект, так как вектор выделен через operator new
+    });
+}
+
+// замер небольших заданий из нескольких потоков: через сервис вычислений с объединением заданий или сразу в потоке
+void RegisterService(Benchmark& benchmark, const string& expression, size_t rows, int producers, bool service) {
+    benchmark.Register("BM_Service/rows:" + to_string(rows) + "/producers:" + to_string(producers) + (service ? "/service" : "/inline"), [expression, rows, producers, service](BenchmarkState& state) {
+        const size_t JOBS = 64; // количество заданий одного потока за итерацию
+        shared_ptr<const ExpressionParser> formula = make_shared<ExpressionParser>(expression);
+        EvaluationService evaluator(1, 1024);
+        vector<double> x(rows), y(rows);
+
+        for (size_t j = 0; j < rows; j++) {
+            x[j] = -10 + 20.0 * j / rows;
+            y[j] = 5 - 10.0 * j / rows;
+        }
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            vector<thread> workers;
+
+            for (int t = 0; t < producers; t++) {
+                workers.push_back(thread([&]() {
+                    vector<future<vector<double>>> futures;
+                    vector<double> result(rows);
+
+                    for (size_t j = 0; j < JOBS; j++) {
+                        if (service)
+                            futures.push_back(evaluator.Submit(formula, { { "x", x }, { "y", y } }));
+                        else
+                            formula->EvaluateBatch({ { "x", x.data() }, { "y", y.data() } }, result.data(), rows);
+                    }
+
+                    for (size_t j = 0; j < futures.size(); j++)
+                        DoNotOptimize(futures[j].get().data());
+
+                    DoNotOptimize(result.data());
+                }));
+            }
+
+            for (size_t t = 0; t < workers.size(); t++)
+                workers[t].join();
+        }
+
+        state.SetItemsProcessed(state.Iterations() * producers * JOBS * rows);
+
+        if (service) {
+            ServiceStatistics statistics = evaluator.GetStatistics();
+            state.SetCounter("p50_us", statistics.p50);
+            state.SetCounter("p99_us", statistics.p99);
+            state.SetCounter("jobs_per_batch", statistics.batches > 0 ? double(statistics.jobs) / statistics.batches : 0);
+        }
+    });
+}
+
+// замер адаптивного интегрирования и поиска корня
+void RegisterNumerics(Benchmark& benchmark) {
+    benchmark.Register("BM_Integrate/oscillating", [](BenchmarkState& state) {
+        ExpressionParser parser("exp(-x^2 / 8) * sin(10 * x)");
+        size_t evaluations = 0;
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            QuadratureResult result = Numerics::Integrate(parser, "x", 0, 10, 1e-10);
+            evaluations = result.evaluations;
+            DoNotOptimize(result.value);
+        }
+
+        state.SetItemsProcessed(state.Iterations());
+        state.SetCounter("evaluations", evaluations);
+    });
+
+    benchmark.Register("BM_FindRoot/brent", [](BenchmarkState& state) {
+        ExpressionParser parser("x^3 - 2*x - 5");
+        size_t evaluations = 0;
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            RootResult result = Numerics::FindRoot(parser, "x", -10, 10);
+            evaluations = result.evaluations;
+            DoNotOptimize(result.root);
+        }
+
+        state.SetItemsProcessed(state.Iterations());
+        state.SetCounter("evaluations", evaluations);
+    });
+
+    benchmark.Register("BM_FindRoot/newton", [](BenchmarkState& state) {
+        ExpressionParser parser("x^3 - 2*x - 5");
+        size_t evaluations = 0;
+
+        for (size_t i = 0; i < state.Iterations(); i++) {
+            RootResult result = Numerics::SolveNewton(parser, "x", 2);
+            evaluations = result.evaluations;
+            DoNotOptimize(result.root);
+        }
+
+        state.SetItemsProcessed(state.Iterations());
+        state.SetCounter("evaluations", evaluations);
+    });
+}
+
+int main(int argc, char **argv) {
+    Benchmark benchmark;
+
+    RegisterParse(benchmark, "short", SHORT_EXPRESSION);
+    RegisterParse(benchmark, "long", MakeLongExpression(100));
+    RegisterParse(benchmark, "nested", MakeNestedExpression(200));
+    RegisterParse(benchmark, "short", SHORT_EXPRESSION, 1000);
+    RegisterParse(benchmark, "long", MakeLongExpression(100), 1000);
+    RegisterParse(benchmark, "nested", MakeNestedExpression(200), 1000);
+    RegisterParse(benchmark, "short", SHORT_EXPRESSION, 0, true);
+    RegisterParse(benchmark, "long", MakeLongExpression(100), 0, true);
+    RegisterParse(benchmark, "nested", MakeNestedExpression(200), 0, true);
+    RegisterHugeParse(benchmark, "huge/1mb", MakeHugeExpression(1 << 20));
+    RegisterHugeParse(benchmark, "huge_nested/1mb", MakeHugeNestedExpression(1 << 20));
+    RegisterHugeParse(benchmark, "huge/1mb", MakeHugeExpression(1 << 20), 1000);
+    RegisterHugeParse(benchmark, "huge_nested/1mb", MakeHugeNestedExpression(1 << 20), 1000);
+
+    RegisterEvaluate(benchmark, "arithmetic", ARITHMETIC_EXPRESSION, 0);
+    RegisterEvaluate(benchmark, "transcendental", TRANSCENDENTAL_EXPRESSION, 0);
+    RegisterEvaluate(benchmark, "many_variables", MakeManyVariablesExpression(32), 32);
+    RegisterEvaluate(benchmark, "long", MakeLongExpression(100), 0);
+    RegisterEvaluate(benchmark, "arithmetic", ARITHMETIC_EXPRESSION, 0, true);
+    RegisterEvaluate(benchmark, "transcendental", TRANSCENDENTAL_EXPRESSION, 0, true);
+    RegisterEvaluate(benchmark, "long", MakeLongExpression(100), 0, true);
+
+    for (size_t rows = 16; rows <= 65536; rows *= 16)
+        RegisterRows(benchmark, TRANSCENDENTAL_EXPRESSION, rows);
+
+    for (size_t rows = 16; rows <= 65536; rows *= 16)
+        RegisterBatch(benchmark, TRANSCENDENTAL_EXPRESSION, rows);
+
+    for (size_t rows = 16; rows <= 65536; rows *= 16)
+        RegisterBatch(benchmark, TRANSCENDENTAL_EXPRESSION, rows, true);
+
+    for (int threads = 1; threads <= 8; threads *= 2)
+        RegisterThreads(benchmark, TRANSCENDENTAL_EXPRESSION, 65536, threads);
+
+    RegisterApproximation(benchmark, "2 + sin(x) * cos(y) + exp(-x^2) + ln(y^2 + 1)", 65536, 0);
+    RegisterApproximation(benchmark, "2 + sin(x) * cos(y) + exp(-x^2) + ln(y^2 + 1)", 65536, 1e-4);
+
+    RegisterTable(benchmark, "sin(x) * cos(x / 3) + exp(-x^2 / 10) + ln(x^2 + 1)", 65536, "program", TableGrid::Uniform);
+    RegisterTable(benchmark, "sin(x) * cos(x / 3) + exp(-x^2 / 10) + ln(x^2 + 1)", 65536, "uniform", TableGrid::Uniform);
+    RegisterTable(benchmark, "sin(x) * cos(x / 3) + exp(-x^2 / 10) + ln(x^2 + 1)", 65536, "chebyshev", TableGrid::Chebyshev);
+
+    RegisterSpans(benchmark, 10000000, false);
+    RegisterSpans(benchmark, 10000000, true);
+
+    RegisterReduce(benchmark, TRANSCENDENTAL_EXPRESSION, 65536, "naive", Summation::Naive);
+    RegisterReduce(benchmark, TRANSCENDENTAL_EXPRESSION, 65536, "kahan", Summation::Kahan);
+    RegisterReduce(benchmark, TRANSCENDENTAL_EXPRESSION, 65536, "pairwise", Summation::Pairwise);
+
+    for (int threads = 1; threads <= 8; threads *= 2)
+        RegisterSweep(benchmark, TRANSCENDENTAL_EXPRESSION, 65536, threads);
+
+    RegisterNumerics(benchmark);
+
+    RegisterService(benchmark, TRANSCENDENTAL_EXPRESSION, 256, 4, false);
+    RegisterService(benchmark, TRANSCENDENTAL_EXPRESSION, 256, 4, true);
+
+    RegisterMemory(benchmark, "short", SHORT_EXPRESSION, 10000, false);
+    RegisterMemory(benchmark, "short", SHORT_EXPRESSION, 10000, true);
+    RegisterMemory(benchmark, "transcendental", TRANSCENDENTAL_EXPRESSION, 10000, false);
+    RegisterMemory(benchmark, "transcendental", TRANSCENDENTAL_EXPRESSION, 10000, true);
+
+    try {
+        return benchmark.Main(argc, argv);
+    }
+    catch (const string& error) {
+        cerr << error << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,144 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include "ExpressionParser.hpp"
+#include "Differential.hpp"
+
+using namespace std;
+
+// дифференциальное тестирование: случайные выражения вычисляются всеми движками и сравниваются с EvaluateRPN.
+// Сборка со сравнением с портом на C:
+//   gcc -O2 -c ../C/differential_bridge.c -o bridge.o && g++ -O2 -std=c++17 -pthread -DEXPRESSION_PARSER_C_PORT fuzz.cpp bridge.o -o fuzz
+// Сборка для libFuzzer:
+//   clang++ -O1 -g -std=c++17 -fsanitize=fuzzer,address -DEXPRESSION_PARSER_LIBFUZZER fuzz.cpp -o fuzz
+
+#ifdef EXPRESSION_PARSER_C_PORT
+extern "C" int c_port_evaluate(const char *expression, int count, const char **names, const double *values, double *result);
+
+// вычисление выражения портом на C
+bool EvaluateCPort(const string& expression, const map<string, double>& variables, double& result) {
+    vector<const char *> names;
+    vector<double> values;
+
+    for (auto it = variables.begin(); it != variables.end(); it++) {
+        names.push_back(it->first.c_str());
+        values.push_back(it->second);
+    }
+
+    return c_port_evaluate(expression.c_str(), names.size(), names.data(), values.data(), &result) == 0;
+}
+#endif
+
+// строки значений переменных
+vector<map<string, double>> MakeRows(GeneratorSource& source, size_t count) {
+    static const vector<double> values = { -3.5, -1, -0.5, 0, 0.25, 0.5, 1, 2, 3, 10, 1000 };
+    vector<map<string, double>> rows(count);
+
+    for (size_t i = 0; i < count; i++)
+        for (const string& name : ExpressionGenerator::VARIABLES)
+            rows[i][name] = values[source.Next(values.size())];
+
+    return rows;
+}
+
+// создание сравнения со всеми доступными движками
+DifferentialRunner MakeRunner() {
+    DifferentialRunner runner;
+#ifdef EXPRESSION_PARSER_C_PORT
+    runner.AddExternalEngine("c", EvaluateCPort);
+#endif
+    return runner;
+}
+
+#ifdef EXPRESSION_PARSER_LIBFUZZER
+// точка входа libFuzzer: байты входа задают выбор правил грамматики и значения переменных
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    GeneratorSource source(data, size);
+    bool portable = source.Next(2);
+    string expression = ExpressionGenerator(source, portable).Generate();
+    vector<map<string, double>> rows = MakeRows(source, 4);
+    DifferentialRunner runner = MakeRunner();
+
+    if (runner.Run(expression, rows, portable) > 0) {
+        for (const EngineReport& report : runner.GetReports())
+            if (report.mismatches > 0)
+                cerr << report.name << ": " << report.example << endl;
+
+        abort();
+    }
+
+    return 0;
+}
+#else
+int main(int argc, char **argv) {
+    size_t count = 10000; // количество выражений
+    uint64_t seed = 1; // начальное значение генератора
+    int depth = 5; // максимальная глубина выражений
+    size_t rows = 16; // количество строк значений на выражение
+    bool verbose = false; // вывод всех выражений с расхождениями
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t eq = arg.find('=');
+        string key = arg.substr(0, eq);
+        string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+        if (key == "--count") {
+            count = stoul(value);
+        }
+        else if (key == "--seed") {
+            seed = stoull(value);
+        }
+        else if (key == "--depth") {
+            depth = stoi(value);
+        }
+        else if (key == "--rows") {
+            rows = stoul(value);
+        }
+        else if (key == "--verbose") {
+            verbose = true;
+        }
+        else {
+            cerr << "Unknown argument '" << arg << "'" << endl;
+            cerr << "Usage: " << argv[0] << " [--count=<expressions>] [--seed=<seed>] [--depth=<depth>] [--rows=<rows>] [--verbose]" << endl;
+            return 1;
+        }
+    }
+
+    GeneratorSource source(seed);
+    DifferentialRunner runner = MakeRunner();
+
+    try {
+        for (size_t i = 0; i < count; i++) {
+            bool portable = i % 2 == 0; // чётные выражения - из общей для всех портов части грамматики
+            string expression = ExpressionGenerator(source, portable, depth).Generate();
+            size_t mismatches = runner.Run(expression, MakeRows(source, rows), portable);
+
+            if (verbose && mismatches > 0)
+                cout << "mismatch: " << expression << endl;
+        }
+    }
+    catch (const string& error) {
+        cerr << error << endl;
+        return 1;
+    }
+
+    size_t mismatches = 0;
+    cout << left << setw(20) << "Engine" << right << setw(14) << "Evaluations" << setw(14) << "Mismatches" << setw(14) << "Skipped" << setw(14) << "ns/eval" << endl;
+
+    for (const EngineReport& report : runner.GetReports()) {
+        cout << left << setw(20) << report.name << right << setw(14) << report.evaluations << setw(14) << report.mismatches << setw(14) << report.skipped;
+        cout << setw(14) << fixed << setprecision(1) << report.seconds * 1e9 / max(report.evaluations, size_t(1)) << defaultfloat << endl;
+        mismatches += report.mismatches;
+    }
+
+    for (const EngineReport& report : runner.GetReports())
+        if (report.mismatches > 0)
+            cout << "first mismatch of " << report.name << ": " << report.example << endl;
+
+    return mismatches > 0 ? 1 : 0;
+}
+#endif
@@ -1,11 +1,17 @@
 #include <iostream>
 #include <string>
 #include "ExpressionParser.hpp"
+#include "Numerics.hpp"
+#include "CompiledExpression.hpp"
+#include "EvaluationService.hpp"
+#include "Differential.hpp"
 
 using namespace std;
 
+FunctionRegistry registry; // реестр пользовательских функций, заполняется в TestRegistry
+
 void TestParser(const string expression, map<string, double> variables, double answer, double eps = 1e-10) {
-    ExpressionParser parser(expression);
+    ExpressionParser parser(expression, registry);
 
     for (auto it = variables.begin(); it != variables.end(); it++)
         parser.SetValue(it->first, it->second);
@@ -14,15 +20,754 @@ void TestParser(const string expression, map<string, double> variables, double a
 
     if (fabs(result - answer) > eps)
         cout << "FAILED: " << expression << ": " << result << " != " << answer << endl;
+
+    // неоптимизированная программа, программа после фоновой оптимизации по порогу и после явной оптимизации
+    ExpressionParser tiered(expression, registry, 2);
+
+    for (auto it = variables.begin(); it != variables.end(); it++)
+        tiered.SetValue(it->first, it->second);
+
+    for (int i = 0; i < 4; i++) {
+        if (i == 3)
+            tiered.Optimize();
+
+        double value = tiered.Evaluate();
+
+        if (fabs(value - answer) > eps && !(isnan(value) && isnan(answer)))
+            cout << "FAILED: tiered " << expression << ": " << value << " != " << answer << " at evaluation " << i << endl;
+    }
+
+    if (!tiered.IsOptimized() || tiered.Disassemble() != parser.Disassemble())
+        cout << "FAILED: tiered " << expression << " must be optimized to '" << parser.Disassemble() << "', got '" << tiered.Disassemble() << "'" << endl;
+}
+
+// проверка специализации программы и её совпадения с эталонным вычислением по польской записи
+// с относительной точностью eps на сетке x, y из [-10, 10]
+void TestCompiled(const string expression, const string program, double eps = 1e-14) {
+    ExpressionParser parser(expression);
+
+    if (parser.Disassemble() != program)
+        cout << "FAILED: " << expression << ": program '" << parser.Disassemble() << "' != '" << program << "'" << endl;
+
+    for (double x = -10; x <= 10; x += 0.25) {
+        for (double y = -10; y <= 10; y += 2.5) {
+            parser.SetValue("x", x);
+            parser.SetValue("y", y);
+
+            double result = parser.Evaluate();
+            double answer = parser.EvaluateRPN();
+
+            if (isnan(result) != isnan(answer) || fabs(result - answer) > eps * max(1.0, fabs(answer))) {
+                cout << "FAILED: " << expression << " at x = " << x << ", y = " << y << ": " << result << " != " << answer << endl;
+                return;
+            }
+        }
+    }
+}
+
+// проверка пакетного вычисления по сравнению с построчным
+void TestBatch(const string expression, const FunctionRegistry& registry = FunctionRegistry()) {
+    ExpressionParser parser(expression, registry);
+    size_t count = 1000;
+    vector<double> x(count), y(count), result(count), registers(count);
+
+    for (size_t i = 0; i < count; i++) {
+        x[i] = -10 + 20.0 * i / count;
+        y[i] = cos(i);
+    }
+
+    parser.SetValue("z", 0.5); // переменная без столбца берётся из SetValue
+    parser.EvaluateBatch({ { "x", x.data() }, { "y", y.data() } }, result.data(), count);
+    parser.EvaluateRegistersBatch({ { "x", x.data() }, { "y", y.data() } }, registers.data(), count);
+
+    for (size_t i = 0; i < count; i++) {
+        parser.SetValue("x", x[i]);
+        parser.SetValue("y", y[i]);
+        double answer = parser.Evaluate();
+
+        if (isnan(result[i]) != isnan(answer) || (!isnan(answer) && result[i] != answer)) {
+            cout << "FAILED: batch " << expression << " at row " << i << ": " << result[i] << " != " << answer << endl;
+            return;
+        }
+
+        if (isnan(registers[i]) != isnan(answer) || (!isnan(answer) && registers[i] != answer)) {
+            cout << "FAILED: registers batch " << expression << " at row " << i << ": " << registers[i] << " != " << answer << endl;
+            return;
+        }
+    }
+}
+
+void TestRegistry() {
+    registry.AddConstant("g", 9.81);
+    registry.AddUnaryFunction("erf", [](double x) { return erf(x); });
+    registry.AddUnaryFunction("normcdf", [](double x) { return 0.5 * erfc(-x / sqrt(2)); });
+    registry.AddBinaryFunction("hyp", (double (*)(double, double)) hypot);
+    registry.AddFunction("clamp", 3, [](const double *args) { return min(max(args[0], args[1]), args[2]); });
+    registry.AddFunction("lerp", 3, [](const double *args) {
+        return args[0] + (args[1] - args[0]) * args[2];
+    }, [](const double * const *args, double *result, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            result[i] = args[0][i] + (args[1][i] - args[0][i]) * args[2][i];
+    });
+
+    TestParser("g * 2", { }, 19.62);
+    TestParser("erf(0)", { }, 0);
+    TestParser("normcdf(x)", { { "x", 0 } }, 0.5);
+    TestParser("hyp(3, 4) + 1", { }, 6);
+    TestParser("clamp(x, -1, 1)", { { "x", 5 } }, 1);
+    TestParser("-clamp(x, 0, 10)^2", { { "x", 5 } }, -25);
+    TestParser("lerp(2, 4, x)", { { "x", 0.25 } }, 2.5);
+
+    ExpressionParser parser("clamp(g * x, -10, lerp(1, 3, 0.5)) + erf(x)", registry);
+
+    if (parser.Disassemble() != "9.8100000000000005 x * -10 2 clamp x erf +")
+        cout << "FAILED: registry program '" << parser.Disassemble() << "'" << endl;
+
+    TestBatch("lerp(x, y, 0.5) + clamp(x, y, 3) * normcdf(y)", registry);
+
+    try {
+        registry.AddConstant("g", 1);
+        cout << "FAILED: duplicate constant must throw" << endl;
+    }
+    catch (const string& error) {
+    }
+}
+
+// проверка сокращённого вычисления условий: невыбранные ветви не вычисляются
+void TestConditions() {
+    int calls = 0;
+    FunctionRegistry counter;
+    counter.AddUnaryFunction("count", [&calls](double x) { calls++; return x; });
+
+    vector<pair<string, int>> expressions = {
+        { "x < 0 && count(x) > 1", 0 }, { "x > 0 || count(x) > 1", 0 }, { "x < 0 || count(x) > 1", 1 },
+        { "if(x > 0, x, count(x))", 0 }, { "if(x < 0, count(x), x) + if(x > 0, count(x), x)", 1 }
+    };
+
+    for (const auto& expression : expressions) {
+        ExpressionParser parser(expression.first, counter);
+        parser.SetValue("x", 2);
+        calls = 0;
+        parser.Evaluate();
+
+        if (calls != expression.second)
+            cout << "FAILED: " << expression.first << ": " << calls << " calls != " << expression.second << endl;
+    }
+}
+
+// проверка регистровой программы и её совпадения со стековой в построчном и пакетном режимах
+void TestRegisters(const string expression, const string program) {
+    ExpressionParser parser(expression);
+    size_t count = 1000;
+    vector<double> x(count), y(count), result(count);
+
+    if (parser.DisassembleRegisters() != program)
+        cout << "FAILED: " << expression << ": registers '" << parser.DisassembleRegisters() << "' != '" << program << "'" << endl;
+
+    for (size_t i = 0; i < count; i++) {
+        x[i] = -10 + 20.0 * i / count;
+        y[i] = cos(i);
+    }
+
+    parser.SetValue("z", 0.5);
+    parser.EvaluateRegistersBatch({ { "x", x.data() }, { "y", y.data() } }, result.data(), count);
+
+    for (size_t i = 0; i < count; i++) {
+        parser.SetValue("x", x[i]);
+        parser.SetValue("y", y[i]);
+        double answer = parser.Evaluate();
+        double registers = parser.EvaluateRegisters();
+
+        if (isnan(registers) != isnan(answer) || (!isnan(answer) && registers != answer)) {
+            cout << "FAILED: registers " << expression << " at row " << i << ": " << registers << " != " << answer << endl;
+            return;
+        }
+
+        if (isnan(result[i]) != isnan(answer) || (!isnan(answer) && result[i] != answer)) {
+            cout << "FAILED: registers batch " << expression << " at row " << i << ": " << result[i] << " != " << answer << endl;
+            return;
+        }
+    }
+}
+
+// проверка вычисления на сетке по сравнению с построчным
+void TestSweep(const string expression, const vector<SweepAxis>& axes, size_t threads) {
+    ExpressionParser parser(expression);
+    vector<double> result(ExpressionParser::GetSweepSize(axes));
+    vector<size_t> index(axes.size(), 0);
+
+    parser.SetValue("z", 0.5);
+    parser.Sweep(axes, result.data(), threads);
+
+    for (size_t i = 0; i < result.size(); i++) {
+        for (size_t a = 0; a < axes.size(); a++)
+            parser.SetValue(axes[a].name, axes[a].GetValue(index[a]));
+
+        double answer = parser.Evaluate();
+
+        if (isnan(result[i]) != isnan(answer) || (!isnan(answer) && result[i] != answer)) {
+            cout << "FAILED: sweep " << expression << " at point " << i << ": " << result[i] << " != " << answer << endl;
+            return;
+        }
+
+        // следующая точка сетки, последняя ось меняется быстрее всего
+        for (size_t a = axes.size(); a-- > 0 && ++index[a] == axes[a].count;)
+            index[a] = 0;
+    }
+}
+
+// проверка поэлементного вычисления по массивам с растягиванием скаляров
+void TestSpans(const string expression, const map<string, ValueSpan>& spans, size_t threads, size_t tierThreshold = 0) {
+    ExpressionParser parser(expression, FunctionRegistry(), tierThreshold);
+    parser.SetValue("z", 0.5);
+    vector<double> result = parser.EvaluateSpans(spans, threads);
+
+    if (result.size() != ExpressionParser::GetBroadcastSize(spans)) {
+        cout << "FAILED: spans " << expression << " size " << result.size() << endl;
+        return;
+    }
+
+    for (size_t i = 0; i < result.size(); i++) {
+        for (auto it = spans.begin(); it != spans.end(); it++)
+            parser.SetValue(it->first, it->second.GetValue(i));
+
+        double answer = parser.EvaluateRPN();
+
+        if (isnan(result[i]) != isnan(answer) || (!isnan(answer) && fabs(result[i] - answer) > 1e-14 * max(1.0, fabs(answer)))) {
+            cout << "FAILED: spans " << expression << " at element " << i << ": " << result[i] << " != " << answer << endl;
+            return;
+        }
+    }
+}
+
+// проверка свёрток по строкам
+void TestReduce() {
+    size_t count = 10000;
+    vector<double> x(count), y(count);
+    long double sum = 0;
+    double low = INFINITY, high = -INFINITY;
+
+    for (size_t i = 0; i < count; i++) {
+        x[i] = sin(i) * 100;
+        y[i] = cos(i * 0.5);
+        double value = x[i] * y[i] + 1;
+        sum += value;
+        low = min(low, value);
+        high = max(high, value);
+    }
+
+    ExpressionParser parser("x * y + 1");
+    ReductionOptions options;
+    options.threads = 3;
+    Reduction reduction = parser.Reduce({ { "x", x.data() }, { "y", y.data() } }, count, options);
+
+    if (reduction.count != count || reduction.nans != 0 || reduction.min != low || reduction.max != high || fabs(reduction.sum - sum) > 1e-9 || fabs(reduction.mean - sum / count) > 1e-13)
+        cout << "FAILED: reduce x * y + 1: " << reduction.sum << " != " << double(sum) << endl;
+
+    // результат не зависит от количества потоков
+    for (Summation summation : { Summation::Naive, Summation::Kahan, Summation::Pairwise }) {
+        options.summation = summation;
+        options.threads = 1;
+        double single = parser.Reduce({ { "x", x.data() }, { "y", y.data() } }, count, options).sum;
+        options.threads = 4;
+        double multiple = parser.Reduce({ { "x", x.data() }, { "y", y.data() } }, count, options).sum;
+
+        if (single != multiple)
+            cout << "FAILED: reduce must not depend on threads: " << single << " != " << multiple << endl;
+    }
+
+    // компенсированное суммирование не теряет малые слагаемые
+    vector<double> terms(count);
+
+    for (size_t i = 0; i < count; i++)
+        terms[i] = i % 2 ? 1 : 1e16;
+
+    options.summation = Summation::Kahan;
+    double kahan = ExpressionParser("x").Reduce({ { "x", terms.data() } }, count, options).sum;
+
+    if (kahan != 1e16 * (count / 2) + count / 2)
+        cout << "FAILED: reduce with Kahan summation: " << setprecision(17) << kahan << endl;
+
+    options = ReductionOptions();
+    options.bins = 10;
+    options.low = 0;
+    options.high = 100;
+    reduction = ExpressionParser("x").Reduce({ SweepAxis("x", -10, 109, 1) }, options);
+
+    vector<size_t> histogram(10, 10);
+    histogram[9] = 11; // значение high попадает в последний интервал
+
+    if (reduction.count != 120 || reduction.outliers != 19 || reduction.mean != 49.5 || reduction.histogram != histogram)
+        cout << "FAILED: reduce histogram of x" << endl;
+
+    reduction = ExpressionParser("sqrt(x) * y").Reduce({ SweepAxis("x", -5, 4, 1), SweepAxis("y", { 1, 2 }) });
+
+    if (reduction.count != 10 || reduction.nans != 10 || reduction.min != 0 || reduction.max != 4 || fabs(reduction.sum - 3 * (1 + sqrt(2) + sqrt(3) + 2)) > 1e-14)
+        cout << "FAILED: reduce sqrt(x) * y: " << reduction.sum << endl;
+
+    reduction = ExpressionParser("sqrt(x)").Reduce({ SweepAxis("x", -5, -1, 1) });
+
+    if (reduction.count != 0 || reduction.nans != 5 || !isnan(reduction.min) || !isnan(reduction.mean))
+        cout << "FAILED: reduce of NaN values" << endl;
+}
+
+// проверка производной по сравнению с центральной разностью на сетке x из [-3, 3]
+void TestDerivative(const string expression) {
+    ExpressionParser parser(expression, registry);
+    parser.SetValue("y", 0.7);
+
+    for (double x = -3; x <= 3; x += 0.125) {
+        double h = 1e-6, derivative;
+        parser.SetValue("x", x + h);
+        double right = parser.Evaluate();
+        parser.SetValue("x", x - h);
+        double left = parser.Evaluate();
+        parser.SetValue("x", x);
+        double value = parser.EvaluateDerivative("x", derivative);
+        double answer = (right - left) / (2 * h);
+
+        // в точках разрыва и излома односторонние разности не совпадают, производная там не проверяется
+        if (fabs((right - value) - (value - left)) / h > 1e-2 * max(1.0, fabs(answer)))
+            continue;
+
+        if (value != parser.Evaluate() || (isfinite(answer) && fabs(derivative - answer) > 1e-5 * max(1.0, fabs(answer)))) {
+            cout << "FAILED: derivative of " << expression << " at x = " << x << ": " << derivative << " != " << answer << endl;
+            return;
+        }
+    }
+}
+
+// проверка интегрирования и поиска корней
+void TestNumerics() {
+    ExpressionParser parser("y * x^2");
+    parser.SetValue("y", 3);
+
+    vector<tuple<string, double, double, double>> integrals = {
+        make_tuple("sin(x)", 0, M_PI, 2), make_tuple("sqrt(x)", 0, 1, 2.0 / 3), make_tuple("abs(x)", -1, 1, 1),
+        make_tuple("exp(-x^2)", -10, 10, sqrt(M_PI)), make_tuple("1 / (1 + 25 * x^2)", -1, 1, 0.4 * atan(5)), make_tuple("x", 1, 0, -0.5)
+    };
+
+    for (const auto& integral : integrals) {
+        QuadratureResult result = Numerics::Integrate(ExpressionParser(get<0>(integral)), "x", get<1>(integral), get<2>(integral));
+
+        if (!result.converged || fabs(result.value - get<3>(integral)) > 1e-9)
+            cout << "FAILED: integral of " << get<0>(integral) << ": " << setprecision(17) << result.value << " != " << get<3>(integral) << endl;
+    }
+
+    if (fabs(Numerics::Integrate(parser, "x", 0, 2).value - 8) > 1e-12)
+        cout << "FAILED: integral of y * x^2 with y = 3" << endl;
+
+    if (Numerics::Integrate(ExpressionParser("sin(1 / x)"), "x", 1e-3, 1, 1e-12, 10).converged)
+        cout << "FAILED: integral with interval limit must not converge" << endl;
+
+    // выражение, отрезок для метода Брента, начальное приближение для метода Ньютона и корень
+    vector<tuple<string, double, double, double, double>> roots = {
+        make_tuple("x^3 - 2*x - 5", 2, 3, 2, 2.0945514815423265), make_tuple("cos(x) - x", 0, 1, 0.5, 0.7390851332151607),
+        make_tuple("exp(x) - 10", -5, 5, 1, log(10)), make_tuple("x - 1", 0, 1, 0, 1), make_tuple("atan(x - 0.3)", -100, 50, 1, 0.3)
+    };
+
+    for (const auto& root : roots) {
+        RootResult brent = Numerics::FindRoot(ExpressionParser(get<0>(root)), "x", get<1>(root), get<2>(root));
+        RootResult newton = Numerics::SolveNewton(ExpressionParser(get<0>(root)), "x", get<3>(root));
+
+        if (!brent.converged || fabs(brent.root - get<4>(root)) > 1e-11)
+            cout << "FAILED: Brent root of " << get<0>(root) << ": " << setprecision(17) << brent.root << " != " << get<4>(root) << endl;
+
+        if (!newton.converged || fabs(newton.root - get<4>(root)) > 1e-11)
+            cout << "FAILED: Newton root of " << get<0>(root) << ": " << setprecision(17) << newton.root << " != " << get<4>(root) << endl;
+    }
+
+    if (Numerics::SolveNewton(ExpressionParser("atan(x - 0.3)"), "x", -25).converged)
+        cout << "FAILED: Newton must diverge on atan from a far initial guess" << endl;
+
+    try {
+        Numerics::FindRoot(ExpressionParser("x^2 + 1"), "x", -1, 1);
+        cout << "FAILED: root without sign change must throw" << endl;
+    }
+    catch (const string& error) {
+    }
+}
+
+// проверка ошибок разбора
+void TestErrors() {
+    vector<string> expressions = { "log(1, 2, 3)", "sin(1, 2)", "max()", "(1, 2)", "1, 2", "max 1", "pow(2)", "(1 + 2", "x = 1", "x & y", "x | y", "2 ! 3", "if(1, 2)", "x*y + + w q", "if(x, y, z) + + w q", "1 + 2 + + + x y z" };
+
+    for (const string& expression : expressions) {
+        for (size_t tierThreshold : { 0, 1 }) {
+            try {
+                ExpressionParser parser(expression, FunctionRegistry(), tierThreshold);
+                cout << "FAILED: " << expression << (tierThreshold > 0 ? " (tiered)" : "") << " must throw" << endl;
+            }
+            catch (const string& error) {
+            }
+        }
+    }
+
+    try {
+        ExpressionParser("x + y").EvaluateSpans({ { "x", vector<double>(3) }, { "y", vector<double>(4) } });
+        cout << "FAILED: spans of different sizes must throw" << endl;
+    }
+    catch (const string& error) {
+    }
+}
+
+void TestDependencies(const string expression, const string answer) {
+    DependencyAnalysis analysis = ExpressionParser(expression).AnalyzeDependencies();
+    stringstream ss;
+
+    for (auto it = analysis.degrees.begin(); it != analysis.degrees.end(); it++)
+        ss << (it == analysis.degrees.begin() ? "" : " ") << it->first << ":" << it->second;
+
+    if (analysis.constant)
+        ss << " = " << analysis.value;
+
+    if (ss.str() != answer)
+        cout << "FAILED: dependencies of " << expression << ": " << ss.str() << " != " << answer << endl;
+}
+
+void TestApproximation(const string expression, double tolerance, const string program) {
+    ExpressionParser parser(expression, FunctionRegistry(), 0, tolerance);
+
+    if (parser.Disassemble() != program)
+        cout << "FAILED: approximation of " << expression << ": " << parser.Disassemble() << " != " << program << endl;
+
+    if (parser.GetApproximationError() > tolerance)
+        cout << "FAILED: approximation error of " << expression << " exceeds tolerance" << endl;
+
+    // значения внутри и вне областей ядер, около нулей синуса и единицы логарифма
+    vector<double> x, y, z;
+
+    for (int i = 0; i < 5000; i++) {
+        x.push_back(sin(i * 0.37) * (i % 7 == 0 ? 1e6 : 20));
+        y.push_back(i % 11 == 0 ? M_PI * (i % 50) : cos(i * 0.11) * 30);
+        z.push_back(i % 13 == 0 ? 1 + 1e-9 * i : exp(sin(i * 0.7) * 700));
+    }
+
+    x.insert(x.end(), { 0, -0.0, INFINITY, -INFINITY, NAN, 1e-310, 800, -800 });
+    y.insert(y.end(), { 1e5, -1e5, 1e5 + 1, NAN, 0, 1e-310, INFINITY, -1 });
+    z.insert(z.end(), { 0, -1, INFINITY, NAN, 1e-310, DBL_MIN, DBL_MAX, 1 });
+
+    map<string, const double *> columns = { { "x", x.data() }, { "y", y.data() }, { "z", z.data() } };
+    ApproximationCheck check = parser.VerifyApproximation(columns, x.size());
+
+    if (check.samples != x.size() || check.violations > 0 || check.maxError > tolerance)
+        cout << "FAILED: approximation of " << expression << " has error " << check.maxError << " in " << check.violations << " rows" << endl;
+
+    vector<double> batch(x.size());
+    parser.EvaluateBatch(columns, batch.data(), x.size());
+
+    for (size_t i = 0; i < x.size(); i++) {
+        parser.SetValue("x", x[i]);
+        parser.SetValue("y", y[i]);
+        parser.SetValue("z", z[i]);
+        double value = parser.Evaluate();
+
+        if (isnan(value) != isnan(batch[i]) || (!isnan(value) && value != batch[i])) {
+            cout << "FAILED: approximate batch of " << expression << " at row " << i << ": " << batch[i] << " != " << value << endl;
+            break;
+        }
+    }
+}
+
+void TestTable(const string expression, double low, double high, TableGrid grid, TableInterpolation interpolation, double maxError) {
+    ExpressionParser parser(expression);
+    TableOptions options;
+    options.grid = grid;
+    options.interpolation = interpolation;
+    options.maxError = maxError;
+    parser.Tabulate("x", low, high, options);
+
+    if (!parser.IsTabulated() || parser.GetTableError() > maxError)
+        cout << "FAILED: table of " << expression << " has error " << parser.GetTableError() << endl;
+
+    vector<double> x;
+
+    for (int i = 0; i <= 3000; i++)
+        x.push_back(low - (high - low) * 0.1 + (high - low) * 1.2 * i / 3000); // точки внутри и вне области
+
+    x.insert(x.end(), { low, high, NAN });
+    vector<double> batch(x.size());
+    parser.EvaluateBatch({ { "x", x.data() } }, batch.data(), x.size());
+
+    for (size_t i = 0; i < x.size(); i++) {
+        parser.SetValue("x", x[i]);
+        double value = parser.Evaluate();
+        double exact = parser.EvaluateRPN();
+        bool inside = x[i] >= low && x[i] <= high;
+
+        // между контрольными точками погрешность может быть немного больше, вне области вычисляется программа
+        double eps = (inside ? 2 * maxError : 1e-14) * max(1.0, fabs(exact));
+
+        if (isnan(value) != isnan(exact) || fabs(value - exact) > eps || isnan(batch[i]) != isnan(exact) || fabs(batch[i] - exact) > eps) {
+            cout << "FAILED: table of " << expression << " at " << x[i] << ": " << value << ", " << batch[i] << " != " << exact << endl;
+            return;
+        }
+    }
+}
+
+void TestCanonical(const string expression1, const string expression2, bool equivalent) {
+    ExpressionParser parser1(expression1);
+    ExpressionParser parser2(expression2);
+
+    if (parser1.IsEquivalent(parser2) != equivalent || (parser1.GetHash() == parser2.GetHash()) != equivalent)
+        cout << "FAILED: " << expression1 << (equivalent ? " must" : " must not") << " be equivalent to " << expression2 << " (" << parser1.GetCanonicalForm() << " / " << parser2.GetCanonicalForm() << ")" << endl;
+}
+
+void TestCompiledExpression(const string expression) {
+    ExpressionParser parser(expression, registry);
+    vector<CompiledExpression> compiled;
+
+    for (int i = 0; i < 20; i++)
+        compiled.push_back(CompiledExpression(parser)); // вектор несколько раз перемещает выражения при росте
+
+    CompiledExpression moved(move(compiled[0]));
+    compiled[0] = move(moved);
+
+    for (int i = 0; i < 20; i++) {
+        double x = -2 + i * 0.25, y = 1.5 - i * 0.1;
+        parser.SetValue("x", x);
+        parser.SetValue("y", y);
+        compiled[i].SetValue("x", x);
+        compiled[i].SetValue(compiled[i].GetVariableIndex("y"), y);
+
+        double answer = parser.Evaluate();
+        double result = compiled[i].Evaluate();
+
+        if (result != answer && !(isnan(result) && isnan(answer)))
+            cout << "FAILED: compiled " << expression << ": " << result << " != " << answer << endl;
+    }
+
+    try {
+        moved.Evaluate();
+        cout << "FAILED: moved-from compiled expression must throw" << endl;
+    }
+    catch (const string& error) {
+    }
+}
+
+void TestTiers() {
+    ExpressionParser parser("2 * 3 + x * y + x * y", FunctionRegistry(), 100);
+
+    if (parser.IsOptimized() || parser.Disassemble() != "2 3 * x y * + x y * +")
+        cout << "FAILED: baseline program '" << parser.Disassemble() << "'" << endl;
+
+    try {
+        parser.GetHash();
+        cout << "FAILED: hash of not optimized expression must throw" << endl;
+    }
+    catch (const string& error) {
+    }
+
+    parser.SetValue("x", 2);
+    parser.SetValue("y", 5);
+
+    for (int i = 0; i < 100; i++)
+        parser.Evaluate();
+
+    ExpressionParser copy(parser); // копия не разделяет фоновую оптимизацию с оригиналом
+    copy.SetValue("x", 1);
+    copy.Optimize();
+    parser.Optimize();
+
+    if (parser.Evaluate() != 26 || copy.Evaluate() != 16 || parser.Disassemble() != "6 x y addmul x y addmul" || copy.GetHash() != parser.GetHash())
+        cout << "FAILED: optimized program '" << parser.Disassemble() << "' = " << parser.Evaluate() << ", copy = " << copy.Evaluate() << endl;
+
+    // каноническая форма и регистровая программа строятся при первом обращении, в том числе из нескольких потоков
+    const ExpressionParser lazy("2 * 3 + x * y + x * y");
+    vector<double> xs = { 1, 2, 3 };
+    vector<ExpressionHash> hashes(4);
+    vector<vector<double>> results(4, vector<double>(xs.size()));
+    vector<thread> threads;
+
+    for (size_t t = 0; t < hashes.size(); t++)
+        threads.push_back(thread([&, t]() {
+            hashes[t] = lazy.GetHash();
+            lazy.EvaluateRegistersBatch({ { "x", xs.data() }, { "y", xs.data() } }, results[t].data(), xs.size());
+        }));
+
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    for (size_t t = 0; t < hashes.size(); t++)
+        if (hashes[t] != parser.GetHash() || results[t] != vector<double>({ 8, 14, 24 }) || ExpressionParser(lazy).DisassembleRegisters() != lazy.DisassembleRegisters())
+            cout << "FAILED: lazy analysis in thread " << t << ": '" << lazy.DisassembleRegisters() << "'" << endl;
+
+    // выражение уничтожается во время фоновой оптимизации
+    for (int i = 0; i < 10; i++) {
+        ExpressionParser temporary("sin(x) + cos(x) * 2", FunctionRegistry(), 1);
+        temporary.Evaluate();
+    }
+}
+
+#ifdef EXPRESSION_PARSER_COROUTINES
+// сопрограмма, которая сразу начинает выполняться и ничего не возвращает
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return DetachedTask(); }
+        suspend_never initial_suspend() noexcept { return suspend_never(); }
+        suspend_never final_suspend() noexcept { return suspend_never(); }
+        void return_void() { }
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+DetachedTask EvaluateWithCoroutine(EvaluationService& service, shared_ptr<const ExpressionParser> formula, promise<double>& result) {
+    map<string, vector<double>> columns = { { "x", { 1, 2, 3 } } };
+    vector<double> values = co_await service.Evaluate(formula, columns);
+    result.set_value(values[0] + values[1] + values[2]);
+}
+#endif
+
+void TestEvaluationService() {
+    shared_ptr<const ExpressionParser> square = make_shared<ExpressionParser>("x^2 + y");
+    shared_ptr<const ExpressionParser> sine = make_shared<ExpressionParser>("sin(x) * 2");
+    ServiceStatistics statistics;
+
+    {
+        EvaluationService service(2, 64);
+        vector<thread> producers;
+        vector<string> errors(4);
+
+        for (int t = 0; t < 4; t++) {
+            producers.push_back(thread([&service, &square, &sine, &errors, t]() {
+                vector<future<vector<double>>> results;
+
+                for (int i = 0; i < 200; i++) {
+                    vector<double> x(i % 7 + 1, t + i);
+                    map<string, vector<double>> columns = { { "x", x } };
+
+                    if (i % 2 == 0)
+                        columns["y"] = vector<double>(x.size(), 1);
+
+                    results.push_back(service.Submit(i % 2 ? sine : square, columns));
+                }
+
+                for (int i = 0; i < 200; i++) {
+                    vector<double> values = results[i].get();
+                    double x = t + i;
+                    double answer = i % 2 ? sin(x) * 2 : x * x + 1;
+
+                    if (values.size() != size_t(i % 7 + 1) || fabs(values.back() - answer) > 1e-12)
+                        errors[t] = "job " + to_string(i) + " of producer " + to_string(t);
+                }
+            }));
+        }
+
+        for (size_t t = 0; t < producers.size(); t++)
+            producers[t].join();
+
+        for (const string& error : errors)
+            if (!error.empty())
+                cout << "FAILED: evaluation service " << error << endl;
+
+        try {
+            service.Submit(square, { { "x", { 1, 2 } }, { "y", { 1 } } });
+            cout << "FAILED: columns of different size must throw" << endl;
+        }
+        catch (const string& error) {
+        }
+
+#ifdef EXPRESSION_PARSER_COROUTINES
+        promise<double> result;
+        future<double> sum = result.get_future();
+        EvaluateWithCoroutine(service, square, result);
+
+        if (sum.get() != 14)
+            cout << "FAILED: coroutine evaluation" << endl;
+#endif
+
+        statistics = service.GetStatistics();
+    }
+
+    if (statistics.jobs < 800 || statistics.batches > statistics.jobs || statistics.p50 > statistics.p99 || statistics.p99 > statistics.max)
+        cout << "FAILED: evaluation service statistics: " << statistics.jobs << " jobs, " << statistics.batches << " batches" << endl;
+}
+
+void TestDifferential() {
+    DifferentialRunner runner;
+    vector<map<string, double>> rows;
+
+    for (double x : { -double(INFINITY), -8.0, -0.0, 0.0, 0.25, 4.0, double(INFINITY) })
+        rows.push_back({ { "x", x }, { "y", 2 }, { "z", -1 } });
+
+    // расхождения, найденные дифференциальным тестированием: понижение силы возведения в степень у -0 и -inf
+    for (string expression : { "root(2, x) + x^0.5", "1 / root(2, x)", "x^-0.5", "1 / x^-0.5", "root(3, x)", "1 / root(3, x)", "(x - 1000) ^ 0.5" })
+        if (runner.Run(expression, rows) > 0)
+            cout << "FAILED: differential " << expression << endl;
+
+    for (const EngineReport& report : runner.GetReports())
+        if (report.mismatches > 0)
+            cout << "FAILED: differential " << report.name << ": " << report.example << endl;
+
+    GeneratorSource source1(42), source2(42);
+    ExpressionGenerator generator1(source1, false), generator2(source2, false);
+
+    for (int i = 0; i < 100; i++) {
+        string expression = generator1.Generate();
+
+        if (expression != generator2.Generate())
+            cout << "FAILED: generator must be deterministic" << endl;
+
+        ExpressionParser parser(expression); // сгенерированное выражение должно разбираться
+    }
+
+    uint8_t bytes[] = { 1, 0 };
+    GeneratorSource fuzzing(bytes, sizeof(bytes));
+
+    if (ExpressionGenerator(fuzzing, true).Generate() != "(x + x)") // после окончания байтов все решения нулевые
+        cout << "FAILED: generator from fuzzer bytes" << endl;
+}
+
+void TestDeepExpression() {
+    const int depth = 50000;
+    string brackets = string(depth, '(') + "x"; // ((x + 1) + 1)...
+    string calls = ""; // max(1, max(1, ... x))
+    string negations = string(depth, '-') + "x"; // - - ... - x
+
+    for (int i = 0; i < depth; i++) {
+        brackets += " + 1)";
+        calls += "max(1, ";
+    }
+
+    calls += "x" + string(depth, ')');
+    vector<pair<string, double>> cases = { { brackets, 2 + depth }, { calls, 2 }, { negations, 2 } };
+
+    for (size_t i = 0; i < cases.size(); i++) {
+        for (size_t tierThreshold : { 0, 1 }) {
+            ExpressionParser parser(cases[i].first, FunctionRegistry(), tierThreshold);
+            parser.SetValue("x", 2);
+
+            if (parser.Evaluate() != cases[i].second || parser.EvaluateRPN() != cases[i].second)
+                cout << "FAILED: deep expression " << i << " with depth " << depth << ": " << parser.Evaluate() << " != " << cases[i].second << endl;
+        }
+    }
+}
+
+void TestStatistics() {
+    ExpressionParser parser("x^3.5 + sin(x)");
+
+    for (int i = 0; i < 10; i++) {
+        parser.SetValue("x", i);
+        parser.Evaluate();
+    }
+
+    ExpressionStatistics statistics = parser.GetStatistics();
+#ifdef EXPRESSION_PARSER_PROFILING
+    if (statistics.evaluations != 10 || statistics.operations["^"].count != 10 || statistics.operations["variable"].count != 20)
+        cout << "FAILED: statistics of x^3.5 + sin(x)" << endl;
+#else
+    if (statistics.evaluations != 0 || statistics.operations.size() != 0)
+        cout << "FAILED: statistics must be empty without EXPRESSION_PARSER_PROFILING" << endl;
+#endif
 }
 
 int main() {
     ExpressionParser calculator("sqrt(abs(x))");
+    vector<double> values(21);
+    calculator.Sweep({ SweepAxis("x", -10, 10, 1) }, values.data());
 
-    for (double x = -10; x <= 10; x++) {
-        calculator.SetValue("x", x);
-        cout << calculator.Evaluate() << endl;
-    }
+    for (double value : values)
+        cout << value << endl;
 
     TestParser("pi", { }, M_PI);
     TestParser("1+2+3+4", { }, 10);
@@ -49,11 +794,235 @@ int main() {
 
     TestParser("max(6, 8)", { }, 8);
     TestParser("min(6, 8)", { }, 6);
+    TestParser("max(6, -8)", { }, 6);
+    TestParser("max(1, 7, 3, 5)", { }, 7);
+    TestParser("min(x, 2, -x, 4)", { { "x", 3 } }, -3);
+    TestParser("sum(1, 2, 3, 4) * 2", { }, 20);
+    TestParser("avg(x, 2, 3, 4)", { { "x", 1 } }, 2.5);
+    TestParser("hypot(3, 4)", { }, 5);
+    TestParser("hypot(2, 3, 6)", { }, 7);
+    TestParser("hypot(x, x)", { { "x", 1e200 } }, sqrt(2) * 1e200, 1e190);
+    TestParser("max(x)", { { "x", -2 } }, -2);
+    TestParser("max(min(1, 2), sum(3, 4), 5) + 1", { }, 8);
+    TestParser("-max(1, 2)^2", { }, -4);
     TestParser("log(2, 8)", { }, 3);
     TestParser("pow(2, 8)", { }, 256);
     TestParser("root(4, 256)", { }, 4);
     TestParser("root(8 / 4 + log(2, 4), 2 ^ 8)", { }, 4);
 
+    TestParser("2*-3", { }, -6);
+    TestParser("2 - -3", { }, 5);
+    TestParser("1 < 2", { }, 1);
+    TestParser("2 <= 1", { }, 0);
+    TestParser("x > 1 == 1", { { "x", 3 } }, 1);
+    TestParser("x >= 3 != 0", { { "x", 3 } }, 1);
+    TestParser("1 + 2 < 2 * 2", { }, 1);
+    TestParser("!x", { { "x", 0 } }, 1);
+    TestParser("!x + 1", { { "x", 5 } }, 1);
+    TestParser("!!x", { { "x", 5 } }, 1);
+    TestParser("-!x", { { "x", 0 } }, -1);
+    TestParser("x > 0 && x < 1 || x == 5", { { "x", 5 } }, 1);
+    TestParser("x > 0 && (x < 1 || x == 4)", { { "x", 5 } }, 0);
+    TestParser("0 || 0 && 1", { }, 0);
+    TestParser("if(x > 0, sqrt(x), -x)", { { "x", 16 } }, 4);
+    TestParser("if(x > 0, sqrt(x), -x)", { { "x", -16 } }, 16);
+    TestParser("if(x, if(y, 1, 2), if(y, 3, 4))", { { "x", 0 }, { "y", 1 } }, 3);
+    TestParser("1 + if(x >= 0 && y >= 0, x * y, 0) * 2", { { "x", 2 }, { "y", 3 } }, 13);
+
     TestParser("(x1 + x2) ^ 2", { { "x1", 3 }, { "x2", 5 } }, 64);
     TestParser("(x123 + x26x) ^ 2", { { "x123", 3 }, { "x26x", 5 } }, 64);
+
+    // понижение силы: целые степени до 16 - умножения (до 8 округлений), x^0.5 - sqrt, root(3, x) - cbrt,
+    // логарифм по постоянному основанию - умножение на обратный логарифм, exp(x*ln2) и 2^x - exp2
+    TestCompiled("x^2", "x square");
+    TestCompiled("x^3", "x cube");
+    TestCompiled("x^-2", "x powi(-2)");
+    TestCompiled("x^7 + y^-5", "x powi(7) y powi(-5) +");
+    TestCompiled("x^-1", "x reciprocal");
+    TestCompiled("x^0", "1");
+    TestCompiled("x^1", "x");
+    TestCompiled("x^0.5", "x root2");
+    TestCompiled("x^-0.5", "x rsqrt");
+    TestCompiled("pow(x, 2.5)", "x 2.5 ^");
+    TestCompiled("(x + 1)^(1 + 1)", "x 1 + square");
+    TestCompiled("root(2, x)", "x root2");
+    TestCompiled("root(3, x)", "x root3");
+    TestCompiled("root(4, x)", "x 0.25 ^");
+    TestCompiled("root(2 + 1, x)", "x root3");
+    TestCompiled("log(2, x)", "x log2");
+    TestCompiled("log(10, x)", "x lg");
+    TestCompiled("log(3, x)", "x logc");
+    TestCompiled("log(x, 3)", "x 3 log");
+    TestCompiled("exp(x*ln2)", "x exp2", 1e-13);
+    TestCompiled("exp(ln2*(x + y))", "x y + exp2", 1e-13);
+    TestCompiled("2^x", "x exp2");
+    TestCompiled("-2^2 + x", "-4 x +");
+
+    TestBatch("sqrt(abs(x))");
+    TestBatch("(x + 1) * (y - 2) / (x * y + 3) - x % 7 + z");
+    TestBatch("sin(x) * cos(y) + exp(-x^2) + ln(abs(y) + 1) + atan(x / (y + 1)) + max(x, y) - min(x, z)");
+    TestBatch("x^-3 + root(3, y) + log(3, abs(x)) + sign(y) * x^3 - x^2.5");
+
+    TestBatch("max(x, y, 0.5) + min(x, -y, z, 1) * sum(x, y, z) - avg(x, y) / hypot(x, y, z)");
+    TestCompiled("max(x, 1, y, 2)", "x 1 y 2 max");
+    // слияние в суперинструкции
+    TestCompiled("x*y + 1", "x y 1 muladd");
+    TestCompiled("1 + x*y", "1 x y addmul");
+    TestCompiled("x*y - 2", "x y 2 mulsub");
+    TestCompiled("2 - x*y", "2 x y submul");
+    TestCompiled("x*x + y*y", "x y sumsq");
+    TestCompiled("(x - y)*(x - y)", "x y - square");
+    TestCompiled("sin(x + 1) * sin(x + 1)", "x 1 + sin square");
+    TestCompiled("-x + y", "x y negadd");
+    TestCompiled("x + -y", "x y -");
+    TestCompiled("x - -y", "x y +");
+    TestCompiled("x*y + sin(x)*y - 3*x*y", "x y x sin y * muladd 3 x * y submul");
+    TestBatch("x*y + 1 - (x - y)*(x - y) + (2 - x*z) * (z*y - 1) + sqrt(x*x + y*y) + (-x + y) / (x - -z)");
+    TestRegisters("x", "return x");
+    TestRegisters("2 + 3", "return 5");
+    TestRegisters("x + 1", "r0 = x + 1; return r0");
+    TestRegisters("sin(x + y) * sin(x + y) + cos(x + y)", "r0 = x + y; r1 = sin(r0); r1 = square(r1); r0 = cos(r0); r0 = r1 + r0; return r0");
+    TestRegisters("(x*y + 1) / (x*y - 1) + x^5", "r0 = muladd(x, y, 1); r1 = mulsub(x, y, 1); r1 = r0 / r1; r0 = powi(x, 5); r0 = r1 + r0; return r0");
+    TestRegisters("max(x, y, z, 2) + if(x > y, sqrt(x), -x) * hypot(x, y) - 2*z", "r0 = max(x, y, z, 2); r1 = x > y; r2 = sqrt(x); r3 = neg(x); r3 = if(r1, r2, r3); r2 = hypot(x, y); r2 = addmul(r0, r3, r2); r2 = submul(r2, 2, z); return r2");
+    TestCompiled("x > 0 && y < 0", "x 0 > jf(4) y 0 < &&");
+    TestCompiled("x < 0 || !(y < 0)", "x 0 < jt(5) y 0 < ! ||");
+    TestCompiled("if(x > 0, sqrt(x), -x)", "x 0 > br(3) x sqrt jmp(2) x neg if");
+    TestCompiled("if(x, if(y, 1, 2), 3) + (1 < 2)", "x br(7) y br(2) 1 jmp(1) 2 if jmp(1) 3 if 1 +");
+    TestCompiled("if(x > y, x - y, y - x) * (x != y && (x > 0 || y > 0))", "x y > br(4) x y - jmp(3) y x - if x y != jf(9) x 0 > jt(4) y 0 > || && *");
+    TestBatch("if(x > 0, sqrt(x), -x) + (x < y) - (y <= 0.5) * (x >= z)");
+    TestBatch("if(x > y, x - y, y - x) * (x != y && (x > 0 || y > 0)) + !(x == 0)");
+    TestCompiled("sum(1, 2, 3) + hypot(x, 0)", "6 x 0 hypot +");
+    TestSweep("sqrt(abs(x)) + z", { SweepAxis("x", -10, 10, 0.1) }, 1);
+    TestSweep("x * y + sin(x) - z", { SweepAxis("x", -10, 10, 0.25), SweepAxis("y", { 1, 2, 3 }) }, 3);
+    TestSweep("x + y * 10 + w * 100", { SweepAxis("w", 0, 9, 1), SweepAxis("x", 0, 9, 1), SweepAxis("y", 0, 9, 1) }, 4);
+    TestSweep("if(x > y, x, y)", { SweepAxis("y", { -1, 0.5 }), SweepAxis("unused", 1, 3, 1), SweepAxis("x", 1, -1, -0.5) }, 2);
+    TestSweep("x", { SweepAxis("x", { }) }, 2);
+
+    vector<double> xs(1000), ys(1000), one = { 4 };
+
+    for (size_t i = 0; i < xs.size(); i++) {
+        xs[i] = sin(i) * 10;
+        ys[i] = cos(i * 0.3);
+    }
+
+    TestSpans("x * k + b", { { "x", xs }, { "k", 2.5 }, { "b", -1 } }, 1);
+    TestSpans("x * k + b", { { "x", xs }, { "k", 2.5 }, { "b", -1 } }, 3, 100);
+    TestSpans("sqrt(abs(x)) * y + max(x, y, k) - z", { { "x", xs }, { "y", ys }, { "k", one } }, 2);
+    TestSpans("if(x > y, x, k) + sin(y)", { { "x", ValueSpan(xs.data(), 300) }, { "y", ValueSpan(ys.data(), 300) }, { "k", 7 } }, 4, 1);
+    TestSpans("x + y", { { "x", 1 }, { "y", one } }, 1);
+    TestSpans("x + 1", { { "x", ValueSpan(xs.data(), 0) }, { "y", 3 } }, 2);
+
+    if (ExpressionParser::GetSweepSize({ SweepAxis("x", 0, 1, 0.1), SweepAxis("y", 0, 30, 7) }) != 11 * 5)
+        cout << "FAILED: sweep size" << endl;
+
+    try {
+        ExpressionParser("x + y").Sweep({ SweepAxis("x", 0, 1, 1), SweepAxis("x", { 2 }) }, values.data());
+        cout << "FAILED: duplicate sweep variable must throw" << endl;
+    }
+    catch (const string& error) {
+    }
+
+    try {
+        SweepAxis("x", 0, 1, -1);
+        cout << "FAILED: sweep range with wrong step must throw" << endl;
+    }
+    catch (const string& error) {
+    }
+
+    TestReduce();
+    TestNumerics();
+    TestDerivative("x^3 - 2*x + 1");
+    TestDerivative("x * y + y / (x^2 + 1) - x % 2");
+    TestDerivative("sin(x) * cos(2*x) + tan(x / 4) + cot(x / 4 + 1)");
+    TestDerivative("sinh(x) + cosh(x / 2) * tanh(x)");
+    TestDerivative("asin(x / 4) + acos(x / 5) + atan(x)");
+    TestDerivative("ln(x^2 + 1) + log2(x^2 + 2) + lg(x^2 + 3) + log(3, x^2 + 4) + log(x^2 + 2, 7)");
+    TestDerivative("exp(-x^2) + 2^x + exp(x * ln2) + sqrt(x^2 + 1) + cbrt(x + 4) + root(3, x + 4) + root(x^2 + 2, 9)");
+    TestDerivative("abs(x - 0.1) + sign(x - 0.1) + x^-3 + x^5 + (x^2 + 1)^-0.5 + (x^2 + 1)^0.5 + (x^2 + 1)^y");
+    TestDerivative("max(x, 1, -x) + min(x^2, 2) + sum(x, x^2, 3) + avg(x, 2*x) + hypot(x, 2, x^2)");
+    TestDerivative("if(x > 0, x^2, -x) + (x > 1) + (x < 2 && x > -2) * x");
+    TestDerivative("x*y + 1 + 1 - x*y + x*x + y*y - (x - y)*(x - y) + -x + y + x*y - 2");
+    TestConditions();
+    TestErrors();
+
+    TestDependencies("x * k + b", "b:1 k:1 x:1");
+    TestDependencies("x*0 + y", "x:0 y:1");
+    TestDependencies("x - x + 3", "x:0 = 3");
+    TestDependencies("x^2*y + sin(z) - 4", "x:2 y:1 z:-1");
+    TestDependencies("(x + 1)^3 * y^-2 + (x*y + 1)^5", "x:5 y:-1");
+    TestDependencies("x*x + y*y + x*y*z", "x:2 y:2 z:1");
+    TestDependencies("x/2 + y/x + sum(x, y, 1)", "x:-1 y:1");
+    TestDependencies("if(c, x, 2*x) + if(1, y, z)", "c:-1 x:1 y:1 z:0");
+    TestDependencies("if(x > 0, 5, 5) + (0 && y) * z", "x:0 y:0 z:0 = 5");
+    TestDependencies("sin(x - x) + (1 || y) + max(x, y)", "x:-1 y:-1");
+    TestDependencies("3 - (x*0)*y + 0*x - 2*(y - y)", "x:0 y:0 = 3");
+    TestDependencies("-(0*x) - 3 + (x - x)*y", "x:0 y:0 = -3");
+
+    if (ExpressionParser("a * 0 + b * c - d / 4").AnalyzeDependencies().GetUsedVariables() != vector<string>({ "b", "c", "d" }))
+        cout << "FAILED: used variables" << endl;
+
+    if (!ExpressionParser("a * b").AnalyzeDependencies().IsLinear("a") || ExpressionParser("a * a").AnalyzeDependencies().IsLinear("a"))
+        cout << "FAILED: linear variables" << endl;
+
+    TestApproximation("sin(x)", 1e-4, "x approx_sin(0)");
+    TestApproximation("cos(y) * 2", 1e-8, "y approx_cos(1) 2 *");
+    TestApproximation("exp(x)", 1e-7, "x approx_exp(1)");
+    TestApproximation("ln(z)", 1e-12, "z ln");
+    TestApproximation("sin(exp(x))", 1e-4, "x exp approx_sin(0)");
+    TestApproximation("if(x > 0, ln(z), exp(sin(y)))", 1e-4, "x 0 > br(3) z approx_ln(0) jmp(3) y sin approx_exp(0) if");
+    TestApproximation("cos(x) - 0.7071", 1e-4, "x cos 0.70709999999999995 -"); // разность может сократиться, ядро остаётся точным
+    TestApproximation("cos(x) + 2", 1e-4, "x approx_cos(0) 2 +");
+    TestApproximation("2 - sin(x) * 0.5", 1e-4, "2 x approx_sin(0) 0.5 submul");
+    TestApproximation("exp(x) + exp(y)", 1e-5, "x approx_exp(0) y approx_exp(0) +");
+    TestApproximation("exp(-x*x) * sin(y)^2 + sqrt(ln(z)^2 + 1) * cos(y)^2 + 1", 1e-4, "x neg x * approx_exp(0) y approx_sin(0) square z approx_ln(0) square 1 + sqrt y approx_cos(0) square * muladd 1 +");
+
+    TestTable("sqrt(abs(x)) + 1", 1, 100, TableGrid::Uniform, TableInterpolation::Cubic, 1e-9);
+    TestTable("sin(x) * x", 0, 3, TableGrid::Uniform, TableInterpolation::Linear, 1e-6);
+    TestTable("exp(-x*x) * cos(3*x) + 2", -2, 2, TableGrid::Chebyshev, TableInterpolation::Cubic, 1e-12);
+    TestTable("if(x > 0, x^3, -x^3) * 1000", -1, 1, TableGrid::Uniform, TableInterpolation::Cubic, 1e-7);
+    TestTable("ln(x) + y * 0", 0.5, 4, TableGrid::Chebyshev, TableInterpolation::Linear, 1e-10);
+
+    for (string expression : { "x + y", "1 / x", "sqrt(abs(x))" }) {
+        try {
+            TableOptions options;
+            options.maxSize = 4096;
+            ExpressionParser(expression).Tabulate("x", -1, 1, options);
+            cout << "FAILED: tabulation of " << expression << " must throw" << endl;
+        }
+        catch (const string& error) {
+        }
+    }
+
+    TestCanonical("a+b", "b + a", true);
+    TestCanonical("sin(x)*2 + 1", "1 + 2*sin(x)", true);
+    TestCanonical("tg(x) * arcsin(y)", "asin(y) * tan(x)", true);
+    TestCanonical("x > y && x >= 1", "1 <= x && y < x", true);
+    TestCanonical("2*3 + x", "x + 6", true);
+    TestCanonical("(a + b) + c", "a + (b + c)", false);
+    TestCanonical("a - b", "b - a", false);
+    TestCanonical("x^2", "x*2", false);
+    TestCanonical("max(x, y)", "max(y, x)", false);
+
+    // хеш не должен меняться между запусками и версиями, так как используется для дедупликации сохранённых формул
+    ExpressionHash hash = ExpressionParser("1 + x").GetHash();
+
+    if (hash.high != 0xe8eb1a9b9e229109ULL || hash.low != 0x925b59043f8d863fULL)
+        cout << "FAILED: hash of 1 + x has changed" << endl;
+
+    TestRegistry();
+    TestDerivative("erf(x) + clamp(x, -1, 1) * lerp(x, y, 0.5)");
+
+    TestTiers();
+    TestEvaluationService();
+    TestDifferential();
+    TestDeepExpression();
+
+    TestCompiledExpression("x + 1");
+    TestCompiledExpression("if(x > 0 && y > 0, sqrt(x * y), -x) + max(x, y, 1) + x^3");
+    TestCompiledExpression("sin(x) * 1 - y / 2 + sin(x) * 2 - y / 3 + sin(x) * 3 - y / 4 + sin(x) * 4 - y / 5 + sin(x) * 5 - y / 6");
+    TestCompiledExpression("erf(x) + clamp(x, -1, 1) * lerp(x, y, 0.5) + g");
+
+    if (!CompiledExpression("x + 1").IsInline() || CompiledExpression("sin(x) * 1 - y / 2 + sin(x) * 2 - y / 3 + sin(x) * 3 - y / 4 + sin(x) * 4 - y / 5 + sin(x) * 5 - y / 6").IsInline())
+        cout << "FAILED: small compiled expressions must be stored inline" << endl;
+    TestStatistics();
 }
\ No newline at end of file
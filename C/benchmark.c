@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <regex.h>
+#include "expression_parser.h"
+
+// названия и формат замеров совпадают с C++/benchmark.cpp, чтобы результаты портов можно было сравнивать напрямую
+
+#define SHORT_EXPRESSION "x + 1"
+#define ARITHMETIC_EXPRESSION "(x + 1) * (y - 2) / (x * y + 3) - x % 7"
+#define TRANSCENDENTAL_EXPRESSION "sin(x) * cos(y) + exp(-x^2) + ln(abs(y) + 1) + atan(x / (y + 1))"
+
+typedef struct {
+    const char *name; // название замера
+    const char *expression; // выражение
+    int variables; // количество переменных x1..xn (0 - переменные x и y)
+    long rows; // количество строк (0 - замер разбора выражения)
+} benchmark_t;
+
+double min_time = 0.5; // минимальное время замера, с
+int json = 0; // вывод в формате json
+int printed = 0; // количество выведенных результатов
+
+volatile double sink; // защита результата от удаления оптимизатором
+
+// текущее время в секундах
+double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// длинное выражение из count слагаемых
+char* make_long_expression(int count) {
+    char *expression = (char *) calloc(count * 40 + 1, sizeof(char));
+
+    for (int i = 0; i < count; i++)
+        sprintf(expression + strlen(expression), "%ssin(x) * %d - y / %d", i > 0 ? " + " : "", i + 1, i + 2);
+
+    return expression;
+}
+
+// выражение с глубиной вложенности скобок depth
+char* make_nested_expression(int depth) {
+    char *expression = (char *) calloc(depth * 6 + 2, sizeof(char));
+    int length = 0;
+
+    for (int i = depth - 1; i >= 0; i--)
+        expression[length++] = '(';
+
+    expression[length++] = 'x';
+
+    for (int i = 0; i < depth; i++)
+        length += sprintf(expression + length, " %c 1)", i % 2 ? '*' : '+');
+
+    return expression;
+}
+
+// выражение от большого количества переменных x1..xcount
+char* make_many_variables_expression(int count) {
+    char *expression = (char *) calloc(count * 16 + 1, sizeof(char));
+
+    for (int i = 1; i < count; i += 2)
+        sprintf(expression + strlen(expression), "%sx%d * x%d", i > 1 ? " + " : "", i, i + 1);
+
+    return expression;
+}
+
+// установка значений переменных для строки row
+void set_row(expression_parser_t *parser, benchmark_t benchmark, long row) {
+    char name[16];
+
+    if (benchmark.variables > 0) {
+        for (int i = 1; i <= benchmark.variables; i++) {
+            sprintf(name, "x%d", i);
+            set_value(parser, name, i * 0.5);
+        }
+    }
+    else if (benchmark.rows > 0) {
+        set_value(parser, "x", -10 + 20.0 * row / benchmark.rows);
+        set_value(parser, "y", 5 - 10.0 * row / benchmark.rows);
+    }
+    else {
+        set_value(parser, "x", 0.75);
+        set_value(parser, "y", -1.25);
+    }
+}
+
+// выполнение замера на заданном количестве итераций, возвращает время в секундах
+double run_iterations(benchmark_t benchmark, long iterations) {
+    expression_parser_t parser;
+    double result = 0;
+    double start = now();
+
+    if (!strncmp(benchmark.name, "BM_Parse", 8)) {
+        for (long i = 0; i < iterations; i++) {
+            init_parser(benchmark.expression, &parser);
+            free_parser(&parser);
+        }
+
+        return now() - start;
+    }
+
+    init_parser(benchmark.expression, &parser);
+    start = now();
+
+    if (benchmark.rows > 0) {
+        for (long i = 0; i < iterations; i++) {
+            for (long row = 0; row < benchmark.rows; row++) {
+                set_row(&parser, benchmark, row);
+                evaluate(parser, &result);
+                sink = result;
+            }
+        }
+    }
+    else {
+        set_row(&parser, benchmark, 0);
+        start = now();
+
+        for (long i = 0; i < iterations; i++) {
+            evaluate(parser, &result);
+            sink = result;
+        }
+    }
+
+    double elapsed = now() - start;
+    free_parser(&parser);
+    return elapsed;
+}
+
+// выполнение замера и вывод результата
+void run_benchmark(benchmark_t benchmark, const regex_t *filter) {
+    if (filter && regexec(filter, benchmark.name, 0, NULL, 0) != 0)
+        return;
+
+    long iterations = 1;
+    double elapsed;
+    clock_t cpu_start, cpu_end;
+
+    while (1) {
+        cpu_start = clock();
+        elapsed = run_iterations(benchmark, iterations);
+        cpu_end = clock();
+
+        if (elapsed >= min_time || iterations >= 1000000000)
+            break;
+
+        double multiplier = elapsed > 0 ? min_time * 1.4 / elapsed : 10;
+        iterations = multiplier > 10 ? iterations * 10 : (long) (iterations * multiplier) + 1;
+    }
+
+    double real_time = elapsed * 1e9 / iterations;
+    double cpu_time = (double) (cpu_end - cpu_start) / CLOCKS_PER_SEC * 1e9 / iterations;
+    double items_per_second = iterations * (benchmark.rows > 0 ? benchmark.rows : 1) / elapsed;
+
+    if (json) {
+        printf("%s    {\n", printed > 0 ? ",\n" : "");
+        printf("      \"name\": \"%s\",\n", benchmark.name);
+        printf("      \"run_name\": \"%s\",\n", benchmark.name);
+        printf("      \"run_type\": \"iteration\",\n");
+        printf("      \"iterations\": %ld,\n", iterations);
+        printf("      \"real_time\": %.17g,\n", real_time);
+        printf("      \"cpu_time\": %.17g,\n", cpu_time);
+        printf("      \"items_per_second\": %.17g,\n", items_per_second);
+        printf("      \"time_unit\": \"ns\"\n");
+        printf("    }");
+    }
+    else {
+        printf("%-48s%13.1f ns%13.1f ns%14ld items_per_second=%.4g/s\n", benchmark.name, real_time, cpu_time, iterations, items_per_second);
+    }
+
+    printed++;
+}
+
+int main(int argc, char **argv) {
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--benchmark_filter=", 19)) {
+            filter = argv[i] + 19;
+        }
+        else if (!strcmp(argv[i], "--benchmark_format=json")) {
+            json = 1;
+        }
+        else if (!strcmp(argv[i], "--benchmark_format=console")) {
+            json = 0;
+        }
+        else if (!strncmp(argv[i], "--benchmark_min_time=", 21)) {
+            char *end;
+            min_time = strtod(argv[i] + 21, &end);
+
+            if (end == argv[i] + 21 || *end || !isfinite(min_time) || min_time < 0) {
+                fprintf(stderr, "Incorrect minimum time '%s'\n", argv[i] + 21);
+                return 1;
+            }
+        }
+        else {
+            fprintf(stderr, "Unknown argument '%s'\n", argv[i]);
+            fprintf(stderr, "Usage: %s [--benchmark_filter=<regex>] [--benchmark_format=console|json] [--benchmark_min_time=<seconds>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // фильтр - расширенное регулярное выражение POSIX, как в C++/Benchmark.hpp
+    regex_t pattern;
+
+    if (filter && *filter && regcomp(&pattern, filter, REG_EXTENDED | REG_NOSUB) != 0) {
+        fprintf(stderr, "Incorrect benchmark filter '%s'\n", filter);
+        return 1;
+    }
+
+    char *long_expression = make_long_expression(100);
+    char *nested_expression = make_nested_expression(200);
+    char *many_variables_expression = make_many_variables_expression(32);
+
+    benchmark_t benchmarks[] = {
+        { "BM_Parse/short", SHORT_EXPRESSION, 0, 0 },
+        { "BM_Parse/long", long_expression, 0, 0 },
+        { "BM_Parse/nested", nested_expression, 0, 0 },
+        { "BM_Evaluate/arithmetic", ARITHMETIC_EXPRESSION, 0, 0 },
+        { "BM_Evaluate/transcendental", TRANSCENDENTAL_EXPRESSION, 0, 0 },
+        { "BM_Evaluate/many_variables", many_variables_expression, 32, 0 },
+        { "BM_Rows/rows:16", TRANSCENDENTAL_EXPRESSION, 0, 16 },
+        { "BM_Rows/rows:256", TRANSCENDENTAL_EXPRESSION, 0, 256 },
+        { "BM_Rows/rows:4096", TRANSCENDENTAL_EXPRESSION, 0, 4096 },
+        { "BM_Rows/rows:65536", TRANSCENDENTAL_EXPRESSION, 0, 65536 }
+    };
+
+    if (json) {
+        printf("{\n");
+        printf("  \"context\": {\n");
+        printf("    \"port\": \"C\"\n");
+        printf("  },\n");
+        printf("  \"benchmarks\": [\n");
+    }
+    else {
+        printf("%-48s%16s%16s%14s UserCounters...\n", "Benchmark", "Time", "CPU", "Iterations");
+    }
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+        run_benchmark(benchmarks[i], filter && *filter ? &pattern : NULL);
+
+    if (json)
+        printf("\n  ]\n}\n");
+
+    free(long_expression);
+    free(nested_expression);
+    free(many_variables_expression);
+
+    if (filter && *filter)
+        regfree(&pattern);
+
+    return 0;
+}
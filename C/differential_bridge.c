@@ -0,0 +1,26 @@
+#include "expression_parser.h"
+
+// мост для дифференциального сравнения портов: вычисление выражения портом на C из отдельной единицы трансляции,
+// так как заголовок порта определяет функции и не может подключаться вместе с кодом на C++
+
+// вычисление выражения с заданными значениями переменных, возвращает 0 при успехе
+int c_port_evaluate(const char *expression, int count, const char **names, const double *values, double *result) {
+    expression_parser_t parser;
+    memset(&parser, 0, sizeof(parser)); // при ошибке разбора часть массивов не инициализируется
+
+    if (init_parser(expression, &parser)) {
+        free_parser(&parser);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int index = index_of_variable(parser.variables, (char *) names[i]);
+
+        if (index > -1)
+            parser.variables.variables[index].value = values[i];
+    }
+
+    int status = evaluate(parser, result);
+    free_parser(&parser);
+    return status;
+}
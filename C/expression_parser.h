@@ -387,6 +387,8 @@ double evaluate_constant(const char *name) {
 
 // инициализация парсера
 int init_parser(const char *expression, expression_parser_t *parser) {
+    parser->variables = init_variables();
+
     // разбиваем на лексемы
     if (split_to_lexemes(expression, parser))
         return -1;
@@ -397,6 +399,16 @@ int init_parser(const char *expression, expression_parser_t *parser) {
     return 0;
 }
 
+// освобождение памяти парсера
+void free_parser(expression_parser_t *parser) {
+    for (int i = 0; i < parser->lexemes.size; i++)
+        free(parser->lexemes.lexemes[i]); // польская запись и переменные ссылаются на эти же строки
+
+    free(parser->lexemes.lexemes);
+    free(parser->rpn.lexemes);
+    free(parser->variables.variables);
+}
+
 // обновление значения переменной
 void set_value(expression_parser_t *parser, char *name, double value) {
     parser->variables.variables[index_of_variable(parser->variables, name)].value = value;